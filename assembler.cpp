@@ -0,0 +1,957 @@
+/*
+File: assembler.cpp
+Author: Brysen Landis
+*/
+
+#include "assembler.h"
+#include "machine.h"
+#include "register_file.h"
+#include "encoding.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <map>
+#include <thread>
+
+// Source files are assembled in two phases over line-aligned chunks of the
+// mapped file. Phase one lexes each chunk on its own, sizing every line and
+// recording label definitions at chunk-relative offsets. Summing the chunk
+// sizes then places every chunk and resolves the label table, and phase two
+// encodes each chunk at its final address. A chunk only ever writes its own
+// slots of the output, so both phases run one chunk per thread.
+
+static const size_t MIN_CHUNK_BYTES = 256 * 1024;
+
+struct SourceLine
+{
+    std::string_view text;
+    unsigned int offset;    // words into the chunk's text, or bytes into its data
+    unsigned int size;      // machine words, or data bytes
+    bool data;
+};
+
+struct ChunkLabel
+{
+    std::string_view name;
+    unsigned int offset;
+    bool data;
+};
+
+// A file included with .incbin. Its bytes never enter the chunk's data image;
+// whole pages are mapped into guest memory straight from the file.
+struct Assembler::IncludedFile
+{
+    std::shared_ptr<MappedFile> file;
+    size_t fileOffset;
+    unsigned int offset;    // bytes into the chunk's data, a page boundary once placed
+    unsigned int size;
+};
+
+struct Assembler::SourceChunk
+{
+    std::string_view text;
+    int endSection = -1;        // last .text (0) or .data (1) directive, -1 if none
+    bool startsInData = false;
+
+    // Phase one
+    std::vector<SourceLine> lines;
+    std::vector<ChunkLabel> labels;
+    unsigned int textWords = 0;
+    unsigned int dataBytes = 0;
+    unsigned int instructions = 0;
+    size_t lineCount = 0;
+    std::vector<IncludedFile> included;
+
+    // Placement, then phase two
+    unsigned int textIndex = 0; // first word, counted from TEXT_BASE
+    unsigned int dataAddr = 0;
+    std::vector<unsigned char> dataImage;
+};
+
+// Runs task(0) .. task(count - 1) on up to threads threads, the caller included
+template <typename Task>
+static void runParallel(size_t count, unsigned int threads, Task task)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++) task(i);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads && t < count; t++) pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool) thread.join();
+}
+
+Assembler::Assembler(unsigned int threads, std::ostream& messages)
+    : loaded(std::make_shared<Program>()), labels(&loaded->labels), missingLabel(Machine::TEXT_BASE),
+      assemblerThreads(threads), messages(&messages), instructions(0), included(false)
+{
+    loaded->entry = Machine::TEXT_BASE;
+    loaded->dataEnd = Machine::DATA_BASE;
+}
+
+Assembler::Assembler(const LabelTable& labels, unsigned int pc)
+    : labels(&labels), missingLabel(pc), assemblerThreads(1), messages(nullptr), instructions(0), included(false)
+{
+}
+
+std::shared_ptr<Program> assembleSource(const std::string& filename, unsigned int threads, std::ostream& messages)
+{
+    Assembler assembler(threads, messages);
+    if (!assembler.parseFile(filename)) return nullptr;
+    return assembler.program();
+}
+
+bool Assembler::parseFile(const std::string& filename)
+{
+    // Lines and tokens are views into the mapped file, so nothing is copied
+    // until an instruction's text is kept for the listing
+    MappedFile file(filename);
+    if (!file.isOpen())
+    {
+        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        return false;
+    }
+    const std::string_view source(reinterpret_cast<const char*>(file.data()), file.size());
+    size_t slash = filename.find_last_of('/');
+    includeDir = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+    unsigned int threads = assemblerThreads ? assemblerThreads : std::max(1u, std::thread::hardware_concurrency());
+    size_t chunkCount = 1;
+    if (threads > 1)
+    {
+        chunkCount = std::max<size_t>(1, std::min<size_t>(threads * 4, source.size() / MIN_CHUNK_BYTES));
+    }
+
+    std::vector<SourceChunk> chunks(chunkCount);
+    size_t start = 0;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        size_t end = std::max(start, source.size() / chunkCount * (i + 1));
+        if (i + 1 == chunkCount || end >= source.size())
+        {
+            end = source.size();
+        }
+        else
+        {
+            end = source.find('\n', end);
+            end = end == std::string_view::npos ? source.size() : end + 1;
+        }
+        chunks[i].text = source.substr(start, end - start);
+        start = end;
+    }
+
+    // Each chunk starts in the section the chunks before it left behind. Only
+    // whole-line directives switch sections, so a backwards search settles it.
+    auto lastSection = [](std::string_view text)
+    {
+        for (size_t pos = text.size(); pos > 0; )
+        {
+            size_t dot = text.rfind('.', pos - 1);
+            if (dot == std::string_view::npos) break;
+            size_t lineStart = text.rfind('\n', dot);
+            lineStart = lineStart == std::string_view::npos ? 0 : lineStart + 1;
+            std::string_view line = cleanLine(text.substr(lineStart, text.find('\n', dot) - lineStart));
+            if (line == ".text") return 0;
+            if (line == ".data") return 1;
+            pos = lineStart;
+        }
+        return -1;
+    };
+    if (chunkCount > 1)
+    {
+        runParallel(chunkCount, threads, [&](size_t i) { chunks[i].endSection = lastSection(chunks[i].text); });
+    }
+    bool data = false;
+    for (SourceChunk& chunk : chunks)
+    {
+        chunk.startsInData = data;
+        if (chunk.endSection >= 0) data = chunk.endSection == 1;
+    }
+
+    runParallel(chunkCount, threads, [&](size_t i) { scanChunk(chunks[i]); });
+
+    // Place the chunks and define their labels in source order, so a label
+    // defined twice keeps its last address
+    unsigned int textWords = 0;
+    unsigned int dataAddr = Machine::DATA_BASE;
+    unsigned int instructionCount = 0;
+    size_t lineCount = 0;
+    for (SourceChunk& chunk : chunks)
+    {
+        chunk.textIndex = textWords;
+        chunk.dataAddr = dataAddr;
+        if (!chunk.included.empty()) alignIncluded(chunk);
+        for (const ChunkLabel& label : chunk.labels)
+        {
+            loaded->labels.insert_or_assign(std::string(label.name),
+                                    label.data ? dataAddr + label.offset : Machine::TEXT_BASE + (textWords + label.offset) * 4);
+        }
+        textWords += chunk.textWords;
+        dataAddr += chunk.dataBytes;
+        instructionCount += chunk.instructions;
+        lineCount += chunk.lineCount;
+    }
+
+    // Assemble now that every label is known. Source lines that expand to
+    // several machine words are listed once per word.
+    std::vector<unsigned int> words(textWords);
+    loaded->listing.resize(textWords);
+    loaded->code.resize(textWords);
+    runParallel(chunkCount, threads, [&](size_t i) { assembleChunk(chunks[i], words); });
+
+    for (unsigned int i = 0; i < textWords; i++)
+    {
+        loaded->image.storeWord(Machine::TEXT_BASE + i * 4, words[i]);
+    }
+    // Pages that would hold only .space zeros are left unallocated
+    auto writeData = [this](unsigned int addr, const unsigned char* image, size_t size)
+    {
+        for (size_t offset = 0; offset < size; )
+        {
+            size_t span = std::min<size_t>(size - offset, Memory::PAGE_SIZE - ((addr + offset) & Memory::PAGE_MASK));
+            const unsigned char* bytes = image + offset;
+            if (std::any_of(bytes, bytes + span, [](unsigned char b) { return b != 0; }))
+            {
+                loaded->image.writeBlock(addr + static_cast<unsigned int>(offset), bytes, span);
+            }
+            offset += span;
+        }
+    };
+    included = false;
+    for (const SourceChunk& chunk : chunks)
+    {
+        // The data image leaves out included files, which sit between its pieces
+        size_t imageOffset = 0;
+        unsigned int offset = 0;
+        for (const IncludedFile& include : chunk.included)
+        {
+            writeData(chunk.dataAddr + offset, chunk.dataImage.data() + imageOffset, include.offset - offset);
+            imageOffset += include.offset - offset;
+            mapIncluded(include, chunk.dataAddr + include.offset);
+            offset = include.offset + include.size;
+            included = true;
+        }
+        writeData(chunk.dataAddr + offset, chunk.dataImage.data() + imageOffset, chunk.dataImage.size() - imageOffset);
+    }
+
+    loaded->entry = Machine::TEXT_BASE;
+    loaded->dataEnd = dataAddr;
+    loaded->sourceLines = lineCount;
+    instructions = instructionCount;
+
+    *messages << "Loaded " << instructionCount << " instructions from " << filename << std::endl;
+    *messages << "Found " << loaded->labels.size() << " labels" << std::endl;
+    return true;
+}
+
+// Phase one: classifies and sizes every line of a chunk. Nothing outside the
+// chunk is written, and labels are only read, so chunks scan concurrently.
+void Assembler::scanChunk(SourceChunk& chunk)
+{
+    std::vector<std::string_view> tokens;
+    bool data = chunk.startsInData;
+
+    for (size_t pos = 0; pos < chunk.text.size(); )
+    {
+        size_t eol = chunk.text.find('\n', pos);
+        if (eol == std::string_view::npos) eol = chunk.text.size();
+        std::string_view cleaned = cleanLine(chunk.text.substr(pos, eol - pos));
+        pos = eol + 1;
+        chunk.lineCount++;
+        if (cleaned.empty()) continue;
+
+        // Check for section directives
+        if (cleaned == ".text")
+        {
+            data = false;
+            chunk.endSection = 0;
+            continue;
+        }
+        else if (cleaned == ".data")
+        {
+            data = true;
+            chunk.endSection = 1;
+            continue;
+        }
+        else if (cleaned.substr(0, 6) == ".globl" || cleaned.substr(0, 7) == ".global")
+        {
+            // Ignore global directive
+            continue;
+        }
+
+        // Check for labels
+        size_t colonPos = cleaned.find(':');
+        if (colonPos != std::string_view::npos && colonPos < cleaned.find('"'))
+        {
+            chunk.labels.push_back({ cleaned.substr(0, colonPos), data ? chunk.dataBytes : chunk.textWords, data });
+
+            // Process rest of line after label
+            cleaned = cleanLine(cleaned.substr(colonPos + 1));
+            if (cleaned.empty()) continue;
+        }
+
+        tokenize(cleaned, tokens);
+        if (data && !tokens.empty() && tokens[0] == ".incbin")
+        {
+            scanIncluded(chunk, cleaned);
+            continue;
+        }
+        if (data)
+        {
+            unsigned int size = dataDirective(tokens, cleaned, nullptr);
+            if (size == 0) continue;
+            chunk.lines.push_back({ cleaned, chunk.dataBytes, size, true });
+            chunk.dataBytes += size;
+        }
+        else
+        {
+            unsigned int size = instructionWords(tokens);
+            chunk.lines.push_back({ cleaned, chunk.textWords, size, false });
+            chunk.textWords += size;
+            chunk.instructions++;
+        }
+    }
+}
+
+// Phase two: encodes a placed chunk into its own range of words, textSegment
+// and program, and builds its data image
+void Assembler::assembleChunk(SourceChunk& chunk, std::vector<unsigned int>& words)
+{
+    std::vector<std::string_view> tokens;
+    std::vector<unsigned int> encoded;
+    unsigned int includedBytes = 0;
+    for (const IncludedFile& include : chunk.included) includedBytes += include.size;
+    chunk.dataImage.assign(chunk.dataBytes - includedBytes, 0);
+
+    // Data lines after an included file sit that much further into the
+    // chunk than into its image
+    size_t nextInclude = 0;
+    unsigned int skipped = 0;
+    for (const SourceLine& line : chunk.lines)
+    {
+        tokenize(line.text, tokens);
+        if (line.data)
+        {
+            while (nextInclude < chunk.included.size() && chunk.included[nextInclude].offset < line.offset)
+            {
+                skipped += chunk.included[nextInclude++].size;
+            }
+            dataDirective(tokens, line.text, chunk.dataImage.data() + line.offset - skipped);
+            continue;
+        }
+
+        unsigned int index = chunk.textIndex + line.offset;
+        unsigned int addr = Machine::TEXT_BASE + index * 4;
+        encoded.clear();
+        encodeInstruction(decodeInstruction(tokens, line.text, addr), addr, encoded);
+        if (encoded.size() != line.size)
+        {
+            std::cerr << "Error: Cannot assemble instruction: " << line.text << std::endl;
+            encoded.resize(line.size, 0);
+        }
+        for (unsigned int word : encoded)
+        {
+            words[index] = word;
+            loaded->listing[index] = std::string(line.text);
+            loaded->code[index] = decodeWord(word, addr);
+            index++;
+            addr += 4;
+        }
+    }
+}
+
+// Assembles one data directive into out, which must have room for it, and
+// returns its size in bytes. With a null out the directive is only sized, so
+// labels it refers to need not be defined yet.
+unsigned int Assembler::dataDirective(const std::vector<std::string_view>& tokens, std::string_view line,
+                                            unsigned char* out)
+{
+    if (tokens.empty()) return 0;
+
+    unsigned int size = 0;
+    try
+    {
+        if (tokens[0] == ".word")
+        {
+            for (size_t i = 1; i < tokens.size(); i++)
+            {
+                if (out)
+                {
+                    // Guest memory is little-endian
+                    unsigned int value = static_cast<unsigned int>(parseImmediate(tokens[i]));
+                    for (int b = 0; b < 4; b++) out[size + b] = static_cast<unsigned char>(value >> (b * 8));
+                }
+                size += 4;
+            }
+        }
+        else if (tokens[0] == ".byte")
+        {
+            for (size_t i = 1; i < tokens.size(); i++)
+            {
+                if (out) out[size] = static_cast<unsigned char>(parseImmediate(tokens[i]));
+                size += 1;
+            }
+        }
+        else if (tokens[0] == ".asciiz" || tokens[0] == ".ascii")
+        {
+            // Take the string between quotes straight from the line, so commas
+            // and runs of spaces inside it survive
+            size_t start = line.find('"');
+            size_t end = line.rfind('"');
+            if (start != std::string_view::npos && end != std::string_view::npos && start < end)
+            {
+                std::string_view str = line.substr(start + 1, end - start - 1);
+
+                // Process escape sequences
+                for (size_t i = 0; i < str.length(); i++)
+                {
+                    char c = str[i];
+                    if (c == '\\' && i + 1 < str.length())
+                    {
+                        char nextChar = str[i + 1];
+                        if (nextChar == 'n') c = '\n';
+                        else if (nextChar == 't') c = '\t';
+                        else if (nextChar == '0') c = '\0';
+                        else continue;
+                        i++;
+                    }
+                    if (out) out[size] = static_cast<unsigned char>(c);
+                    size++;
+                }
+
+                if (tokens[0] == ".asciiz")
+                {
+                    if (out) out[size] = '\0';
+                    size++;
+                }
+            }
+        }
+        else if (tokens[0] == ".space")
+        {
+            // The zeros are already in out, so only the size matters
+            if (!out && tokens.size() > 1)
+            {
+                int space = parseImmediate(tokens[1]);
+                if (space > 0) size = static_cast<unsigned int>(space);
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        std::cerr << "Error: Invalid data directive: " << line << std::endl;
+    }
+    return size;
+}
+
+// .incbin "file"[, offset[, length]] includes length bytes of a file from
+// offset, or the rest of it, as data. Paths are relative to the source file.
+void Assembler::scanIncluded(SourceChunk& chunk, std::string_view line)
+{
+    size_t start = line.find('"');
+    size_t end = line.rfind('"');
+    if (start == std::string_view::npos || end == start)
+    {
+        std::cerr << "Error: Invalid data directive: " << line << std::endl;
+        return;
+    }
+    std::string name(line.substr(start + 1, end - start - 1));
+    std::string path = name[0] == '/' ? name : includeDir + name;
+
+    size_t fileOffset = 0;
+    long long length = -1;
+    std::vector<std::string_view> args;
+    tokenize(line.substr(end + 1), args);
+    try
+    {
+        if (args.size() > 0) fileOffset = static_cast<size_t>(std::max(0, parseImmediate(args[0])));
+        if (args.size() > 1) length = std::max(0, parseImmediate(args[1]));
+    }
+    catch (const std::exception&)
+    {
+        std::cerr << "Error: Invalid data directive: " << line << std::endl;
+        return;
+    }
+
+    // Mapped with private writes so the pages can go straight into memory
+    auto file = std::make_shared<MappedFile>(path, true);
+    if (!file->isOpen())
+    {
+        std::cerr << "Error: Cannot open file " << path << std::endl;
+        return;
+    }
+    size_t available = fileOffset < file->size() ? file->size() - fileOffset : 0;
+    size_t size = length < 0 ? available : std::min<size_t>(available, static_cast<size_t>(length));
+    if (size == 0) return;
+
+    chunk.included.push_back({ file, fileOffset, chunk.dataBytes, static_cast<unsigned int>(size) });
+    chunk.dataBytes += static_cast<unsigned int>(size);
+}
+
+// Pads a placed chunk's data so each included file starts on a page,
+// moving the data lines and labels after it along
+void Assembler::alignIncluded(SourceChunk& chunk)
+{
+    // Each include's padding applies to everything from its original offset on
+    std::vector<std::pair<unsigned int, unsigned int>> shifts; // original offset, total shift
+    unsigned int shift = 0;
+    for (IncludedFile& include : chunk.included)
+    {
+        unsigned int original = include.offset;
+        unsigned int addr = chunk.dataAddr + original + shift;
+        shift += (Memory::PAGE_SIZE - (addr & Memory::PAGE_MASK)) & Memory::PAGE_MASK;
+        include.offset = original + shift;
+        shifts.push_back({ original, shift });
+    }
+
+    auto shiftFor = [&](unsigned int offset)
+    {
+        unsigned int total = 0;
+        for (const auto& entry : shifts)
+        {
+            if (entry.first > offset) break;
+            total = entry.second;
+        }
+        return total;
+    };
+    for (SourceLine& line : chunk.lines)
+    {
+        if (line.data) line.offset += shiftFor(line.offset);
+    }
+    for (ChunkLabel& label : chunk.labels)
+    {
+        if (label.data) label.offset += shiftFor(label.offset);
+    }
+    chunk.dataBytes += shift;
+}
+
+// Whole pages of an included file are shared with the mapping, which stays
+// alive as long as any memory uses them; a partial last page, or a file
+// offset off a page boundary, is copied
+void Assembler::mapIncluded(const IncludedFile& include, unsigned int addr)
+{
+    unsigned char* bytes = include.file->privateData() + include.fileOffset;
+    size_t mapped = 0;
+    if ((include.fileOffset & Memory::PAGE_MASK) == 0)
+    {
+        for (; mapped + Memory::PAGE_SIZE <= include.size; mapped += Memory::PAGE_SIZE)
+        {
+            loaded->image.attachPage((addr + static_cast<unsigned int>(mapped)) >> Memory::PAGE_BITS, include.file,
+                                     bytes + mapped);
+        }
+    }
+    loaded->image.writeBlock(addr + static_cast<unsigned int>(mapped), bytes + mapped, include.size - mapped);
+}
+
+std::string_view cleanLine(std::string_view line)
+{
+    // Remove comments, leaving a '#' inside a string literal alone
+    bool inString = false;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        if (line[i] == '"' && (i == 0 || line[i - 1] != '\\'))
+        {
+            inString = !inString;
+        }
+        else if (line[i] == '#' && !inString)
+        {
+            line = line.substr(0, i);
+            break;
+        }
+    }
+    
+    // Trim whitespace
+    size_t start = line.find_first_not_of(" \t\r\n");
+    size_t end = line.find_last_not_of(" \t\r\n");
+    
+    if (start == std::string_view::npos) return std::string_view();
+    return line.substr(start, end - start + 1);
+}
+
+static bool isTokenSeparator(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r' || c == '\n';
+}
+
+void tokenize(std::string_view line, std::vector<std::string_view>& tokens)
+{
+    tokens.clear();
+    size_t i = 0;
+    while (i < line.size())
+    {
+        if (isTokenSeparator(line[i]))
+        {
+            i++;
+            continue;
+        }
+        
+        size_t start = i;
+        while (i < line.size() && !isTokenSeparator(line[i]) && line[i] != '(') i++;
+        if (i > start) tokens.push_back(line.substr(start, i - start));
+        
+        // Handle parentheses for memory operations: offset($reg)
+        if (i < line.size() && line[i] == '(')
+        {
+            size_t close = line.find(')', i);
+            if (close == std::string_view::npos) close = line.size();
+            size_t first = i + 1;
+            size_t last = close;
+            while (first < last && isTokenSeparator(line[first])) first++;
+            while (last > first && isTokenSeparator(line[last - 1])) last--;
+            tokens.push_back(line.substr(first, last - first));
+            i = close + 1;
+        }
+    }
+}
+
+int Assembler::parseImmediate(std::string_view str)
+{
+    if (str.empty()) return 0;
+    
+    // Check for label reference; labels never start with a digit or sign
+    if (!std::isdigit(static_cast<unsigned char>(str[0])) && str[0] != '-' && str[0] != '+')
+    {
+        auto label = labels->find(str);
+        if (label != labels->end()) return static_cast<int>(label->second);
+    }
+    
+    // Like std::stoi, trailing characters are ignored and a missing number throws
+    const char* first = str.data();
+    const char* last = first + str.size();
+    std::from_chars_result result;
+    int value = 0;
+    
+    // Handle hex
+    if (str.size() > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+    {
+        unsigned int hex = 0;
+        result = std::from_chars(first + 2, last, hex, 16);
+        value = static_cast<int>(hex);
+    }
+    else
+    {
+        // Handle decimal (including negative)
+        if (*first == '+') first++;
+        result = std::from_chars(first, last, value);
+    }
+    
+    if (result.ec == std::errc::invalid_argument) throw std::invalid_argument("immediate");
+    if (result.ec == std::errc::result_out_of_range) throw std::out_of_range("immediate");
+    return value;
+}
+
+int Assembler::getRegisterNumber(std::string_view regName)
+{
+    static const std::string_view names[32] = {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+    };
+    
+    std::string_view clean = regName;
+    if (!clean.empty() && clean[0] == '$') clean.remove_prefix(1);
+    
+    // Check if it's a number
+    if (!clean.empty() && std::isdigit(static_cast<unsigned char>(clean[0])))
+    {
+        int regNum = -1;
+        std::from_chars(clean.data(), clean.data() + clean.size(), regNum);
+        return regNum;
+    }
+    
+    for (int i = 0; i < 32; i++)
+    {
+        if (names[i] == clean) return i;
+    }
+    
+    // Reports the bad name
+    return RegisterFile::getRegNumber(std::string(clean.empty() ? regName : clean));
+}
+
+bool Assembler::isLabel(std::string_view token)
+{
+    return labels->find(token) != labels->end();
+}
+
+unsigned int Assembler::getLabelAddress(std::string_view label)
+{
+    auto it = labels->find(label);
+    if (it != labels->end())
+    {
+        return it->second;
+    }
+    std::cerr << "Error: Label " << label << " not found" << std::endl;
+    return missingLabel;
+}
+
+// Operand layouts accepted by the decoder
+enum OperandFormat
+{
+    FMT_NONE,           // syscall
+    FMT_RD_RS_RT,       // add $rd, $rs, $rt
+    FMT_RD_RT_SHAMT,    // sll $rd, $rt, shamt
+    FMT_RD_RT_RS,       // sllv $rd, $rt, $rs
+    FMT_RS_RT,          // mult $rs, $rt
+    FMT_RD,             // mfhi $rd
+    FMT_RS,             // jr $rs
+    FMT_JALR,           // jalr $rd, $rs  or  jalr $rs
+    FMT_RT_RS_IMM,      // addi $rt, $rs, imm
+    FMT_RT_IMM,         // lui $rt, imm
+    FMT_MEM,            // lw $rt, offset($rs)  or  lw $rt, label
+    FMT_RS_RT_LABEL,    // beq $rs, $rt, label
+    FMT_RS_LABEL,       // bgtz $rs, label
+    FMT_LABEL,          // j label
+    FMT_RD_RS           // move $rd, $rs
+};
+
+struct OpcodeInfo
+{
+    Opcode op;
+    OperandFormat format;
+    size_t operands;
+};
+
+static const std::map<std::string, OpcodeInfo, std::less<>>& opcodeTable()
+{
+    static const std::map<std::string, OpcodeInfo, std::less<>> table = {
+        {"add",   {OP_ADD,   FMT_RD_RS_RT, 3}}, {"addu",  {OP_ADDU,  FMT_RD_RS_RT, 3}},
+        {"sub",   {OP_SUB,   FMT_RD_RS_RT, 3}}, {"subu",  {OP_SUBU,  FMT_RD_RS_RT, 3}},
+        {"and",   {OP_AND,   FMT_RD_RS_RT, 3}}, {"or",    {OP_OR,    FMT_RD_RS_RT, 3}},
+        {"xor",   {OP_XOR,   FMT_RD_RS_RT, 3}}, {"nor",   {OP_NOR,   FMT_RD_RS_RT, 3}},
+        {"slt",   {OP_SLT,   FMT_RD_RS_RT, 3}}, {"sltu",  {OP_SLTU,  FMT_RD_RS_RT, 3}},
+        {"sll",   {OP_SLL,   FMT_RD_RT_SHAMT, 3}}, {"srl", {OP_SRL,  FMT_RD_RT_SHAMT, 3}},
+        {"sra",   {OP_SRA,   FMT_RD_RT_SHAMT, 3}},
+        {"sllv",  {OP_SLLV,  FMT_RD_RT_RS, 3}}, {"srlv",  {OP_SRLV,  FMT_RD_RT_RS, 3}},
+        {"srav",  {OP_SRAV,  FMT_RD_RT_RS, 3}},
+        {"mult",  {OP_MULT,  FMT_RS_RT, 2}}, {"multu", {OP_MULTU, FMT_RS_RT, 2}},
+        {"div",   {OP_DIV,   FMT_RS_RT, 2}}, {"divu",  {OP_DIVU,  FMT_RS_RT, 2}},
+        {"mfhi",  {OP_MFHI,  FMT_RD, 1}}, {"mflo",  {OP_MFLO,  FMT_RD, 1}},
+        {"mthi",  {OP_MTHI,  FMT_RS, 1}}, {"mtlo",  {OP_MTLO,  FMT_RS, 1}},
+        {"jr",    {OP_JR,    FMT_RS, 1}}, {"jalr",  {OP_JALR,  FMT_JALR, 1}},
+        {"addi",  {OP_ADDI,  FMT_RT_RS_IMM, 3}}, {"addiu", {OP_ADDIU, FMT_RT_RS_IMM, 3}},
+        {"andi",  {OP_ANDI,  FMT_RT_RS_IMM, 3}}, {"ori",   {OP_ORI,   FMT_RT_RS_IMM, 3}},
+        {"xori",  {OP_XORI,  FMT_RT_RS_IMM, 3}}, {"slti",  {OP_SLTI,  FMT_RT_RS_IMM, 3}},
+        {"sltiu", {OP_SLTIU, FMT_RT_RS_IMM, 3}}, {"lui",   {OP_LUI,   FMT_RT_IMM, 2}},
+        {"lw",    {OP_LW,    FMT_MEM, 2}}, {"lh",    {OP_LH,    FMT_MEM, 2}},
+        {"lhu",   {OP_LHU,   FMT_MEM, 2}}, {"lb",    {OP_LB,    FMT_MEM, 2}},
+        {"lbu",   {OP_LBU,   FMT_MEM, 2}}, {"sw",    {OP_SW,    FMT_MEM, 2}},
+        {"sh",    {OP_SH,    FMT_MEM, 2}}, {"sb",    {OP_SB,    FMT_MEM, 2}},
+        {"beq",   {OP_BEQ,   FMT_RS_RT_LABEL, 3}}, {"bne", {OP_BNE,  FMT_RS_RT_LABEL, 3}},
+        {"blt",   {OP_BLT,   FMT_RS_RT_LABEL, 3}}, {"ble", {OP_BLE,  FMT_RS_RT_LABEL, 3}},
+        {"bgt",   {OP_BGT,   FMT_RS_RT_LABEL, 3}}, {"bge", {OP_BGE,  FMT_RS_RT_LABEL, 3}},
+        {"bltz",  {OP_BLTZ,  FMT_RS_LABEL, 2}}, {"blez",  {OP_BLEZ,  FMT_RS_LABEL, 2}},
+        {"bgtz",  {OP_BGTZ,  FMT_RS_LABEL, 2}}, {"bgez",  {OP_BGEZ,  FMT_RS_LABEL, 2}},
+        {"j",     {OP_J,     FMT_LABEL, 1}}, {"jal",   {OP_JAL,   FMT_LABEL, 1}},
+        {"syscall", {OP_SYSCALL, FMT_NONE, 0}}, {"nop", {OP_NOP, FMT_NONE, 0}},
+        {"li",    {OP_LI,    FMT_RT_IMM, 2}}, {"la",    {OP_LA,    FMT_RT_IMM, 2}},
+        {"move",  {OP_MOVE,  FMT_RD_RS, 2}}, {"clear", {OP_CLEAR, FMT_RD, 1}},
+        {"not",   {OP_NOT,   FMT_RD_RS, 2}}
+    };
+    return table;
+}
+
+int Assembler::decodeRegister(std::string_view regName)
+{
+    int regNum = getRegisterNumber(regName);
+    if (regNum < 0 || regNum > 31)
+    {
+        std::cerr << "Error: Invalid register number: " << regNum << std::endl;
+        return 0;
+    }
+    return regNum;
+}
+
+unsigned int Assembler::parseBranchTarget(std::string_view token, unsigned int addr)
+{
+    if (isLabel(token))
+    {
+        return getLabelAddress(token);
+    }
+    return addr + 4 + (parseImmediate(token) << 2);
+}
+
+DecodedInstruction Assembler::decodeInstruction(const std::vector<std::string_view>& tokens,
+                                                      std::string_view instr, unsigned int addr)
+{
+    DecodedInstruction d = { OP_INVALID, 0, 0, 0, 0, 0 };
+    
+    if (tokens.empty())
+    {
+        d.op = OP_NOP;
+        return d;
+    }
+    
+    auto it = opcodeTable().find(tokens[0]);
+    if (it == opcodeTable().end())
+    {
+        std::cerr << "Warning: Unsupported instruction: " << tokens[0] << std::endl;
+        return d;
+    }
+    
+    const OpcodeInfo& info = it->second;
+    if (tokens.size() - 1 < info.operands)
+    {
+        std::cerr << "Error: Missing operands: " << instr << std::endl;
+        return d;
+    }
+    
+    try
+    {
+        switch (info.format)
+        {
+            case FMT_NONE:
+                break;
+            case FMT_RD_RS_RT:
+                d.rd = decodeRegister(tokens[1]);
+                d.rs = decodeRegister(tokens[2]);
+                d.rt = decodeRegister(tokens[3]);
+                break;
+            case FMT_RD_RT_SHAMT:
+                d.rd = decodeRegister(tokens[1]);
+                d.rt = decodeRegister(tokens[2]);
+                d.imm = parseImmediate(tokens[3]) & 0x1F;
+                break;
+            case FMT_RD_RT_RS:
+                d.rd = decodeRegister(tokens[1]);
+                d.rt = decodeRegister(tokens[2]);
+                d.rs = decodeRegister(tokens[3]);
+                break;
+            case FMT_RS_RT:
+                d.rs = decodeRegister(tokens[1]);
+                d.rt = decodeRegister(tokens[2]);
+                break;
+            case FMT_RD:
+                d.rd = decodeRegister(tokens[1]);
+                break;
+            case FMT_RS:
+                d.rs = decodeRegister(tokens[1]);
+                break;
+            case FMT_JALR:
+                if (tokens.size() > 2)
+                {
+                    d.rd = decodeRegister(tokens[1]);
+                    d.rs = decodeRegister(tokens[2]);
+                }
+                else
+                {
+                    d.rd = REG_RA;
+                    d.rs = decodeRegister(tokens[1]);
+                }
+                break;
+            case FMT_RT_RS_IMM:
+                d.rt = decodeRegister(tokens[1]);
+                d.rs = decodeRegister(tokens[2]);
+                d.imm = parseImmediate(tokens[3]);
+                if (info.op == OP_ANDI || info.op == OP_ORI || info.op == OP_XORI)
+                {
+                    d.imm &= 0xFFFF;
+                }
+                break;
+            case FMT_RT_IMM:
+                d.rt = decodeRegister(tokens[1]);
+                d.imm = parseImmediate(tokens[2]);
+                if (info.op == OP_LUI)
+                {
+                    d.imm = static_cast<int>((static_cast<unsigned int>(d.imm) & 0xFFFF) << 16);
+                }
+                break;
+            case FMT_MEM:
+                d.rt = decodeRegister(tokens[1]);
+                if (tokens.size() > 3)
+                {
+                    d.imm = parseImmediate(tokens[2]);
+                    d.rs = decodeRegister(tokens[3]);
+                }
+                else if (tokens[2][0] == '$')
+                {
+                    d.rs = decodeRegister(tokens[2]); // ($reg) with no offset
+                }
+                else
+                {
+                    d.imm = parseImmediate(tokens[2]); // absolute label address
+                }
+                break;
+            case FMT_RS_RT_LABEL:
+                d.rs = decodeRegister(tokens[1]);
+                d.rt = decodeRegister(tokens[2]);
+                d.target = parseBranchTarget(tokens[3], addr);
+                break;
+            case FMT_RS_LABEL:
+                d.rs = decodeRegister(tokens[1]);
+                d.target = parseBranchTarget(tokens[2], addr);
+                break;
+            case FMT_LABEL:
+                if (isLabel(tokens[1]))
+                {
+                    d.target = getLabelAddress(tokens[1]);
+                }
+                else
+                {
+                    unsigned int target = parseImmediate(tokens[1]);
+                    d.target = (addr & 0xF0000000) | ((target & 0x03FFFFFF) << 2);
+                }
+                break;
+            case FMT_RD_RS:
+                d.rd = decodeRegister(tokens[1]);
+                d.rs = decodeRegister(tokens[2]);
+                break;
+        }
+    }
+    catch (const std::exception&)
+    {
+        std::cerr << "Error: Cannot decode instruction: " << instr << std::endl;
+        return d;
+    }
+    
+    d.op = info.op;
+    return d;
+}
+
+// Number of machine words encodeInstruction() will produce for a source line,
+// worked out before labels are known. Label operands never fit 16 bits.
+unsigned int Assembler::instructionWords(const std::vector<std::string_view>& tokens)
+{
+    if (tokens.empty()) return 1;
+    
+    auto it = opcodeTable().find(tokens[0]);
+    if (it == opcodeTable().end() || tokens.size() - 1 < it->second.operands) return 1;
+    
+    auto fits = [this](std::string_view token, bool allowUnsigned)
+    {
+        int value;
+        try
+        {
+            value = parseImmediate(token);
+        }
+        catch (const std::exception&)
+        {
+            return false; // label defined further down
+        }
+        return (value >= -32768 && value <= 32767) || (allowUnsigned && value >= 0 && value <= 0xFFFF);
+    };
+    
+    switch (it->second.op)
+    {
+        case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE: case OP_LA:
+            return 2;
+        case OP_LI:
+            return fits(tokens[2], true) ? 1 : 2;
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU:
+            return fits(tokens[3], false) ? 1 : 3;
+        case OP_LW: case OP_LH: case OP_LHU: case OP_LB: case OP_LBU: case OP_SW: case OP_SH: case OP_SB:
+            if (tokens.size() > 3)
+            {
+                if (fits(tokens[2], false)) return 1;
+                return getRegisterNumber(tokens[3]) == REG_ZERO ? 2 : 3;
+            }
+            if (tokens[2][0] == '$') return 1;
+            return fits(tokens[2], false) ? 1 : 2;
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+File: assembler.h
+Author: Brysen Landis
+*/
+
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "program.h"
+
+// Strips a comment and surrounding whitespace from a source line
+std::string_view cleanLine(std::string_view line);
+
+// Splits a cleaned line into views of the line, without allocating beyond
+// the caller's reused vector. Commas separate like whitespace, and
+// offset($reg) gives offset and $reg.
+void tokenize(std::string_view line, std::vector<std::string_view>& tokens);
+
+// Turns source text into a Program (assembler.cpp), or decodes single lines
+// against the labels of one already loaded
+class Assembler
+{
+public:
+    // Raised whenever parseFile() turns the same source into a different
+    // program, so cached programs from another revision are assembled again
+    static const unsigned int REVISION = 2;
+
+    // Assembles into a new Program on up to threads threads (0 uses every
+    // hardware thread), reporting progress to messages
+    Assembler(unsigned int threads, std::ostream& messages);
+
+    // Decodes lines against labels, which must outlive the assembler. A
+    // label that is not defined stands for pc.
+    Assembler(const LabelTable& labels, unsigned int pc);
+
+    bool parseFile(const std::string& filename);
+
+    // The program parseFile() built, with dataEnd and sourceLines set
+    std::shared_ptr<Program> program() const { return loaded; }
+
+    unsigned int instructionCount() const { return instructions; }
+    bool includesFiles() const { return included; }     // the source used .incbin
+
+    DecodedInstruction decodeInstruction(const std::vector<std::string_view>& tokens,
+                                         std::string_view instr, unsigned int addr);
+
+private:
+    struct SourceChunk;
+    struct IncludedFile;
+
+    std::shared_ptr<Program> loaded;
+    const LabelTable* labels;
+    unsigned int missingLabel;  // address an undefined label decodes to
+    unsigned int assemblerThreads;
+    std::ostream* messages;
+    std::string includeDir;     // directory .incbin paths are relative to
+    unsigned int instructions;
+    bool included;
+
+    void scanChunk(SourceChunk& chunk);
+    void assembleChunk(SourceChunk& chunk, std::vector<unsigned int>& words);
+    void scanIncluded(SourceChunk& chunk, std::string_view line);
+    void alignIncluded(SourceChunk& chunk);
+    void mapIncluded(const IncludedFile& include, unsigned int addr);
+    unsigned int dataDirective(const std::vector<std::string_view>& tokens, std::string_view line,
+                               unsigned char* out);
+    unsigned int instructionWords(const std::vector<std::string_view>& tokens);
+
+    unsigned int parseBranchTarget(std::string_view token, unsigned int addr);
+    int decodeRegister(std::string_view regName);
+    int parseImmediate(std::string_view str);
+    int getRegisterNumber(std::string_view regName);
+    bool isLabel(std::string_view token);
+    unsigned int getLabelAddress(std::string_view label);
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+File: basic_blocks.cpp
+Author: Brysen Landis
+*/
+
+#include "basic_blocks.h"
+
+bool endsBasicBlock(Opcode op)
+{
+    switch (op)
+    {
+        case OP_JR: case OP_JALR:
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+        case OP_BLTZ: case OP_BLEZ: case OP_BGTZ: case OP_BGEZ:
+        case OP_J: case OP_JAL:
+        case OP_SYSCALL: case OP_COPY_LOOP: case OP_BREAKPOINT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool hasStaticTarget(Opcode op)
+{
+    return endsBasicBlock(op) && op != OP_JR && op != OP_JALR && op != OP_SYSCALL && op != OP_BREAKPOINT;
+}
+
+std::vector<BasicBlock> formBasicBlocks(const std::vector<DecodedInstruction>& program,
+                                        const LabelTable& labels,
+                                        unsigned int textBase)
+{
+    std::vector<BasicBlock> blocks;
+    const size_t count = program.size();
+    if (count == 0) return blocks;
+    
+    std::vector<bool> leader(count, false);
+    leader[0] = true;
+    
+    auto markAddress = [&](unsigned int addr)
+    {
+        unsigned int index = (addr - textBase) >> 2;
+        if ((addr & 3) == 0 && index < count) leader[index] = true;
+    };
+    
+    for (const auto& label : labels)
+    {
+        markAddress(label.second);
+    }
+    
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!endsBasicBlock(program[i].op)) continue;
+        if (hasStaticTarget(program[i].op)) markAddress(program[i].target);
+        if (i + 1 < count) leader[i + 1] = true;
+    }
+    
+    unsigned int first = 0;
+    for (unsigned int i = 1; i <= count; i++)
+    {
+        if (i == count || leader[i])
+        {
+            blocks.push_back({first, i});
+            first = i;
+        }
+    }
+    return blocks;
+}
+
+std::vector<unsigned int> blockEndsOf(const std::vector<BasicBlock>& blocks, size_t count)
+{
+    std::vector<unsigned int> ends(count, 0);
+    for (const BasicBlock& block : blocks)
+    {
+        for (unsigned int i = block.first; i < block.end && i < count; i++) ends[i] = block.end;
+    }
+    return ends;
+}
@@ -0,0 +1,35 @@
+/*
+File: basic_blocks.h
+Author: Brysen Landis
+*/
+
+#ifndef BASIC_BLOCKS_H
+#define BASIC_BLOCKS_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "instruction.h"
+
+// A straight-line run of instructions [first, end) in the decoded program.
+// Control only enters at first and only leaves after end - 1.
+struct BasicBlock
+{
+    unsigned int first;
+    unsigned int end;
+};
+
+// True for instructions after which control may not fall through
+// (branches, jumps and syscalls, which can halt or block on input)
+bool endsBasicBlock(Opcode op);
+
+// Splits the program at labels, branch/jump targets and block-ending
+// instructions. Blocks are returned in address order and cover every slot.
+std::vector<BasicBlock> formBasicBlocks(const std::vector<DecodedInstruction>& program,
+                                        const LabelTable& labels,
+                                        unsigned int textBase);
+
+// For each of count slots, the end of the block holding it
+std::vector<unsigned int> blockEndsOf(const std::vector<BasicBlock>& blocks, size_t count);
+
+#endif
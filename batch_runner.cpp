@@ -0,0 +1,216 @@
+/*
+File: batch_runner.cpp
+Author: Brysen Landis
+*/
+
+#include "batch_runner.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include <chrono>
+#include <map>
+
+enum JobStatus
+{
+    JOB_RAN,        // no expected output to check
+    JOB_PASSED,
+    JOB_FAILED,
+    JOB_ERROR       // could not load the program or open a file
+};
+
+struct BatchJob
+{
+    std::string program;
+    std::string input;      // empty for no input
+    std::string expected;   // empty when the output is not checked
+
+    JobStatus status;
+    std::string error;
+    std::string errors;     // what the program wrote to descriptor 2
+    double seconds;
+    unsigned long long instructions;
+    size_t mismatchLine;    // first output line that differs, from 1
+};
+
+static std::string resolvePath(const std::string& base, const std::string& path)
+{
+    if (base.empty() || path.empty() || path[0] == '/') return path;
+    return base + "/" + path;
+}
+
+static bool readManifest(const std::string& manifest, std::vector<BatchJob>& jobs)
+{
+    std::ifstream file(manifest);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Cannot open manifest " << manifest << std::endl;
+        return false;
+    }
+
+    size_t slash = manifest.rfind('/');
+    std::string base = slash == std::string::npos ? "" : manifest.substr(0, slash);
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.resize(comment);
+
+        std::istringstream fields(line);
+        std::string program, input, expected;
+        if (!(fields >> program)) continue;
+        fields >> input >> expected;
+
+        BatchJob job = {};
+        job.program = resolvePath(base, program);
+        if (!input.empty() && input != "-") job.input = resolvePath(base, input);
+        if (!expected.empty() && expected != "-") job.expected = resolvePath(base, expected);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static size_t firstDifference(const std::string& expected, const std::string& actual)
+{
+    size_t line = 1;
+    for (size_t i = 0; i < expected.size() && i < actual.size(); i++)
+    {
+        if (expected[i] != actual[i]) return line;
+        if (expected[i] == '\n') line++;
+    }
+    return line;
+}
+
+static std::shared_ptr<const Program> loadShared(const std::string& filename, const MIPSInterpreter& settings)
+{
+    LoadSettings load = settings.getLoadSettings();
+    load.assemblerThreads = 1; // the pool already keeps every core busy
+    std::ostream discard(nullptr);
+    return Program::load(filename, load, discard);
+}
+
+static void runJob(BatchJob& job, const MIPSInterpreter& settings, const std::shared_ptr<const Program>& program)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    MIPSInterpreter interpreter;
+    interpreter.copySettings(settings);
+
+    // The program reads from its preloaded input file and writes into
+    // strings, its errors apart from the output that is checked; completion
+    // messages are dropped
+    std::string input;
+    std::ostringstream output;
+    std::ostringstream errors;
+    std::ostream discard(nullptr);
+    if (!job.input.empty())
+    {
+        MappedFile inputFile(job.input);
+        if (!inputFile.isOpen())
+        {
+            job.status = JOB_ERROR;
+            job.error = "cannot open " + job.input;
+            return;
+        }
+        input.assign(reinterpret_cast<const char*>(inputFile.data()), inputFile.size());
+    }
+    interpreter.setInput(std::move(input));
+    interpreter.setOutput(output);
+    interpreter.setErrorOutput(errors);
+    interpreter.setMessages(discard);
+
+    if (!program)
+    {
+        job.status = JOB_ERROR;
+        job.error = "cannot load program";
+    }
+    else
+    {
+        interpreter.loadProgram(program);
+        interpreter.run();
+        job.instructions = interpreter.instructionsExecuted();
+        job.errors = errors.str();
+        job.status = JOB_RAN;
+
+        if (!job.expected.empty())
+        {
+            std::ifstream expectedFile(job.expected, std::ios::binary);
+            std::ostringstream expected;
+            if (!expectedFile.is_open())
+            {
+                job.status = JOB_ERROR;
+                job.error = "cannot open " + job.expected;
+            }
+            else
+            {
+                expected << expectedFile.rdbuf();
+                const std::string actual = output.str();
+                job.status = expected.str() == actual ? JOB_PASSED : JOB_FAILED;
+                if (job.status == JOB_FAILED) job.mismatchLine = firstDifference(expected.str(), actual);
+            }
+        }
+    }
+
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int runBatch(const std::string& manifest, const MIPSInterpreter& settings, unsigned int threads)
+{
+    std::vector<BatchJob> jobs;
+    if (!readManifest(manifest, jobs)) return 1;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Each distinct program is loaded once and shared by every job naming it
+    std::map<std::string, std::shared_ptr<const Program>> programs;
+    for (const BatchJob& job : jobs) programs[job.program];
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(threads);
+        for (auto& entry : programs)
+        {
+            pool.submit([&entry, &settings] { entry.second = loadShared(entry.first, settings); });
+        }
+        pool.wait();
+
+        for (BatchJob& job : jobs)
+        {
+            const std::shared_ptr<const Program>& program = programs[job.program];
+            pool.submit([&job, &settings, &program] { runJob(job, settings, program); });
+        }
+        pool.wait();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    static const char* const statusNames[] = { "RAN", "PASS", "FAIL", "ERROR" };
+    size_t statusCounts[4] = {};
+    double busy = 0;
+    unsigned long long instructions = 0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (const BatchJob& job : jobs)
+    {
+        statusCounts[job.status]++;
+        busy += job.seconds;
+        instructions += job.instructions;
+
+        std::cout << std::left << std::setw(6) << statusNames[job.status] << std::right
+                  << std::setw(10) << job.seconds * 1000 << " ms  "
+                  << std::setw(12) << job.instructions << " instr  " << job.program;
+        if (!job.input.empty()) std::cout << " < " << job.input;
+        if (job.status == JOB_FAILED) std::cout << "  (output differs at line " << job.mismatchLine << ")";
+        if (job.status == JOB_ERROR) std::cout << "  (" << job.error << ")";
+        std::cout << "\n" << job.errors;
+        if (!job.errors.empty() && job.errors.back() != '\n') std::cout << "\n";
+    }
+
+    std::cout << "\n=== Batch: " << jobs.size() << " jobs on " << threads << " threads ===\n";
+    std::cout << "Passed " << statusCounts[JOB_PASSED] << ", failed " << statusCounts[JOB_FAILED]
+              << ", errors " << statusCounts[JOB_ERROR] << ", unchecked " << statusCounts[JOB_RAN] << "\n";
+    std::cout << "Wall " << wall << " s, " << (wall > 0 ? jobs.size() / wall : 0) << " jobs/sec, "
+              << "parallel speedup " << (wall > 0 ? busy / wall : 0) << "x\n";
+    std::cout << instructions << " instructions, " << (wall > 0 ? instructions / wall / 1e6 : 0)
+              << "M instructions/sec\n";
+    std::cout << std::defaultfloat;
+
+    return statusCounts[JOB_FAILED] + statusCounts[JOB_ERROR] > 0 ? 1 : 0;
+}
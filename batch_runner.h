@@ -0,0 +1,23 @@
+/*
+File: batch_runner.h
+Author: Brysen Landis
+*/
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <string>
+#include "interpreter.h"
+
+// Runs every job in a manifest on a pool of threads, each job in its own
+// interpreter configured like settings. Each program is loaded only once.
+// A manifest line names a program and, optionally, a file to use as its
+// input and a file its output must match:
+//
+//     program.asm  [input.txt|-]  [expected.txt|-]
+//
+// Relative paths are taken from the manifest's directory and '#' starts a
+// comment. Prints a line per job and a summary; returns the process exit code.
+int runBatch(const std::string& manifest, const MIPSInterpreter& settings, unsigned int threads);
+
+#endif
@@ -0,0 +1,270 @@
+/*
+File: binary_image.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+#include "encoding.h"
+#include <iterator>
+
+// Loading and saving assembled programs. ELF images carry the text segment as
+// genuine big-endian MIPS words plus the initialized data segment; raw .bin
+// images are just the text words, loaded at TEXT_BASE. The simulated machine
+// is little-endian, so instruction words are converted on the way in and out
+// and data bytes are copied as they are.
+
+static const unsigned char ELF_MAGIC[4] = { 0x7F, 'E', 'L', 'F' };
+static const unsigned int ELF_HEADER_SIZE = 52;
+static const unsigned int ELF_PHDR_SIZE = 32;
+static const unsigned int EM_MIPS = 8;
+static const unsigned int ET_EXEC = 2;
+static const unsigned int PT_LOAD = 1;
+static const unsigned int PF_X = 1, PF_W = 2, PF_R = 4;
+
+static void putBig16(std::vector<unsigned char>& out, unsigned int value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+static void putBig32(std::vector<unsigned char>& out, unsigned int value)
+{
+    putBig16(out, value >> 16);
+    putBig16(out, value & 0xFFFF);
+}
+
+static unsigned int get16(const unsigned char* p, bool bigEndian)
+{
+    return bigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char* p, bool bigEndian)
+{
+    return bigEndian ? (get16(p, true) << 16) | get16(p + 2, true) : get16(p, false) | (get16(p + 2, false) << 16);
+}
+
+bool isBinaryImage(const std::string& filename)
+{
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0) return true;
+
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    return file && std::memcmp(magic, ELF_MAGIC, sizeof(magic)) == 0;
+}
+
+static bool loadElf(const std::vector<unsigned char>& image, unsigned int& textWords, Program& program)
+{
+    if (image.size() < ELF_HEADER_SIZE || image[4] != 1 || (image[5] != 1 && image[5] != 2))
+    {
+        std::cerr << "Error: Not a 32-bit ELF file" << std::endl;
+        return false;
+    }
+    const bool bigEndian = image[5] == 2;
+    const unsigned char* header = image.data();
+
+    if (get16(header + 16, bigEndian) != ET_EXEC || get16(header + 18, bigEndian) != EM_MIPS)
+    {
+        std::cerr << "Error: Not a MIPS executable" << std::endl;
+        return false;
+    }
+
+    unsigned int entry = get32(header + 24, bigEndian);
+    unsigned int phoff = get32(header + 28, bigEndian);
+    unsigned int phentsize = get16(header + 42, bigEndian);
+    unsigned int phnum = get16(header + 44, bigEndian);
+    if (phentsize < ELF_PHDR_SIZE || phoff > image.size() || phnum > (image.size() - phoff) / phentsize)
+    {
+        std::cerr << "Error: Truncated ELF program headers" << std::endl;
+        return false;
+    }
+
+    textWords = 0;
+    for (unsigned int i = 0; i < phnum; i++)
+    {
+        const unsigned char* ph = header + phoff + i * phentsize;
+        if (get32(ph, bigEndian) != PT_LOAD) continue;
+
+        unsigned int offset = get32(ph + 4, bigEndian);
+        unsigned int vaddr = get32(ph + 8, bigEndian);
+        unsigned int filesz = get32(ph + 16, bigEndian);
+        unsigned int memsz = get32(ph + 20, bigEndian);
+        unsigned int flags = get32(ph + 24, bigEndian);
+        if (offset > image.size() || filesz > image.size() - offset || filesz > memsz)
+        {
+            std::cerr << "Error: ELF segment lies outside the file" << std::endl;
+            return false;
+        }
+
+        if (flags & PF_X)
+        {
+            // The engines index the program from TEXT_BASE
+            if (vaddr != Machine::TEXT_BASE || textWords != 0 || filesz % 4 != 0)
+            {
+                std::cerr << "Error: ELF text segment must be one word-aligned segment at 0x"
+                          << std::hex << Machine::TEXT_BASE << std::dec << std::endl;
+                return false;
+            }
+            for (unsigned int w = 0; w < filesz; w += 4)
+            {
+                program.image.storeWord(vaddr + w, get32(&image[offset + w], bigEndian));
+            }
+            textWords = filesz / 4;
+        }
+        else
+        {
+            for (unsigned int b = 0; b < filesz; b++)
+            {
+                program.image.store(vaddr + b, image[offset + b]);
+            }
+            if (vaddr >= Machine::DATA_BASE) program.dataEnd = std::max(program.dataEnd, vaddr + memsz);
+        }
+    }
+
+    program.entry = entry;
+    return true;
+}
+
+std::shared_ptr<Program> loadBinaryImage(const std::string& filename, std::ostream& messages)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        return nullptr;
+    }
+    std::vector<unsigned char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto loaded = std::make_shared<Program>();
+    loaded->dataEnd = Machine::DATA_BASE;
+
+    unsigned int textWords;
+    if (image.size() >= sizeof(ELF_MAGIC) && std::memcmp(image.data(), ELF_MAGIC, sizeof(ELF_MAGIC)) == 0)
+    {
+        if (!loadElf(image, textWords, *loaded)) return nullptr;
+    }
+    else
+    {
+        if (image.size() % 4 != 0)
+        {
+            std::cerr << "Error: Raw image size is not a whole number of words: " << filename << std::endl;
+            return nullptr;
+        }
+        textWords = static_cast<unsigned int>(image.size() / 4);
+        for (unsigned int i = 0; i < textWords; i++)
+        {
+            loaded->image.storeWord(Machine::TEXT_BASE + i * 4, get32(&image[i * 4], true));
+        }
+        loaded->entry = Machine::TEXT_BASE;
+    }
+
+    for (unsigned int i = 0; i < textWords; i++)
+    {
+        unsigned int addr = Machine::TEXT_BASE + i * 4;
+        unsigned int word = loaded->image.fetchWord(addr);
+        DecodedInstruction d = decodeWord(word, addr);
+        loaded->code.push_back(d);
+        if (d.op == OP_INVALID)
+        {
+            std::ostringstream text;
+            text << ".word 0x" << std::hex << std::setw(8) << std::setfill('0') << word;
+            loaded->listing.push_back(text.str());
+        }
+        else
+        {
+            loaded->listing.push_back(disassemble(d));
+        }
+    }
+
+    messages << "Loaded " << textWords << " instructions from " << filename << std::endl;
+    return loaded;
+}
+
+bool MIPSInterpreter::saveBinary(const std::string& filename)
+{
+    const unsigned int textSize = static_cast<unsigned int>(prog->code.size() * 4);
+    const bool raw = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0;
+    std::vector<unsigned char> image;
+
+    // Trailing zero bytes (.space) are left to the segment's memory size
+    Memory memory = prog->image;
+    unsigned int dataSize = prog->dataEnd - DATA_BASE;
+    unsigned int dataFileSize = dataSize;
+    while (dataFileSize > 0 && memory.fetch(DATA_BASE + dataFileSize - 1) == 0) dataFileSize--;
+
+    if (raw)
+    {
+        if (dataFileSize > 0)
+        {
+            std::cerr << "Warning: Raw images hold only the text segment; initialized data is not saved" << std::endl;
+        }
+        if (prog->entry != TEXT_BASE)
+        {
+            std::cerr << "Warning: Raw images start at the text base; the entry point is not saved" << std::endl;
+        }
+    }
+    else
+    {
+        const unsigned int phnum = dataSize > 0 ? 2 : 1;
+        const unsigned int textOffset = ELF_HEADER_SIZE + phnum * ELF_PHDR_SIZE;
+
+        static const unsigned char ident[16] = { 0x7F, 'E', 'L', 'F', 1, 2, 1 };
+        image.insert(image.end(), ident, ident + sizeof(ident));
+        putBig16(image, ET_EXEC);
+        putBig16(image, EM_MIPS);
+        putBig32(image, 1);                 // e_version
+        putBig32(image, prog->entry);       // e_entry
+        putBig32(image, ELF_HEADER_SIZE);   // e_phoff
+        putBig32(image, 0);                 // e_shoff
+        putBig32(image, 0);                 // e_flags (MIPS-I)
+        putBig16(image, ELF_HEADER_SIZE);
+        putBig16(image, ELF_PHDR_SIZE);
+        putBig16(image, phnum);
+        putBig16(image, 0);                 // no section headers
+        putBig16(image, 0);
+        putBig16(image, 0);
+
+        putBig32(image, PT_LOAD);
+        putBig32(image, textOffset);
+        putBig32(image, TEXT_BASE);
+        putBig32(image, TEXT_BASE);
+        putBig32(image, textSize);
+        putBig32(image, textSize);
+        putBig32(image, PF_R | PF_X);
+        putBig32(image, 4);
+
+        if (dataSize > 0)
+        {
+            putBig32(image, PT_LOAD);
+            putBig32(image, textOffset + textSize);
+            putBig32(image, DATA_BASE);
+            putBig32(image, DATA_BASE);
+            putBig32(image, dataFileSize);
+            putBig32(image, dataSize);
+            putBig32(image, PF_R | PF_W);
+            putBig32(image, 4);
+        }
+    }
+
+    for (unsigned int addr = TEXT_BASE; addr < TEXT_BASE + textSize; addr += 4)
+    {
+        putBig32(image, memory.fetchWord(addr));
+    }
+    if (!raw)
+    {
+        for (unsigned int i = 0; i < dataFileSize; i++)
+        {
+            image.push_back(memory.fetch(DATA_BASE + i));
+        }
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "Error: Cannot write file " << filename << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+
+    *messages << "Wrote " << prog->code.size() << " instructions (" << image.size() << " bytes) to " << filename << std::endl;
+    return static_cast<bool>(out);
+}
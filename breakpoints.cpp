@@ -0,0 +1,454 @@
+/*
+File: breakpoints.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+#include <charconv>
+#include <chrono>
+
+// Breakpoints cost nothing until they are reached. Each address with one is
+// patched, in this machine's copy of the code, to an OP_BREAKPOINT that stops
+// whatever run loop executes it the way an exit does, and the instruction it
+// covers runs only when stepping over it. Watchpoints keep their pages out of
+// Memory's write cache, so every other store takes the usual path. Only
+// "break if" needs a test after each instruction, and only debugRun() makes
+// one. until and finish add temporary breakpoints of their own.
+
+namespace
+{
+    std::string_view trim(std::string_view text)
+    {
+        size_t start = text.find_first_not_of(" \t");
+        if (start == std::string_view::npos) return std::string_view();
+        return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+    }
+
+    std::string hexWord(unsigned int value)
+    {
+        std::ostringstream out;
+        out << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+        return out.str();
+    }
+
+    // An address, with the first label naming it
+    std::string describe(unsigned int addr, const LabelTable& labels)
+    {
+        std::string text = hexWord(addr);
+        for (const auto& label : labels)
+        {
+            if (label.second == addr) return text + " <" + label.first + ">";
+        }
+        return text;
+    }
+}
+
+bool MIPSInterpreter::breakpointCommand(std::string_view line, std::string& reply)
+{
+    line = cleanLine(line);
+    size_t split = line.find_first_of(" \t");
+    std::string_view command = line.substr(0, split);
+    std::string_view operands = split == std::string_view::npos ? std::string_view() : trim(line.substr(split));
+
+    if (command == "break")
+    {
+        Breakpoint b = {};
+        b.text = std::string(operands);
+
+        // "if" starts the condition, alone or after the location
+        std::string_view location = operands, condition;
+        if (operands == "if" || operands.substr(0, 3) == "if " || operands.substr(0, 3) == "if\t")
+        {
+            b.kind = Breakpoint::WHEN;
+            b.conditional = true;
+            location = std::string_view();
+            condition = trim(operands.substr(2));
+        }
+        else
+        {
+            b.kind = Breakpoint::AT;
+            size_t at = operands.find(" if ");
+            if (at != std::string_view::npos)
+            {
+                b.conditional = true;
+                location = trim(operands.substr(0, at));
+                condition = trim(operands.substr(at + 4));
+            }
+        }
+
+        if (operands.empty())
+        {
+            reply = "break needs a label or address, or if <condition>";
+            return true;
+        }
+        if (b.conditional && !parseCondition(condition, b.condition))
+        {
+            reply = "Cannot read condition \"" + std::string(condition) + "\"; expected <register> <op> <register or number>";
+            return true;
+        }
+        if (b.kind == Breakpoint::AT)
+        {
+            unsigned int index = 0;
+            bool found = parseAddress(location, b.address);
+            if (found) index = (b.address - TEXT_BASE) >> 2;
+            if (!found || (b.address & 3) != 0 || index >= prog->code.size())
+            {
+                reply = "No instruction at " + std::string(location);
+                return true;
+            }
+        }
+
+        b.number = nextBreakpoint++;
+        breakpoints.push_back(b);
+        applyBreakpoints();
+        reply = "Breakpoint " + std::to_string(b.number);
+        if (b.kind == Breakpoint::AT) reply += " at " + describe(b.address, prog->labels);
+        if (b.conditional) reply += (b.kind == Breakpoint::AT ? " if " : " when ") + std::string(condition);
+    }
+    else if (command == "watch")
+    {
+        Breakpoint b = {};
+        b.kind = Breakpoint::WATCH;
+        b.text = std::string(operands);
+        if (!parseRange(operands, b.address, b.length))
+        {
+            reply = "watch needs a label or address, with an optional ,length";
+            return true;
+        }
+
+        b.number = nextBreakpoint++;
+        breakpoints.push_back(b);
+        applyBreakpoints();
+        reply = "Watchpoint " + std::to_string(b.number) + " on " + describe(b.address, prog->labels) + ", " +
+                std::to_string(b.length) + " byte" + (b.length == 1 ? "" : "s");
+    }
+    else if (command == "delete")
+    {
+        if (operands.empty())
+        {
+            reply = "Deleted " + std::to_string(breakpoints.size()) + " breakpoint" + (breakpoints.size() == 1 ? "" : "s");
+            breakpoints.clear();
+        }
+        else
+        {
+            unsigned int number = 0;
+            std::from_chars(operands.data(), operands.data() + operands.size(), number);
+            auto found = std::find_if(breakpoints.begin(), breakpoints.end(),
+                                      [number](const Breakpoint& b) { return b.number == number; });
+            if (found == breakpoints.end())
+            {
+                reply = "No breakpoint " + std::string(operands);
+                return true;
+            }
+            breakpoints.erase(found);
+            reply = "Deleted breakpoint " + std::string(operands);
+        }
+        applyBreakpoints();
+    }
+    else if (command == "breaks")
+    {
+        reply = breakpoints.empty() ? "No breakpoints" : "Breakpoints:";
+        for (const Breakpoint& b : breakpoints)
+        {
+            reply += "\n  " + std::to_string(b.number) + (b.kind == Breakpoint::WATCH ? "  watch " : "  break ") + b.text;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void MIPSInterpreter::applyBreakpoints()
+{
+    for (unsigned int slot : patchedSlots) patchedCode[slot] = prog->code[slot];
+    patchedSlots.clear();
+    mem.clearWatches();
+    for (const Breakpoint& b : breakpoints)
+    {
+        if (b.kind == Breakpoint::WATCH) mem.watch(b.address, b.length);
+        if (b.kind == Breakpoint::AT) patchStop(b.address, patchedSlots);
+    }
+}
+
+void MIPSInterpreter::patchStop(unsigned int addr, std::vector<unsigned int>& patched)
+{
+    if (patchedCode.empty()) patchedCode = prog->code;
+    const unsigned int slot = (addr - TEXT_BASE) >> 2;
+    if (patchedCode[slot].op == OP_BREAKPOINT) return;
+    patchedCode[slot] = { OP_BREAKPOINT, 0, 0, 0, 0, addr };
+    patched.push_back(slot);
+}
+
+void MIPSInterpreter::watchedWrite(unsigned int addr)
+{
+    if (!stopped)
+    {
+        for (const Breakpoint& b : breakpoints)
+        {
+            if (b.kind != Breakpoint::WATCH || addr < b.address || addr - b.address >= b.length) continue;
+            watchHit = b.number;
+            watchOld = 0;
+            for (unsigned int i = 0; i < b.length && i < 4; i++)
+            {
+                watchOld |= static_cast<unsigned int>(mem.fetch(b.address + i)) << (i * 8);
+            }
+            break;
+        }
+        watchAddress = addr;
+        watchPC = PC;
+    }
+    stopped = halted = true;
+}
+
+bool MIPSInterpreter::parseCondition(std::string_view text, Condition& condition)
+{
+    static const std::string_view OPERATORS[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+    size_t at = text.find_first_of("=!<>");
+    if (at == std::string_view::npos) return false;
+    size_t width = (at + 1 < text.size() && text[at + 1] == '=') ? 2 : 1;
+    const std::string_view* op = std::find(std::begin(OPERATORS), std::end(OPERATORS), text.substr(at, width));
+    if (op == std::end(OPERATORS)) return false;
+    condition.compare = static_cast<Condition::Compare>(op - OPERATORS);
+
+    if (!parseRegister(trim(text.substr(0, at)), condition.reg)) return false;
+    std::string_view right = trim(text.substr(at + width));
+    condition.registerOperand = parseRegister(right, condition.operand);
+    if (condition.registerOperand) return true;
+
+    bool negative = !right.empty() && right[0] == '-';
+    if (negative) right.remove_prefix(1);
+    if (!parseAddress(right, condition.operand)) return false;
+    if (negative) condition.operand = 0u - condition.operand;
+    return true;
+}
+
+bool MIPSInterpreter::holds(const Condition& condition) const
+{
+    auto value = [this](unsigned int reg)
+    {
+        return static_cast<int>(reg == 32 ? HI : reg == 33 ? LO : regFile.get(static_cast<int>(reg)));
+    };
+    const int left = value(condition.reg);
+    const int right = condition.registerOperand ? value(condition.operand) : static_cast<int>(condition.operand);
+    switch (condition.compare)
+    {
+        case Condition::EQ: return left == right;
+        case Condition::NE: return left != right;
+        case Condition::LT: return left < right;
+        case Condition::LE: return left <= right;
+        case Condition::GT: return left > right;
+        case Condition::GE: return left >= right;
+    }
+    return false;
+}
+
+bool MIPSInterpreter::atBreakpoint() const
+{
+    unsigned int index = (PC - TEXT_BASE) >> 2;
+    return (PC & 3) == 0 && index < patchedCode.size() && patchedCode[index].op == OP_BREAKPOINT;
+}
+
+bool MIPSInterpreter::advance(unsigned long long limit)
+{
+    if (history) return runRecorded(*history, limit);
+    if (limit > 0 && atBreakpoint())
+    {
+        Machine::step();
+        limit--;
+    }
+    return runFor(limit);
+}
+
+std::string MIPSInterpreter::continueRun()
+{
+    return debugRun(~0ULL, GOAL_NONE, 0);
+}
+
+bool MIPSInterpreter::runCommand(std::string_view line, std::string& reply)
+{
+    line = cleanLine(line);
+    size_t split = line.find_first_of(" \t");
+    std::string_view command = line.substr(0, split);
+    std::string_view operand = split == std::string_view::npos ? std::string_view() : trim(line.substr(split));
+
+    if (command == "continue" || command == "c")
+    {
+        reply = continueRun();
+    }
+    else if ((command == "step" || command == "s") && !operand.empty())
+    {
+        unsigned long long count = 0;
+        auto result = std::from_chars(operand.data(), operand.data() + operand.size(), count);
+        if (result.ec != std::errc() || result.ptr != operand.data() + operand.size() || count == 0)
+        {
+            reply = "step needs a number of instructions";
+            return true;
+        }
+        reply = debugRun(count, GOAL_NONE, 0);
+    }
+    else if (command == "until" || command == "u")
+    {
+        unsigned int addr = 0;
+        unsigned int index = parseAddress(operand, addr) ? (addr - TEXT_BASE) >> 2 : ~0u;
+        if ((addr & 3) != 0 || index >= prog->code.size())
+        {
+            reply = "No instruction at " + std::string(operand);
+            return true;
+        }
+        reply = debugRun(~0ULL, GOAL_UNTIL, addr);
+    }
+    else if (command == "finish")
+    {
+        reply = debugRun(~0ULL, GOAL_FINISH, 0);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string MIPSInterpreter::debugRun(unsigned long long limit, RunGoal goal, unsigned int target)
+{
+    if (halted) return "Program halted.";
+
+    // Temporary breakpoints: the until address, or every call and return,
+    // patched over the breakpoints already in place and put back after
+    if (goal == GOAL_FINISH && callSites.empty())
+    {
+        for (size_t i = 0; i < prog->code.size(); i++)
+        {
+            const DecodedInstruction& d = instructionAt(i);
+            if (d.op == OP_JAL || d.op == OP_JALR || (d.op == OP_JR && d.rs == REG_RA))
+            {
+                callSites.push_back(TEXT_BASE + static_cast<unsigned int>(i * 4));
+            }
+        }
+    }
+    std::vector<unsigned int> stops;    // slots patched for this run alone
+    if (goal == GOAL_UNTIL) patchStop(target, stops);
+    for (size_t i = 0; goal == GOAL_FINISH && i < callSites.size(); i++) patchStop(callSites[i], stops);
+    int depth = 0;              // calls finish has followed in
+    bool returning = false;     // finish is stepping over the return
+
+    // Whether each "break if" condition held after the last instruction
+    std::vector<bool> held;
+    for (const Breakpoint& b : breakpoints)
+    {
+        if (b.kind == Breakpoint::WHEN) held.push_back(holds(b.condition));
+    }
+
+    // Long runs go STATUS_CHUNK instructions at a time, and the clock is
+    // read about that often for the status line
+    static const unsigned long long STATUS_CHUNK = 1 << 22;
+    const auto started = std::chrono::steady_clock::now();
+    auto nextStatus = started + std::chrono::seconds(1);
+    const unsigned long long first = executedCount;
+    unsigned long long checked = first;
+    bool statusShown = false;
+
+    watchHit = 0;
+    mem.setWatchHook([this](unsigned int addr) { watchedWrite(addr); });
+    std::string reason;
+    bool leaving = true;    // a breakpoint at PC was already reported
+    while (reason.empty())
+    {
+        if (atBreakpoint())
+        {
+            for (const Breakpoint& b : breakpoints)
+            {
+                if (!leaving && b.kind == Breakpoint::AT && b.address == PC && (!b.conditional || holds(b.condition)))
+                {
+                    reason = "Breakpoint " + std::to_string(b.number) + " at " + describe(PC, prog->labels);
+                    break;
+                }
+            }
+            if (!reason.empty()) break;
+            if (goal == GOAL_UNTIL && PC == target && !leaving)
+            {
+                reason = "Reached " + describe(PC, prog->labels);
+                break;
+            }
+            if (goal == GOAL_FINISH)
+            {
+                const DecodedInstruction& d = instructionAt((PC - TEXT_BASE) >> 2);
+                if (d.op != OP_JR) depth++;
+                else if (depth-- == 0) returning = true;
+            }
+        }
+        leaving = false;
+
+        const unsigned long long done = executedCount - first;
+        if (done >= limit)
+        {
+            reason = "Stepped " + std::to_string(done) + " instruction" + (done == 1 ? "" : "s");
+            break;
+        }
+        const unsigned long long chunk = (returning || !held.empty()) ? 1 : std::min(limit - done, STATUS_CHUNK);
+        bool running = advance(chunk);
+        if (stopped)
+        {
+            // At a breakpoint, checked above, or after a watched write
+            stopped = halted = false;
+            if (watchHit == 0) continue;
+            const Breakpoint& b = *std::find_if(breakpoints.begin(), breakpoints.end(),
+                                                [this](const Breakpoint& w) { return w.number == watchHit; });
+            reason = "Watchpoint " + std::to_string(b.number) + ": " + hexWord(watchAddress) + " written by " +
+                     hexWord(watchPC);
+            if (b.length <= 4)
+            {
+                unsigned int now = 0;
+                for (unsigned int i = 0; i < b.length; i++)
+                {
+                    now |= static_cast<unsigned int>(mem.fetch(b.address + i)) << (i * 8);
+                }
+                reason += ", " + std::to_string(static_cast<int>(watchOld)) + " -> " + std::to_string(static_cast<int>(now));
+            }
+            break;
+        }
+        if (!running)
+        {
+            reason = halted ? "Program exited." : "Program complete.";
+            break;
+        }
+        if (returning)
+        {
+            reason = "Returned to " + describe(PC, prog->labels);
+            break;
+        }
+
+        size_t i = 0;
+        for (const Breakpoint& b : breakpoints)
+        {
+            if (b.kind != Breakpoint::WHEN) continue;
+            bool now = holds(b.condition);
+            if (now && !held[i] && reason.empty())
+            {
+                reason = "Breakpoint " + std::to_string(b.number) + " (" + b.text + ") at " + describe(PC, prog->labels);
+            }
+            held[i++] = now;
+        }
+
+        if (executedCount - checked >= STATUS_CHUNK)
+        {
+            checked = executedCount;
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= nextStatus)
+            {
+                const double seconds = std::chrono::duration<double>(now - started).count();
+                const unsigned long long executed = executedCount - first;
+                *messages << "\r" << executed << " instructions, " << std::fixed << std::setprecision(1)
+                          << executed / seconds / 1e6 << "M/s, PC " << hexWord(PC) << std::defaultfloat << std::flush;
+                nextStatus = now + std::chrono::seconds(1);
+                statusShown = true;
+            }
+        }
+    }
+    mem.setWatchHook(nullptr);
+    for (unsigned int slot : stops) patchedCode[slot] = prog->code[slot];
+    if (statusShown) *messages << "\n";
+    return reason;
+}
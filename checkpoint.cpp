@@ -0,0 +1,179 @@
+/*
+File: checkpoint.cpp
+Author: Brysen Landis
+*/
+
+#include "machine.h"
+#include "mapped_file.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// A checkpoint is a header, the program path, the page numbers of every
+// resident page, then the pages themselves starting at a page-aligned offset.
+// Resuming maps the file privately and points the machine's page tables
+// straight at the mapped pages, which are copied only when written.
+
+static const char CHECKPOINT_MAGIC[8] = { 'M', 'I', 'P', 'S', 'C', 'K', 'P', 'T' };
+static const unsigned int CHECKPOINT_VERSION = 2;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int pageSize;          // Memory::PAGE_SIZE, guards layout changes
+    unsigned long long fingerprint; // Program::fingerprint() of the program
+    unsigned long long executedCount;
+    unsigned int registers[32];
+    unsigned int PC, HI, LO;
+    unsigned int heapPtr;
+    GuestHeap heap;
+    unsigned int halted;
+    unsigned int pathLength;
+    unsigned int pageCount;
+    unsigned int pageOffset;        // file offset of the first page
+};
+
+// Maps a checkpoint and checks its header and page table fit the file
+static std::shared_ptr<MappedFile> openCheckpoint(const std::string& path, CheckpointHeader& header)
+{
+    auto file = std::make_shared<MappedFile>(path, true);
+    if (!file->isOpen())
+    {
+        std::cerr << "Error: Cannot open checkpoint " << path << std::endl;
+        return nullptr;
+    }
+
+    const size_t size = file->size();
+    bool valid = size >= sizeof(header);
+    if (valid)
+    {
+        std::memcpy(&header, file->data(), sizeof(header));
+        valid = std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+                header.version == CHECKPOINT_VERSION && header.pageSize == Memory::PAGE_SIZE &&
+                header.pageOffset % Memory::PAGE_SIZE == 0 &&
+                sizeof(header) + header.pathLength + header.pageCount * 4ULL <= header.pageOffset &&
+                header.pageOffset + header.pageCount * static_cast<unsigned long long>(Memory::PAGE_SIZE) <= size;
+    }
+    if (!valid)
+    {
+        std::cerr << "Error: " << path << " is not a checkpoint this interpreter can resume" << std::endl;
+        return nullptr;
+    }
+    return file;
+}
+
+bool Machine::saveCheckpoint(const std::string& path) const
+{
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.pageSize = Memory::PAGE_SIZE;
+    header.fingerprint = prog->fingerprint();
+    header.executedCount = executedCount;
+    for (int r = 0; r < 32; r++) header.registers[r] = regFile.get(r);
+    header.PC = PC;
+    header.HI = HI;
+    header.LO = LO;
+    header.heapPtr = heapPtr;
+    header.heap = heap;
+    header.halted = halted ? 1 : 0;
+
+    std::error_code error;
+    std::string program = prog->source.empty() ? "" : std::filesystem::absolute(prog->source, error).string();
+    header.pathLength = static_cast<unsigned int>(program.size());
+
+    std::vector<unsigned int> pageNums;
+    mem.forEachPage([&](unsigned int pageNum, const unsigned char*) { pageNums.push_back(pageNum); });
+    header.pageCount = static_cast<unsigned int>(pageNums.size());
+    size_t indexEnd = sizeof(header) + program.size() + pageNums.size() * 4;
+    header.pageOffset = static_cast<unsigned int>((indexEnd + Memory::PAGE_MASK) & ~static_cast<size_t>(Memory::PAGE_MASK));
+
+    // Write beside the final name and rename, so a crash mid-write leaves the
+    // previous checkpoint intact
+    std::ostringstream tempName;
+    tempName << path << ".tmp" << std::chrono::steady_clock::now().time_since_epoch().count();
+    {
+        std::ofstream out(tempName.str(), std::ios::binary);
+        if (!out.is_open())
+        {
+            std::cerr << "Error: Cannot write checkpoint " << path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(program.data(), static_cast<std::streamsize>(program.size()));
+        out.write(reinterpret_cast<const char*>(pageNums.data()), static_cast<std::streamsize>(pageNums.size() * 4));
+        std::vector<char> padding(header.pageOffset - indexEnd, 0);
+        out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        mem.forEachPage([&](unsigned int, const unsigned char* bytes)
+        {
+            out.write(reinterpret_cast<const char*>(bytes), Memory::PAGE_SIZE);
+        });
+        if (!out.good())
+        {
+            out.close();
+            std::remove(tempName.str().c_str());
+            std::cerr << "Error: Cannot write checkpoint " << path << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(tempName.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(tempName.str().c_str());
+        std::cerr << "Error: Cannot write checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Machine::checkpointProgram(const std::string& path, std::string& program)
+{
+    CheckpointHeader header;
+    std::shared_ptr<MappedFile> file = openCheckpoint(path, header);
+    if (!file) return false;
+    program.assign(reinterpret_cast<const char*>(file->data() + sizeof(header)), header.pathLength);
+    return true;
+}
+
+bool Machine::resumeCheckpoint(const std::string& path)
+{
+    CheckpointHeader header;
+    std::shared_ptr<MappedFile> file = openCheckpoint(path, header);
+    if (!file) return false;
+    if (header.fingerprint != prog->fingerprint())
+    {
+        std::cerr << "Error: " << path << " was saved from a different program" << std::endl;
+        return false;
+    }
+
+    regFile = RegisterFile();
+    for (int r = 0; r < 32; r++) regFile.set(r, header.registers[r]);
+    PC = header.PC;
+    HI = header.HI;
+    LO = header.LO;
+    heapPtr = header.heapPtr;
+    heap = header.heap;
+    halted = header.halted != 0;
+    executedCount = header.executedCount;
+
+    // Every page in the file shares ownership of the mapping
+    const unsigned char* index = file->data() + sizeof(header) + header.pathLength;
+    unsigned char* pages = file->privateData() + header.pageOffset;
+    mem = Memory();
+    for (unsigned int i = 0; i < header.pageCount; i++)
+    {
+        unsigned int pageNum;
+        std::memcpy(&pageNum, index + i * 4, sizeof(pageNum));
+        if (pageNum >> (32 - Memory::PAGE_BITS))
+        {
+            std::cerr << "Error: " << path << " is not a checkpoint this interpreter can resume" << std::endl;
+            restart();
+            return false;
+        }
+        mem.attachPage(pageNum, file, pages + static_cast<size_t>(i) * Memory::PAGE_SIZE);
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+File: copy_loops.cpp
+Author: Brysen Landis
+*/
+
+#include "copy_loops.h"
+
+static bool isIncrement(const DecodedInstruction& d, int amount)
+{
+    return (d.op == OP_ADDI || d.op == OP_ADDIU) && d.rt == d.rs && d.imm == amount;
+}
+
+size_t fuseCopyLoops(std::vector<DecodedInstruction>& program, std::vector<CopyLoop>& loops,
+                     unsigned int textBase)
+{
+    size_t fused = 0;
+    for (size_t i = 0; i + 4 < program.size(); i++)
+    {
+        const DecodedInstruction& load = program[i];
+        const DecodedInstruction& store = program[i + 1];
+        if ((load.op != OP_LB && load.op != OP_LBU) || load.imm != 0) continue;
+        if (store.op != OP_SB || store.imm != 0 || store.rt != load.rt) continue;
+
+        CopyLoop loop = {};
+        loop.load = load;
+        loop.temp = load.rt;
+        loop.src = load.rs;
+        loop.dst = store.rs;
+
+        // The increments, in any order, up to the branch
+        bool srcStep = false, dstStep = false;
+        int counter = -1;
+        size_t j = i + 2;
+        for (; j < program.size() && j < i + 5; j++)
+        {
+            const DecodedInstruction& d = program[j];
+            if (!srcStep && isIncrement(d, 1) && d.rt == loop.src) srcStep = true;
+            else if (!dstStep && isIncrement(d, 1) && d.rt == loop.dst) dstStep = true;
+            else if (counter < 0 && isIncrement(d, -1)) counter = d.rt;
+            else break;
+        }
+        if (!srcStep || !dstStep || j >= program.size()) continue;
+
+        const DecodedInstruction& branch = program[j];
+        const unsigned int head = textBase + static_cast<unsigned int>(i * 4);
+        if (branch.op != OP_BNE || branch.target != head) continue;
+        if (counter >= 0)
+        {
+            if (!(branch.rs == counter && branch.rt == 0) && !(branch.rt == counter && branch.rs == 0)) continue;
+            loop.bound = static_cast<unsigned char>(counter);
+        }
+        else
+        {
+            if (branch.rs != loop.src && branch.rt != loop.src) continue;
+            loop.bound = branch.rs == loop.src ? branch.rt : branch.rs;
+            loop.endPointer = true;
+        }
+
+        // Four different registers, none of them $zero
+        const unsigned char regs[4] = { loop.temp, loop.src, loop.dst, loop.bound };
+        bool distinct = true;
+        for (int a = 0; a < 4; a++)
+        {
+            if (regs[a] == 0) distinct = false;
+            for (int b = a + 1; b < 4; b++)
+            {
+                if (regs[a] == regs[b]) distinct = false;
+            }
+        }
+        if (!distinct) continue;
+
+        loop.length = static_cast<unsigned int>(j - i + 1);
+        loop.exit = head + loop.length * 4;
+        program[i] = { OP_COPY_LOOP, 0, 0, 0, static_cast<int>(loops.size()), loop.exit };
+        loops.push_back(loop);
+        fused++;
+        i = j;
+    }
+    return fused;
+}
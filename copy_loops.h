@@ -0,0 +1,38 @@
+/*
+File: copy_loops.h
+Author: Brysen Landis
+*/
+
+#ifndef COPY_LOOPS_H
+#define COPY_LOOPS_H
+
+#include <vector>
+#include "instruction.h"
+
+// A byte-copy loop found in the decoded program, in one of two shapes:
+//
+//     loop: lb   t, 0(src)             loop: lb   t, 0(src)
+//           sb   t, 0(dst)                   sb   t, 0(dst)
+//           addi src, src, 1                 addi src, src, 1
+//           addi dst, dst, 1                 addi dst, dst, 1
+//           addi count, count, -1            bne  src, end, loop
+//           bne  count, $zero, loop
+//
+// with lbu for lb, addiu for addi and the increments in any order.
+struct CopyLoop
+{
+    DecodedInstruction load;    // the lb or lbu the loop starts with
+    unsigned char temp, src, dst;
+    unsigned char bound;        // count register, or end register if endPointer
+    bool endPointer;
+    unsigned int length;        // instructions per iteration
+    unsigned int exit;          // address after the branch
+};
+
+// Replaces the first instruction of every copy loop in program with
+// OP_COPY_LOOP, whose imm indexes loops and whose target is the loop's exit.
+// The rest of each loop is left in place. Returns the number replaced.
+size_t fuseCopyLoops(std::vector<DecodedInstruction>& program, std::vector<CopyLoop>& loops,
+                     unsigned int textBase);
+
+#endif
@@ -0,0 +1,432 @@
+/*
+File: cpp_emitter.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+#include "trace.h"
+#include <cctype>
+
+// Ahead-of-time translation of a loaded program to a standalone C++ source
+// file. Guest registers become locals, every basic block gets a case label in
+// one big switch over the PC, and direct branches become gotos between those
+// labels. The small runtime at the top mirrors Memory and executeSyscall(),
+// without the file (13-16) and allocator (104-106) syscalls; a program that
+// uses them is not emitted.
+
+static const char* const CPP_RUNTIME = R"(#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+static uint8_t* pages[1u << 20];
+
+static inline uint8_t* page(uint32_t addr)
+{
+    uint8_t*& p = pages[addr >> 12];
+    if (!p) p = static_cast<uint8_t*>(std::calloc(4096, 1));
+    return p;
+}
+
+static inline uint8_t lb8(uint32_t a) { return page(a)[a & 4095]; }
+static inline void sb8(uint32_t a, uint8_t v) { page(a)[a & 4095] = v; }
+
+static inline uint16_t lh16(uint32_t a)
+{
+    if ((a & 1) == 0) { uint16_t v; std::memcpy(&v, page(a) + (a & 4095), 2); return v; }
+    return static_cast<uint16_t>(lb8(a) | (lb8(a + 1) << 8));
+}
+
+static inline void sh16(uint32_t a, uint16_t v)
+{
+    if ((a & 1) == 0) { std::memcpy(page(a) + (a & 4095), &v, 2); return; }
+    sb8(a, v & 0xFF); sb8(a + 1, v >> 8);
+}
+
+static inline uint32_t lw32(uint32_t a)
+{
+    if ((a & 3) == 0) { uint32_t v; std::memcpy(&v, page(a) + (a & 4095), 4); return v; }
+    return lb8(a) | (lb8(a + 1) << 8) | (lb8(a + 2) << 16) | (static_cast<uint32_t>(lb8(a + 3)) << 24);
+}
+
+static inline void sw32(uint32_t a, uint32_t v)
+{
+    if ((a & 3) == 0) { std::memcpy(page(a) + (a & 4095), &v, 4); return; }
+    sb8(a, v & 0xFF); sb8(a + 1, (v >> 8) & 0xFF); sb8(a + 2, (v >> 16) & 0xFF); sb8(a + 3, v >> 24);
+}
+
+static uint32_t heapPtr = 0x10020000;
+
+// Returns true when the program asks to exit
+static bool sys(uint32_t& v0, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    switch (v0)
+    {
+        case 1: std::cout << static_cast<int32_t>(a0); break;
+        case 4: for (uint8_t c; (c = lb8(a0)) != 0; a0++) std::cout << c; break;
+        case 5: { int value; std::cin >> value; v0 = static_cast<uint32_t>(value); break; }
+        case 8:
+        {
+            std::string input;
+            std::getline(std::cin, input);
+            int maxLen = static_cast<int>(a1);
+            if (maxLen <= 0) break;
+            for (int i = 0; i < maxLen - 1 && i < static_cast<int>(input.length()); i++) sb8(a0 + i, input[i]);
+            sb8(a0 + std::min(maxLen - 1, static_cast<int>(input.length())), 0);
+            break;
+        }
+        case 9: v0 = heapPtr; heapPtr += a0; break;
+        case 10: return true;
+        case 11: std::cout << static_cast<char>(a0); break;
+        case 12: { char ch; std::cin >> ch; v0 = static_cast<uint32_t>(ch); break; }
+        case 100:
+            if (a0 - a1 >= a2) for (uint32_t i = 0; i < a2; i++) sb8(a0 + i, lb8(a1 + i));
+            else for (uint32_t i = a2; i-- > 0; ) sb8(a0 + i, lb8(a1 + i));
+            v0 = a0;
+            break;
+        case 101: for (uint32_t i = 0; i < a2; i++) sb8(a0 + i, static_cast<uint8_t>(a1)); v0 = a0; break;
+        case 102:
+            v0 = 0;
+            for (uint32_t i = 0; i < a2 && v0 == 0; i++)
+            {
+                if (lb8(a0 + i) != lb8(a1 + i)) v0 = lb8(a0 + i) < lb8(a1 + i) ? 0xFFFFFFFFu : 1u;
+            }
+            break;
+        case 103: v0 = 0; while (lb8(a0 + v0) != 0) v0++; break;
+        default:
+            std::cout << std::flush;
+            std::cerr << "Error: Unsupported syscall: " << v0 << std::endl;
+            std::exit(1);
+    }
+    return false;
+}
+)";
+
+static std::string hex32(unsigned int value)
+{
+    std::ostringstream out;
+    out << "0x" << std::hex << std::setw(8) << std::setfill('0') << value << "u";
+    return out.str();
+}
+
+static std::string label(unsigned int addr)
+{
+    std::ostringstream out;
+    out << "L_" << std::hex << std::setw(8) << std::setfill('0') << addr;
+    return out.str();
+}
+
+static std::string reg(int n)
+{
+    return n == 0 ? std::string("0u") : "r" + std::to_string(n);
+}
+
+static std::string sreg(int n)
+{
+    return "static_cast<int32_t>(" + reg(n) + ")";
+}
+
+static std::string assign(int n, const std::string& expr)
+{
+    return n == 0 ? std::string() : "r" + std::to_string(n) + " = " + expr + ";";
+}
+
+static std::string imm(int value)
+{
+    return std::to_string(value);
+}
+
+// Marks the registers an emitted statement reads and writes, HI as 32 and
+// LO as 33, so main() declares only those and the output builds cleanly
+// with -Wall -Wextra
+static void noteRegisters(const std::string& s, bool read[34], bool written[34])
+{
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (i > 0 && (std::isalnum(static_cast<unsigned char>(s[i - 1])) || s[i - 1] == '_')) continue;
+        size_t end = i;
+        int n = -1;
+        if (s[i] == 'r' && i + 1 < s.size() && std::isdigit(static_cast<unsigned char>(s[i + 1])))
+        {
+            n = 0;
+            for (end = i + 1; end < s.size() && std::isdigit(static_cast<unsigned char>(s[end])); end++)
+            {
+                n = n * 10 + (s[end] - '0');
+            }
+        }
+        else if (s.compare(i, 2, "HI") == 0 || s.compare(i, 2, "LO") == 0)
+        {
+            n = s[i] == 'H' ? 32 : 33;
+            end = i + 2;
+        }
+        if (n < 0 || n >= 34 || (end < s.size() && (std::isalnum(static_cast<unsigned char>(s[end])) || s[end] == '_')))
+        {
+            continue;
+        }
+        if (s.compare(end, 3, " = ") == 0) written[n] = true;
+        else read[n] = true;
+        i = end - 1;
+    }
+}
+
+bool MIPSInterpreter::emitCpp(const std::string& filename)
+{
+    const size_t count = prog->code.size();
+    std::vector<bool> leader(count, false);
+    for (const BasicBlock& block : formBasicBlocks(prog->code, prog->labels, TEXT_BASE))
+    {
+        leader[block.first] = true;
+    }
+
+    // The entry point starts a block, which ELF images need not label
+    const unsigned int entryIndex = (prog->entry - TEXT_BASE) >> 2;
+    if ((prog->entry & 3) == 0 && entryIndex < count) leader[entryIndex] = true;
+
+    // Syscalls the runtime lacks are refused here wherever $v0 is set by a
+    // constant earlier in the block; any other $v0 is checked as it runs
+    for (size_t i = 0; i < count; i++)
+    {
+        if (prog->code[i].op != OP_SYSCALL) continue;
+        for (size_t j = i; j-- > 0 && !leader[j + 1]; )
+        {
+            const DecodedInstruction& d = prog->code[j];
+            const InstructionEffects effects = effectsOf(d);
+            if (!(effects.flags & TraceRecord::WRITES_REGISTER) || effects.reg != REG_V0) continue;
+            const bool constant = d.op == OP_LI || ((d.op == OP_ADDI || d.op == OP_ADDIU || d.op == OP_ORI) && d.rs == 0);
+            const unsigned int v0 = static_cast<unsigned int>(d.imm);
+            if (constant && ((v0 >= 13 && v0 <= 16) || (v0 >= 104 && v0 <= 106)))
+            {
+                std::cerr << "Error: The syscall at 0x" << std::hex << std::setw(8) << std::setfill('0')
+                          << TEXT_BASE + i * 4 << std::dec << std::setfill(' ') << " is number " << v0
+                          << ", which --emit-cpp does not support" << std::endl;
+                return false;
+            }
+            break;
+        }
+    }
+
+    auto inProgram = [&](unsigned int addr)
+    {
+        unsigned int index = (addr - TEXT_BASE) >> 2;
+        return (addr & 3) == 0 && index < count && leader[index];
+    };
+
+    // Direct transfers jump to a block label; anything else re-dispatches
+    bool usesDispatch = false;
+    auto jumpTo = [&](unsigned int addr)
+    {
+        if (inProgram(addr)) return "goto " + label(addr) + ";";
+        usesDispatch = true;
+        return "{ pc = " + hex32(addr) + "; goto dispatch; }";
+    };
+
+    // Block labels are only emitted where a direct branch lands
+    std::vector<bool> targeted(count, false);
+    for (const DecodedInstruction& d : prog->code)
+    {
+        if (d.op >= OP_BEQ && d.op <= OP_JAL && inProgram(d.target))
+        {
+            targeted[(d.target - TEXT_BASE) >> 2] = true;
+        }
+    }
+
+    std::ofstream out(filename);
+    if (!out.is_open())
+    {
+        std::cerr << "Error: Cannot write file " << filename << std::endl;
+        return false;
+    }
+
+    out << "// Generated by the MIPS interpreter (--emit-cpp)\n";
+    out << "// Build with: g++ -O2 -o program " << filename << "\n\n";
+    out << CPP_RUNTIME << "\n";
+
+    // Initialized data, one array per non-empty page
+    Memory data = prog->image;
+    std::vector<unsigned int> dataPages;
+    for (unsigned int pageAddr = DATA_BASE; pageAddr < prog->dataEnd; pageAddr += Memory::PAGE_SIZE)
+    {
+        unsigned int length = 0;
+        for (unsigned int i = 0; i < Memory::PAGE_SIZE; i++)
+        {
+            if (data.fetch(pageAddr + i) != 0) length = i + 1;
+        }
+        if (length == 0) continue;
+
+        out << "static const uint8_t data_" << std::hex << pageAddr << std::dec << "[" << length << "] = {";
+        for (unsigned int i = 0; i < length; i++)
+        {
+            out << (i % 16 == 0 ? "\n    " : " ") << static_cast<int>(data.fetch(pageAddr + i)) << ",";
+        }
+        out << "\n};\n\n";
+        dataPages.push_back(pageAddr);
+    }
+
+    out << "int main()\n{\n";
+    for (unsigned int pageAddr : dataPages)
+    {
+        out << "    std::memcpy(page(" << hex32(pageAddr) << "), data_" << std::hex << pageAddr << std::dec
+            << ", sizeof(data_" << std::hex << pageAddr << std::dec << "));\n";
+    }
+    if (heapStart(*prog) != HEAP_BASE)
+    {
+        out << "    heapPtr = " << hex32(heapStart(*prog)) << ";\n";
+    }
+    std::ostringstream body;
+    bool read[34] = {};
+    bool written[34] = {};
+    bool first = true;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Fused copy loops are emitted as the loops they were
+        const DecodedInstruction& d = prog->code[i].op == OP_COPY_LOOP ? prog->copyLoops[prog->code[i].imm].load
+                                                                        : prog->code[i];
+        unsigned int addr = TEXT_BASE + static_cast<unsigned int>(i * 4);
+        std::string s;
+
+        if (leader[i])
+        {
+            // Blocks run on into the next one
+            if (!first) body << "        [[fallthrough]];\n";
+            first = false;
+            body << "    case " << hex32(addr) << ":" << (targeted[i] ? " " + label(addr) + ":" : "") << "\n";
+        }
+
+        switch (d.op)
+        {
+            case OP_ADD: case OP_ADDU: s = assign(d.rd, reg(d.rs) + " + " + reg(d.rt)); break;
+            case OP_SUB: case OP_SUBU: s = assign(d.rd, reg(d.rs) + " - " + reg(d.rt)); break;
+            case OP_AND:   s = assign(d.rd, reg(d.rs) + " & " + reg(d.rt)); break;
+            case OP_OR:    s = assign(d.rd, reg(d.rs) + " | " + reg(d.rt)); break;
+            case OP_XOR:   s = assign(d.rd, reg(d.rs) + " ^ " + reg(d.rt)); break;
+            case OP_NOR:   s = assign(d.rd, "~(" + reg(d.rs) + " | " + reg(d.rt) + ")"); break;
+            case OP_SLT:   s = assign(d.rd, sreg(d.rs) + " < " + sreg(d.rt) + " ? 1u : 0u"); break;
+            case OP_SLTU:  s = assign(d.rd, reg(d.rs) + " < " + reg(d.rt) + " ? 1u : 0u"); break;
+            case OP_SLL:   s = assign(d.rd, reg(d.rt) + " << " + imm(d.imm)); break;
+            case OP_SRL:   s = assign(d.rd, reg(d.rt) + " >> " + imm(d.imm)); break;
+            case OP_SRA:   s = assign(d.rd, "static_cast<uint32_t>(" + sreg(d.rt) + " >> " + imm(d.imm) + ")"); break;
+            case OP_SLLV:  s = assign(d.rd, reg(d.rt) + " << (" + reg(d.rs) + " & 31)"); break;
+            case OP_SRLV:  s = assign(d.rd, reg(d.rt) + " >> (" + reg(d.rs) + " & 31)"); break;
+            case OP_SRAV:  s = assign(d.rd, "static_cast<uint32_t>(" + sreg(d.rt) + " >> (" + reg(d.rs) + " & 31))"); break;
+            case OP_MULT:
+                s = "{ int64_t p = static_cast<int64_t>(" + sreg(d.rs) + ") * " + sreg(d.rt) +
+                    "; LO = static_cast<uint32_t>(p); HI = static_cast<uint32_t>(p >> 32); }";
+                break;
+            case OP_MULTU:
+                s = "{ uint64_t p = static_cast<uint64_t>(" + reg(d.rs) + ") * " + reg(d.rt) +
+                    "; LO = static_cast<uint32_t>(p); HI = static_cast<uint32_t>(p >> 32); }";
+                break;
+            case OP_DIV:
+                s = "{ int32_t n = " + sreg(d.rs) + ", m = " + sreg(d.rt) + "; "
+                    "if (m == -1) { LO = 0u - static_cast<uint32_t>(n); HI = 0; } "
+                    "else if (m != 0) { LO = static_cast<uint32_t>(n / m); HI = static_cast<uint32_t>(n % m); } }";
+                break;
+            case OP_DIVU:
+                s = "{ uint32_t n = " + reg(d.rs) + ", m = " + reg(d.rt) + "; "
+                    "if (m != 0) { LO = n / m; HI = n % m; } }";
+                break;
+            case OP_MFHI:  s = assign(d.rd, "HI"); break;
+            case OP_MFLO:  s = assign(d.rd, "LO"); break;
+            case OP_MTHI:  s = "HI = " + reg(d.rs) + ";"; break;
+            case OP_MTLO:  s = "LO = " + reg(d.rs) + ";"; break;
+            case OP_JR:    usesDispatch = true; s = "pc = " + reg(d.rs) + "; goto dispatch;"; break;
+            case OP_JALR:
+                usesDispatch = true;
+                s = "{ uint32_t t = " + reg(d.rs) + "; " + assign(d.rd, hex32(addr + 4)) + " pc = t; goto dispatch; }";
+                break;
+            case OP_ADDI: case OP_ADDIU:
+                s = assign(d.rt, reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)));
+                break;
+            case OP_ANDI:  s = assign(d.rt, reg(d.rs) + " & " + hex32(static_cast<unsigned int>(d.imm))); break;
+            case OP_ORI:   s = assign(d.rt, reg(d.rs) + " | " + hex32(static_cast<unsigned int>(d.imm))); break;
+            case OP_XORI:  s = assign(d.rt, reg(d.rs) + " ^ " + hex32(static_cast<unsigned int>(d.imm))); break;
+            case OP_SLTI:  s = assign(d.rt, sreg(d.rs) + " < " + imm(d.imm) + " ? 1u : 0u"); break;
+            case OP_SLTIU: s = assign(d.rt, reg(d.rs) + " < " + hex32(static_cast<unsigned int>(d.imm)) + " ? 1u : 0u"); break;
+            case OP_LUI: case OP_LI: case OP_LA:
+                s = assign(d.rt, hex32(static_cast<unsigned int>(d.imm)));
+                break;
+            case OP_LW:
+                s = assign(d.rt, "lw32(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ")");
+                break;
+            case OP_LH:
+                s = assign(d.rt, "static_cast<uint32_t>(static_cast<int16_t>(lh16(" + reg(d.rs) + " + " +
+                                 hex32(static_cast<unsigned int>(d.imm)) + ")))");
+                break;
+            case OP_LHU:
+                s = assign(d.rt, "lh16(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ")");
+                break;
+            case OP_LB:
+                s = assign(d.rt, "static_cast<uint32_t>(static_cast<int8_t>(lb8(" + reg(d.rs) + " + " +
+                                 hex32(static_cast<unsigned int>(d.imm)) + ")))");
+                break;
+            case OP_LBU:
+                s = assign(d.rt, "lb8(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ")");
+                break;
+            case OP_SW:
+                s = "sw32(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ", " + reg(d.rt) + ");";
+                break;
+            case OP_SH:
+                s = "sh16(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ", static_cast<uint16_t>(" + reg(d.rt) + "));";
+                break;
+            case OP_SB:
+                s = "sb8(" + reg(d.rs) + " + " + hex32(static_cast<unsigned int>(d.imm)) + ", static_cast<uint8_t>(" + reg(d.rt) + "));";
+                break;
+            case OP_BEQ:   s = "if (" + reg(d.rs) + " == " + reg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BNE:   s = "if (" + reg(d.rs) + " != " + reg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BLT:   s = "if (" + sreg(d.rs) + " < " + sreg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BLE:   s = "if (" + sreg(d.rs) + " <= " + sreg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BGT:   s = "if (" + sreg(d.rs) + " > " + sreg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BGE:   s = "if (" + sreg(d.rs) + " >= " + sreg(d.rt) + ") " + jumpTo(d.target); break;
+            case OP_BLTZ:  s = "if (" + sreg(d.rs) + " < 0) " + jumpTo(d.target); break;
+            case OP_BLEZ:  s = "if (" + sreg(d.rs) + " <= 0) " + jumpTo(d.target); break;
+            case OP_BGTZ:  s = "if (" + sreg(d.rs) + " > 0) " + jumpTo(d.target); break;
+            case OP_BGEZ:  s = "if (" + sreg(d.rs) + " >= 0) " + jumpTo(d.target); break;
+            case OP_J:     s = jumpTo(d.target); break;
+            case OP_JAL:   s = "r31 = " + hex32(addr + 4) + "; " + jumpTo(d.target); break;
+            case OP_SYSCALL: s = "if (sys(r2, r4, r5, r6)) return 0;"; break;
+            case OP_MOVE:  s = assign(d.rd, reg(d.rs)); break;
+            case OP_CLEAR: s = assign(d.rd, "0u"); break;
+            case OP_NOT:   s = assign(d.rd, "~" + reg(d.rs)); break;
+            case OP_NOP: case OP_INVALID: case OP_COPY_LOOP: case OP_BREAKPOINT: case OP_COUNT:
+                break;
+        }
+
+        std::string source = prog->listing[i];
+        while (!source.empty() && source.back() == '\\') source.pop_back();
+        body << "        " << (s.empty() ? ";" : s) << " // " << source << "\n";
+        noteRegisters(s, read, written);
+    }
+
+    // Only registers the program touches are declared, and those it only
+    // writes are cast to void
+    std::string unread;
+    for (int i = 1; i < 32; i++)
+    {
+        if (!read[i] && !written[i]) continue;
+        out << "    uint32_t r" << i << " = " << (i == REG_SP ? hex32(STACK_BASE) : std::string("0")) << ";\n";
+        if (!read[i]) unread += " (void)r" + std::to_string(i) + ";";
+    }
+    if (read[32] || written[32] || read[33] || written[33])
+    {
+        out << "    uint32_t HI = 0, LO = 0;\n";
+        if (!read[32]) unread += " (void)HI;";
+        if (!read[33]) unread += " (void)LO;";
+    }
+    if (!unread.empty()) out << "   " << unread << "\n";
+    out << "    uint32_t pc = " << hex32(prog->entry) << ";\n\n";
+    if (usesDispatch) out << "dispatch:\n";
+    out << "    switch (pc)\n    {\n";
+    out << "    default:\n        goto done;\n";
+    out << body.str();
+    out << "    }\n\n";
+    out << "done:\n";
+    out << "    std::cout << std::flush;\n";
+    out << "    return 0;\n";
+    out << "}\n";
+
+    std::cout << "Wrote " << count << " instructions to " << filename << std::endl;
+    return true;
+}
@@ -0,0 +1,391 @@
+/*
+File: encoding.cpp
+Author: Brysen Landis
+*/
+
+#include "encoding.h"
+#include "register_file.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+// Primary opcode field (bits 31..26)
+enum PrimaryOpcode
+{
+    PRI_SPECIAL = 0x00, PRI_REGIMM = 0x01, PRI_J = 0x02, PRI_JAL = 0x03,
+    PRI_BEQ = 0x04, PRI_BNE = 0x05, PRI_BLEZ = 0x06, PRI_BGTZ = 0x07,
+    PRI_ADDI = 0x08, PRI_ADDIU = 0x09, PRI_SLTI = 0x0A, PRI_SLTIU = 0x0B,
+    PRI_ANDI = 0x0C, PRI_ORI = 0x0D, PRI_XORI = 0x0E, PRI_LUI = 0x0F,
+    PRI_LB = 0x20, PRI_LH = 0x21, PRI_LW = 0x23, PRI_LBU = 0x24, PRI_LHU = 0x25,
+    PRI_SB = 0x28, PRI_SH = 0x29, PRI_SW = 0x2B
+};
+
+// Function field (bits 5..0) of SPECIAL instructions
+enum FunctionCode
+{
+    FN_SLL = 0x00, FN_SRL = 0x02, FN_SRA = 0x03,
+    FN_SLLV = 0x04, FN_SRLV = 0x06, FN_SRAV = 0x07,
+    FN_JR = 0x08, FN_JALR = 0x09, FN_SYSCALL = 0x0C,
+    FN_MFHI = 0x10, FN_MTHI = 0x11, FN_MFLO = 0x12, FN_MTLO = 0x13,
+    FN_MULT = 0x18, FN_MULTU = 0x19, FN_DIV = 0x1A, FN_DIVU = 0x1B,
+    FN_ADD = 0x20, FN_ADDU = 0x21, FN_SUB = 0x22, FN_SUBU = 0x23,
+    FN_AND = 0x24, FN_OR = 0x25, FN_XOR = 0x26, FN_NOR = 0x27,
+    FN_SLT = 0x2A, FN_SLTU = 0x2B
+};
+
+// REGIMM rt field
+enum { RI_BLTZ = 0x00, RI_BGEZ = 0x01 };
+
+static unsigned int rType(unsigned int funct, unsigned int rs, unsigned int rt, unsigned int rd, unsigned int shamt = 0)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | ((shamt & 0x1F) << 6) | funct;
+}
+
+static unsigned int iType(unsigned int op, unsigned int rs, unsigned int rt, int imm)
+{
+    return (op << 26) | (rs << 21) | (rt << 16) | (static_cast<unsigned int>(imm) & 0xFFFF);
+}
+
+static bool fitsSigned16(int value)
+{
+    return value >= -32768 && value <= 32767;
+}
+
+// Word offset from the following instruction, as the hardware computes it
+static int branchOffset(unsigned int target, unsigned int addr)
+{
+    int offset = static_cast<int>(target - (addr + 4)) >> 2;
+    if (!fitsSigned16(offset))
+    {
+        std::cerr << "Error: Branch target out of range at 0x" << std::hex << addr << std::dec << std::endl;
+    }
+    return offset;
+}
+
+static unsigned int jType(unsigned int op, unsigned int target, unsigned int addr)
+{
+    if ((target & 0xF0000000) != ((addr + 4) & 0xF0000000))
+    {
+        std::cerr << "Error: Jump target out of range at 0x" << std::hex << addr << std::dec << std::endl;
+    }
+    return (op << 26) | ((target >> 2) & 0x03FFFFFF);
+}
+
+// Upper half for a lui/offset pair, rounded so the sign-extended low half adds back correctly
+static unsigned int highAdjusted(int value)
+{
+    return ((static_cast<unsigned int>(value) + 0x8000) >> 16) & 0xFFFF;
+}
+
+static void loadConstant(int reg, int value, std::vector<unsigned int>& words)
+{
+    words.push_back(iType(PRI_LUI, 0, reg, static_cast<int>(static_cast<unsigned int>(value) >> 16)));
+    words.push_back(iType(PRI_ORI, reg, reg, value));
+}
+
+void encodeInstruction(const DecodedInstruction& d, unsigned int addr, std::vector<unsigned int>& words)
+{
+    switch (d.op)
+    {
+        case OP_ADD:   words.push_back(rType(FN_ADD, d.rs, d.rt, d.rd)); break;
+        case OP_ADDU:  words.push_back(rType(FN_ADDU, d.rs, d.rt, d.rd)); break;
+        case OP_SUB:   words.push_back(rType(FN_SUB, d.rs, d.rt, d.rd)); break;
+        case OP_SUBU:  words.push_back(rType(FN_SUBU, d.rs, d.rt, d.rd)); break;
+        case OP_AND:   words.push_back(rType(FN_AND, d.rs, d.rt, d.rd)); break;
+        case OP_OR:    words.push_back(rType(FN_OR, d.rs, d.rt, d.rd)); break;
+        case OP_XOR:   words.push_back(rType(FN_XOR, d.rs, d.rt, d.rd)); break;
+        case OP_NOR:   words.push_back(rType(FN_NOR, d.rs, d.rt, d.rd)); break;
+        case OP_SLT:   words.push_back(rType(FN_SLT, d.rs, d.rt, d.rd)); break;
+        case OP_SLTU:  words.push_back(rType(FN_SLTU, d.rs, d.rt, d.rd)); break;
+        case OP_SLL:   words.push_back(rType(FN_SLL, 0, d.rt, d.rd, d.imm)); break;
+        case OP_SRL:   words.push_back(rType(FN_SRL, 0, d.rt, d.rd, d.imm)); break;
+        case OP_SRA:   words.push_back(rType(FN_SRA, 0, d.rt, d.rd, d.imm)); break;
+        case OP_SLLV:  words.push_back(rType(FN_SLLV, d.rs, d.rt, d.rd)); break;
+        case OP_SRLV:  words.push_back(rType(FN_SRLV, d.rs, d.rt, d.rd)); break;
+        case OP_SRAV:  words.push_back(rType(FN_SRAV, d.rs, d.rt, d.rd)); break;
+        case OP_MULT:  words.push_back(rType(FN_MULT, d.rs, d.rt, 0)); break;
+        case OP_MULTU: words.push_back(rType(FN_MULTU, d.rs, d.rt, 0)); break;
+        case OP_DIV:   words.push_back(rType(FN_DIV, d.rs, d.rt, 0)); break;
+        case OP_DIVU:  words.push_back(rType(FN_DIVU, d.rs, d.rt, 0)); break;
+        case OP_MFHI:  words.push_back(rType(FN_MFHI, 0, 0, d.rd)); break;
+        case OP_MFLO:  words.push_back(rType(FN_MFLO, 0, 0, d.rd)); break;
+        case OP_MTHI:  words.push_back(rType(FN_MTHI, d.rs, 0, 0)); break;
+        case OP_MTLO:  words.push_back(rType(FN_MTLO, d.rs, 0, 0)); break;
+        case OP_JR:    words.push_back(rType(FN_JR, d.rs, 0, 0)); break;
+        case OP_JALR:  words.push_back(rType(FN_JALR, d.rs, 0, d.rd)); break;
+        case OP_SYSCALL: words.push_back(FN_SYSCALL); break;
+
+        // Immediates that do not fit go through $at
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU:
+        {
+            static const unsigned int immediateOp[] = { PRI_ADDI, PRI_ADDIU, PRI_SLTI, PRI_SLTIU };
+            static const unsigned int registerOp[] = { FN_ADD, FN_ADDU, FN_SLT, FN_SLTU };
+            int which = d.op == OP_ADDI ? 0 : d.op == OP_ADDIU ? 1 : d.op == OP_SLTI ? 2 : 3;
+            if (fitsSigned16(d.imm))
+            {
+                words.push_back(iType(immediateOp[which], d.rs, d.rt, d.imm));
+            }
+            else
+            {
+                loadConstant(REG_AT, d.imm, words);
+                words.push_back(rType(registerOp[which], d.rs, REG_AT, d.rt));
+            }
+            break;
+        }
+        case OP_ANDI:  words.push_back(iType(PRI_ANDI, d.rs, d.rt, d.imm)); break;
+        case OP_ORI:   words.push_back(iType(PRI_ORI, d.rs, d.rt, d.imm)); break;
+        case OP_XORI:  words.push_back(iType(PRI_XORI, d.rs, d.rt, d.imm)); break;
+        case OP_LUI:   words.push_back(iType(PRI_LUI, 0, d.rt, static_cast<int>(static_cast<unsigned int>(d.imm) >> 16))); break;
+
+        case OP_LW: case OP_LH: case OP_LHU: case OP_LB: case OP_LBU: case OP_SW: case OP_SH: case OP_SB:
+        {
+            unsigned int op = d.op == OP_LW ? PRI_LW : d.op == OP_LH ? PRI_LH : d.op == OP_LHU ? PRI_LHU :
+                              d.op == OP_LB ? PRI_LB : d.op == OP_LBU ? PRI_LBU : d.op == OP_SW ? PRI_SW :
+                              d.op == OP_SH ? PRI_SH : PRI_SB;
+            if (fitsSigned16(d.imm))
+            {
+                words.push_back(iType(op, d.rs, d.rt, d.imm));
+            }
+            else
+            {
+                words.push_back(iType(PRI_LUI, 0, REG_AT, static_cast<int>(highAdjusted(d.imm))));
+                if (d.rs != REG_ZERO) words.push_back(rType(FN_ADDU, REG_AT, d.rs, REG_AT));
+                words.push_back(iType(op, REG_AT, d.rt, d.imm));
+            }
+            break;
+        }
+
+        case OP_BEQ:   words.push_back(iType(PRI_BEQ, d.rs, d.rt, branchOffset(d.target, addr))); break;
+        case OP_BNE:   words.push_back(iType(PRI_BNE, d.rs, d.rt, branchOffset(d.target, addr))); break;
+        case OP_BLTZ:  words.push_back(iType(PRI_REGIMM, d.rs, RI_BLTZ, branchOffset(d.target, addr))); break;
+        case OP_BGEZ:  words.push_back(iType(PRI_REGIMM, d.rs, RI_BGEZ, branchOffset(d.target, addr))); break;
+        case OP_BLEZ:  words.push_back(iType(PRI_BLEZ, d.rs, 0, branchOffset(d.target, addr))); break;
+        case OP_BGTZ:  words.push_back(iType(PRI_BGTZ, d.rs, 0, branchOffset(d.target, addr))); break;
+
+        // Two-register compares become slt into $at plus a branch on $at
+        case OP_BLT: case OP_BGE:
+            words.push_back(rType(FN_SLT, d.rs, d.rt, REG_AT));
+            words.push_back(iType(d.op == OP_BLT ? PRI_BNE : PRI_BEQ, REG_AT, 0, branchOffset(d.target, addr + 4)));
+            break;
+        case OP_BGT: case OP_BLE:
+            words.push_back(rType(FN_SLT, d.rt, d.rs, REG_AT));
+            words.push_back(iType(d.op == OP_BGT ? PRI_BNE : PRI_BEQ, REG_AT, 0, branchOffset(d.target, addr + 4)));
+            break;
+
+        case OP_J:     words.push_back(jType(PRI_J, d.target, addr)); break;
+        case OP_JAL:   words.push_back(jType(PRI_JAL, d.target, addr)); break;
+
+        case OP_LI:
+            if (fitsSigned16(d.imm))
+            {
+                words.push_back(iType(PRI_ADDIU, 0, d.rt, d.imm));
+            }
+            else if ((static_cast<unsigned int>(d.imm) >> 16) == 0)
+            {
+                words.push_back(iType(PRI_ORI, 0, d.rt, d.imm));
+            }
+            else
+            {
+                loadConstant(d.rt, d.imm, words);
+            }
+            break;
+        case OP_LA:    loadConstant(d.rt, d.imm, words); break;
+        case OP_MOVE:  words.push_back(rType(FN_ADDU, d.rs, 0, d.rd)); break;
+        case OP_CLEAR: words.push_back(rType(FN_ADDU, 0, 0, d.rd)); break;
+        case OP_NOT:   words.push_back(rType(FN_NOR, d.rs, 0, d.rd)); break;
+
+        // Lines that failed to decode were already reported; they assemble to a
+        // nop. Copy loops and breakpoints only appear after assembly.
+        case OP_NOP: case OP_INVALID: case OP_COPY_LOOP: case OP_BREAKPOINT: case OP_COUNT:
+            words.push_back(0);
+            break;
+    }
+}
+
+DecodedInstruction decodeWord(unsigned int word, unsigned int addr)
+{
+    DecodedInstruction d = { OP_INVALID, 0, 0, 0, 0, 0 };
+    if (word == 0)
+    {
+        d.op = OP_NOP;
+        return d;
+    }
+
+    unsigned int opcode = word >> 26;
+    unsigned char rs = (word >> 21) & 0x1F;
+    unsigned char rt = (word >> 16) & 0x1F;
+    unsigned char rd = (word >> 11) & 0x1F;
+    int simm = static_cast<short>(word & 0xFFFF);
+    int uimm = static_cast<int>(word & 0xFFFF);
+    unsigned int branchTarget = addr + 4 + (static_cast<unsigned int>(simm) << 2);
+
+    if (opcode == PRI_SPECIAL)
+    {
+        static const Opcode special[64] = {
+            OP_SLL, OP_INVALID, OP_SRL, OP_SRA, OP_SLLV, OP_INVALID, OP_SRLV, OP_SRAV,
+            OP_JR, OP_JALR, OP_INVALID, OP_INVALID, OP_SYSCALL, OP_INVALID, OP_INVALID, OP_INVALID,
+            OP_MFHI, OP_MTHI, OP_MFLO, OP_MTLO, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID,
+            OP_MULT, OP_MULTU, OP_DIV, OP_DIVU, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID,
+            OP_ADD, OP_ADDU, OP_SUB, OP_SUBU, OP_AND, OP_OR, OP_XOR, OP_NOR,
+            OP_INVALID, OP_INVALID, OP_SLT, OP_SLTU, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID,
+            OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID,
+            OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID
+        };
+        d.op = special[word & 0x3F];
+        if (d.op == OP_INVALID || d.op == OP_SYSCALL) return d;
+        d.rs = rs;
+        d.rt = rt;
+        d.rd = rd;
+        if (d.op == OP_SLL || d.op == OP_SRL || d.op == OP_SRA)
+        {
+            d.rs = 0;
+            d.imm = (word >> 6) & 0x1F;
+        }
+        return d;
+    }
+
+    switch (opcode)
+    {
+        case PRI_REGIMM:
+            if (rt != RI_BLTZ && rt != RI_BGEZ) return d;
+            d.op = rt == RI_BLTZ ? OP_BLTZ : OP_BGEZ;
+            d.rs = rs;
+            d.target = branchTarget;
+            return d;
+        case PRI_J: case PRI_JAL:
+            d.op = opcode == PRI_J ? OP_J : OP_JAL;
+            d.target = ((addr + 4) & 0xF0000000) | ((word & 0x03FFFFFF) << 2);
+            return d;
+        case PRI_BEQ:  d.op = OP_BEQ; break;
+        case PRI_BNE:  d.op = OP_BNE; break;
+        case PRI_BLEZ: d.op = OP_BLEZ; break;
+        case PRI_BGTZ: d.op = OP_BGTZ; break;
+        case PRI_ADDI: d.op = OP_ADDI; break;
+        case PRI_ADDIU: d.op = OP_ADDIU; break;
+        case PRI_SLTI: d.op = OP_SLTI; break;
+        case PRI_SLTIU: d.op = OP_SLTIU; break;
+        case PRI_ANDI: d.op = OP_ANDI; break;
+        case PRI_ORI:  d.op = OP_ORI; break;
+        case PRI_XORI: d.op = OP_XORI; break;
+        case PRI_LUI:  d.op = OP_LUI; break;
+        case PRI_LB:   d.op = OP_LB; break;
+        case PRI_LH:   d.op = OP_LH; break;
+        case PRI_LW:   d.op = OP_LW; break;
+        case PRI_LBU:  d.op = OP_LBU; break;
+        case PRI_LHU:  d.op = OP_LHU; break;
+        case PRI_SB:   d.op = OP_SB; break;
+        case PRI_SH:   d.op = OP_SH; break;
+        case PRI_SW:   d.op = OP_SW; break;
+        default:
+            return d;
+    }
+
+    d.rs = rs;
+    d.rt = rt;
+    switch (d.op)
+    {
+        case OP_BEQ: case OP_BNE: case OP_BLEZ: case OP_BGTZ:
+            d.target = branchTarget;
+            break;
+        case OP_ANDI: case OP_ORI: case OP_XORI:
+            d.imm = uimm;
+            break;
+        case OP_LUI:
+            d.rs = 0;
+            d.imm = static_cast<int>(static_cast<unsigned int>(uimm) << 16);
+            break;
+        default:
+            d.imm = simm;
+            break;
+    }
+    return d;
+}
+
+static const char* const REGISTER_NAMES[32] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+
+const char* registerName(unsigned int reg)
+{
+    return REGISTER_NAMES[reg & 0x1F];
+}
+
+const char* mnemonic(Opcode op)
+{
+    static const char* const names[OP_COUNT] = {
+        "add", "addu", "sub", "subu", "and", "or", "xor", "nor", "slt", "sltu",
+        "sll", "srl", "sra", "sllv", "srlv", "srav",
+        "mult", "multu", "div", "divu", "mfhi", "mflo", "mthi", "mtlo", "jr", "jalr",
+        "addi", "addiu", "andi", "ori", "xori", "slti", "sltiu", "lui",
+        "lw", "lh", "lhu", "lb", "lbu", "sw", "sh", "sb",
+        "beq", "bne", "blt", "ble", "bgt", "bge", "bltz", "blez", "bgtz", "bgez",
+        "j", "jal", "syscall", "nop", "li", "la", "move", "clear", "not", "(invalid)",
+        "(copy loop)", "(breakpoint)"
+    };
+    return op < OP_COUNT ? names[op] : "?";
+}
+
+std::string disassemble(const DecodedInstruction& d)
+{
+    std::ostringstream out;
+    const char* rd = REGISTER_NAMES[d.rd & 0x1F];
+    const char* rs = REGISTER_NAMES[d.rs & 0x1F];
+    const char* rt = REGISTER_NAMES[d.rt & 0x1F];
+    out << mnemonic(d.op);
+
+    switch (d.op)
+    {
+        case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU: case OP_AND: case OP_OR:
+        case OP_XOR: case OP_NOR: case OP_SLT: case OP_SLTU:
+            out << " " << rd << ", " << rs << ", " << rt;
+            break;
+        case OP_SLL: case OP_SRL: case OP_SRA:
+            out << " " << rd << ", " << rt << ", " << d.imm;
+            break;
+        case OP_SLLV: case OP_SRLV: case OP_SRAV:
+            out << " " << rd << ", " << rt << ", " << rs;
+            break;
+        case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU:
+            out << " " << rs << ", " << rt;
+            break;
+        case OP_MFHI: case OP_MFLO: case OP_CLEAR:
+            out << " " << rd;
+            break;
+        case OP_MTHI: case OP_MTLO: case OP_JR:
+            out << " " << rs;
+            break;
+        case OP_JALR: case OP_MOVE: case OP_NOT:
+            out << " " << rd << ", " << rs;
+            break;
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU:
+            out << " " << rt << ", " << rs << ", " << d.imm;
+            break;
+        case OP_ANDI: case OP_ORI: case OP_XORI:
+            out << " " << rt << ", " << rs << ", 0x" << std::hex << d.imm;
+            break;
+        case OP_LUI:
+            out << " " << rt << ", 0x" << std::hex << (static_cast<unsigned int>(d.imm) >> 16);
+            break;
+        case OP_LI: case OP_LA:
+            out << " " << rt << ", " << d.imm;
+            break;
+        case OP_LW: case OP_LH: case OP_LHU: case OP_LB: case OP_LBU: case OP_SW: case OP_SH: case OP_SB:
+            out << " " << rt << ", " << d.imm << "(" << rs << ")";
+            break;
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+            out << " " << rs << ", " << rt << ", 0x" << std::hex << std::setw(8) << std::setfill('0') << d.target;
+            break;
+        case OP_BLTZ: case OP_BLEZ: case OP_BGTZ: case OP_BGEZ:
+            out << " " << rs << ", 0x" << std::hex << std::setw(8) << std::setfill('0') << d.target;
+            break;
+        case OP_J: case OP_JAL:
+            out << " 0x" << std::hex << std::setw(8) << std::setfill('0') << d.target;
+            break;
+        case OP_SYSCALL: case OP_NOP: case OP_INVALID: case OP_COPY_LOOP: case OP_BREAKPOINT: case OP_COUNT:
+            break;
+    }
+    return out.str();
+}
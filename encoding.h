@@ -0,0 +1,30 @@
+/*
+File: encoding.h
+Author: Brysen Landis
+*/
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <vector>
+#include <string>
+#include "instruction.h"
+
+// Appends the MIPS-I machine words for d, assembled at addr. Pseudo-instructions
+// and immediates that do not fit 16 bits expand to several words using $at.
+void encodeInstruction(const DecodedInstruction& d, unsigned int addr, std::vector<unsigned int>& words);
+
+// Decodes one machine word fetched from addr. Unrecognized words decode to
+// OP_INVALID.
+DecodedInstruction decodeWord(unsigned int word, unsigned int addr);
+
+// Instruction name of an opcode, such as "addi"
+const char* mnemonic(Opcode op);
+
+// Name of a general register such as "$t0"; reg is taken modulo 32
+const char* registerName(unsigned int reg);
+
+// Assembly text for a decoded machine instruction, used when no source exists
+std::string disassemble(const DecodedInstruction& d);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+File: fan_out.cpp
+Author: Brysen Landis
+*/
+
+#include "fan_out.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include <chrono>
+
+struct FanOutRun
+{
+    std::string input;
+    std::string output;
+    std::string error;
+    double seconds;
+    unsigned long long instructions;
+};
+
+int runFanOut(const std::string& filename, const std::string& label, const std::vector<std::string>& inputs,
+              const MIPSInterpreter& settings, unsigned int threads)
+{
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    MIPSInterpreter prefix;
+    std::ostream discard(nullptr);
+    prefix.copySettings(settings);
+    prefix.setMessages(discard);
+    if (!prefix.loadFile(filename)) return 1;
+
+    std::shared_ptr<const Program> program = prefix.sharedProgram();
+    auto found = program->labels.find(label);
+    if (found == program->labels.end())
+    {
+        std::cerr << "Error: Unknown label " << label << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!prefix.runUntil(found->second))
+    {
+        std::cerr << "Error: Program ended before reaching " << label << std::endl;
+        return 1;
+    }
+    const Machine::Snapshot snapshot = prefix.snapshot();
+    double prefixSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<FanOutRun> runs(inputs.size());
+    start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(threads);
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            FanOutRun& run = runs[i];
+            run.input = inputs[i];
+            pool.submit([&run, &snapshot, &program, &settings]
+            {
+                auto runStart = std::chrono::steady_clock::now();
+                MappedFile inputFile(run.input);
+                if (!inputFile.isOpen())
+                {
+                    run.error = "cannot open " + run.input;
+                    return;
+                }
+
+                MIPSInterpreter machine;
+                std::ostringstream output;
+                std::ostream quiet(nullptr);
+                machine.copySettings(settings);
+                machine.setMessages(quiet);
+                machine.loadProgram(program);
+                machine.restore(snapshot);
+                machine.setInput(std::string(reinterpret_cast<const char*>(inputFile.data()), inputFile.size()));
+                machine.setOutput(output);
+                machine.setErrorOutput(output);
+                machine.run();
+
+                run.output = output.str();
+                run.instructions = machine.instructionsExecuted() - snapshot.executedCount;
+                run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+            });
+        }
+        pool.wait();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool failed = false;
+    for (const FanOutRun& run : runs)
+    {
+        std::cout << "\n=== " << run.input << " ===\n";
+        if (!run.error.empty())
+        {
+            std::cout << "Error: " << run.error << "\n";
+            failed = true;
+            continue;
+        }
+        std::cout << run.output;
+        if (!run.output.empty() && run.output.back() != '\n') std::cout << "\n";
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "\n=== Fan-out: " << runs.size() << " inputs from " << label << " on " << threads << " threads ===\n";
+    std::cout << "Prefix " << snapshot.executedCount << " instructions in " << prefixSeconds * 1000 << " ms, run once\n";
+    std::cout << "Wall " << wall << " s, " << (wall > 0 ? runs.size() / wall : 0) << " runs/sec\n";
+    unsigned long long instructions = 0;
+    for (const FanOutRun& run : runs) instructions += run.instructions;
+    std::cout << instructions << " instructions after the snapshot\n";
+    std::cout << std::defaultfloat;
+
+    return failed ? 1 : 0;
+}
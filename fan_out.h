@@ -0,0 +1,21 @@
+/*
+File: fan_out.h
+Author: Brysen Landis
+*/
+
+#ifndef FAN_OUT_H
+#define FAN_OUT_H
+
+#include <string>
+#include <vector>
+#include "interpreter.h"
+
+// Runs a program up to a label once, snapshots the machine there and then
+// finishes the run once per input file, each from a restored copy of the
+// snapshot, on a pool of threads. The prefix uses the console; each input's
+// output, with anything written to descriptor 2, is printed under its name.
+// Returns the process exit code.
+int runFanOut(const std::string& filename, const std::string& label, const std::vector<std::string>& inputs,
+              const MIPSInterpreter& settings, unsigned int threads);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+File: file_syscalls.cpp
+Author: Brysen Landis
+*/
+
+#include "machine.h"
+#include <algorithm>
+#include <filesystem>
+
+// MARS file syscalls:
+//   13 open   $a0 = path, $a1 = flags (0 read, 1 write, 9 append) -> $v0 = fd
+//   14 read   $a0 = fd, $a1 = buffer, $a2 = max bytes             -> $v0 = bytes read
+//   15 write  $a0 = fd, $a1 = buffer, $a2 = bytes                 -> $v0 = bytes written
+//   16 close  $a0 = fd
+// Errors return -1 in $v0. Descriptors 0, 1 and 2 are the host's input,
+// output and error callbacks. Reads and writes go straight between the host
+// file and guest pages.
+
+bool Machine::resolveGuestPath(const std::string& guestPath, std::string& hostPath) const
+{
+    if (guestPath.empty() || guestPath[0] == '/' || guestPath[0] == '\\') return false;
+
+    // No component may climb out of the root
+    size_t start = 0;
+    while (start <= guestPath.size())
+    {
+        size_t end = guestPath.find_first_of("/\\", start);
+        if (end == std::string::npos) end = guestPath.size();
+        if (guestPath.compare(start, end - start, "..") == 0) return false;
+        start = end + 1;
+    }
+
+    // Nor may a symbolic link lead out of it; links are resolved before the
+    // check, and the file is opened by its resolved path
+    std::error_code error;
+    const std::filesystem::path root = std::filesystem::weakly_canonical(fileRoot.empty() ? "." : fileRoot, error);
+    if (error) return false;
+    const std::filesystem::path resolved = std::filesystem::weakly_canonical(root / guestPath, error);
+    if (error) return false;
+    if (std::mismatch(root.begin(), root.end(), resolved.begin(), resolved.end()).first != root.end()) return false;
+
+    hostPath = resolved.string();
+    return true;
+}
+
+void Machine::executeFileSyscall(unsigned int v0)
+{
+    const unsigned int a0 = regFile.get(REG_A0);
+    const unsigned int a1 = regFile.get(REG_A1);
+    const unsigned int a2 = regFile.get(REG_A2);
+    int result = -1;
+
+    // The open file behind a descriptor, or null
+    auto fileFor = [this](unsigned int fd) -> std::FILE*
+    {
+        if (fd < FIRST_FILE || fd - FIRST_FILE >= files.size()) return nullptr;
+        return files[fd - FIRST_FILE].get();
+    };
+
+    switch (v0)
+    {
+        case 13:
+        {
+            const char* mode = a1 == 0 ? "rb" : a1 == 1 ? "wb" : a1 == 9 ? "ab" : nullptr;
+            std::string guestPath, hostPath;
+            mem.appendString(a0, guestPath);
+            if (!mode || !resolveGuestPath(guestPath, hostPath)) break;
+
+            size_t slot = 0;
+            while (slot < files.size() && files[slot]) slot++;
+            if (slot == MAX_FILES) break;
+
+            std::FILE* file = std::fopen(hostPath.c_str(), mode);
+            if (!file) break;
+            if (slot == files.size()) files.emplace_back();
+            files[slot] = std::shared_ptr<std::FILE>(file, std::fclose);
+            result = static_cast<int>(FIRST_FILE + slot);
+            break;
+        }
+        case 14:
+        {
+            if (a0 == 0)
+            {
+                if (!host.read) break;
+                if (!inputPreloaded) flushOutput();
+                result = static_cast<int>(mem.fillBlock(a1, a2, [this](unsigned char* bytes, size_t length)
+                {
+                    return host.read(reinterpret_cast<char*>(bytes), length);
+                }));
+                break;
+            }
+            std::FILE* file = fileFor(a0);
+            if (!file) break;
+            result = static_cast<int>(mem.fillBlock(a1, a2, [file](unsigned char* bytes, size_t length)
+            {
+                return std::fread(bytes, 1, length, file);
+            }));
+            if (std::ferror(file)) result = -1;
+            break;
+        }
+        case 15:
+        {
+            if (a0 == 1 || a0 == 2)
+            {
+                // Standard output joins the console buffer; errors flush it and
+                // go out at once
+                std::string errors;
+                std::string& target = a0 == 1 ? output : errors;
+                result = static_cast<int>(mem.drainBlock(a1, a2, [&target](const unsigned char* bytes, size_t length)
+                {
+                    target.append(reinterpret_cast<const char*>(bytes), length);
+                    return length;
+                }));
+                if (a0 == 2)
+                {
+                    flushOutput();
+                    if (host.writeError) host.writeError(errors.data(), errors.size());
+                }
+                else if (output.size() >= OUTPUT_BUFFER_SIZE)
+                {
+                    flushOutput();
+                }
+                break;
+            }
+            std::FILE* file = fileFor(a0);
+            if (!file) break;
+            result = static_cast<int>(mem.drainBlock(a1, a2, [file](const unsigned char* bytes, size_t length)
+            {
+                return std::fwrite(bytes, 1, length, file);
+            }));
+            if (std::ferror(file)) result = -1;
+            break;
+        }
+        case 16:
+        {
+            if (fileFor(a0))
+            {
+                files[a0 - FIRST_FILE].reset();
+                result = 0;
+            }
+            break;
+        }
+    }
+
+    regFile.set(REG_V0, static_cast<unsigned int>(result));
+}
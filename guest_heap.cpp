@@ -0,0 +1,211 @@
+/*
+File: guest_heap.cpp
+Author: Brysen Landis
+*/
+
+#include "machine.h"
+#include <algorithm>
+#include <sstream>
+
+// Allocator syscalls:
+//   104 malloc   $a0 = bytes                   -> $v0 = address, 0 if out of memory
+//   105 free     $a0 = address
+//   106 realloc  $a0 = address, $a1 = bytes    -> $v0 = address, 0 if out of memory
+// Addresses are 8-byte aligned. Blocks up to a class size are served from
+// that class's free list or the current span; bigger ones are whole pages
+// from the break, reused first-fit once freed. The break is shared with
+// sbrk and stops at the stack pointer.
+
+static const unsigned int CLASS_SIZES[GuestHeap::CLASS_COUNT] = {
+    16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+static const unsigned int HEADER_SIZE = 8;
+static const unsigned int LIVE_TAG = 0xA110C8ED;
+static const unsigned int FREE_TAG = 0xF4EEB10C;
+
+// Freed large blocks looked at before taking fresh pages instead
+static const unsigned int LARGE_SEARCH_LIMIT = 64;
+
+// The smallest class whose blocks hold bytes, or CLASS_COUNT if none does
+static unsigned int classFor(unsigned int bytes)
+{
+    unsigned int c = 0;
+    while (c < GuestHeap::CLASS_COUNT && CLASS_SIZES[c] - HEADER_SIZE < bytes) c++;
+    return c;
+}
+
+unsigned int Machine::heapTake(unsigned int bytes)
+{
+    unsigned int start = (heapPtr + 7) & ~7u;
+    unsigned int end = start + bytes;
+    if (start < heapPtr || end < start || end > regFile.get(REG_SP)) return 0;
+    heapPtr = end;
+    heap.arenaBytes += bytes;
+    return start;
+}
+
+void Machine::pushFreeBlock(unsigned int block, unsigned int size)
+{
+    unsigned int c = 0;
+    while (c < GuestHeap::CLASS_COUNT && CLASS_SIZES[c] != size) c++;
+    unsigned int& head = c < GuestHeap::CLASS_COUNT ? heap.freeLists[c] : heap.largeFree;
+    mem.storeWord(block, size);
+    mem.storeWord(block + 4, FREE_TAG);
+    mem.storeWord(block + HEADER_SIZE, head);
+    head = block;
+}
+
+unsigned int Machine::heapAllocate(unsigned int bytes)
+{
+    if (bytes == 0) bytes = 1; // still a distinct address
+    unsigned int c = classFor(bytes);
+    unsigned int block = 0;
+    unsigned int size;
+
+    if (c < GuestHeap::CLASS_COUNT)
+    {
+        size = CLASS_SIZES[c];
+        block = heap.freeLists[c];
+        if (block && mem.fetchWord(block + 4) != FREE_TAG)
+        {
+            // The program overwrote a free block; abandon the list rather than follow it
+            std::ostringstream message;
+            message << "heap free list corrupted at 0x" << std::hex << block;
+            warn(message.str());
+            heap.freeLists[c] = block = 0;
+        }
+        if (block)
+        {
+            heap.freeLists[c] = mem.fetchWord(block + HEADER_SIZE);
+        }
+        else
+        {
+            if (heap.spanEnd - heap.spanNext < size)
+            {
+                // What is left of the span goes to the free lists, largest classes first
+                while (heap.spanEnd - heap.spanNext >= CLASS_SIZES[0])
+                {
+                    unsigned int fit = GuestHeap::CLASS_COUNT - 1;
+                    while (CLASS_SIZES[fit] > heap.spanEnd - heap.spanNext) fit--;
+                    pushFreeBlock(heap.spanNext, CLASS_SIZES[fit]);
+                    heap.spanNext += CLASS_SIZES[fit];
+                }
+                unsigned int span = heapTake(GuestHeap::SPAN_SIZE);
+                if (!span) return 0;
+                heap.spanNext = span;
+                heap.spanEnd = span + GuestHeap::SPAN_SIZE;
+            }
+            block = heap.spanNext;
+            heap.spanNext += size;
+        }
+    }
+    else
+    {
+        if (bytes > 0xFFFFFFFFu - HEADER_SIZE - Memory::PAGE_MASK) return 0;
+        size = (bytes + HEADER_SIZE + Memory::PAGE_MASK) & ~Memory::PAGE_MASK;
+
+        // First fit among freed blocks at most twice the size needed
+        unsigned int previous = 0;
+        unsigned int candidate = heap.largeFree;
+        for (unsigned int searched = 0; candidate && searched < LARGE_SEARCH_LIMIT; searched++)
+        {
+            if (mem.fetchWord(candidate + 4) != FREE_TAG) break;
+            unsigned int candidateSize = mem.fetchWord(candidate);
+            unsigned int next = mem.fetchWord(candidate + HEADER_SIZE);
+            if (candidateSize >= size && candidateSize / 2 <= size)
+            {
+                if (previous) mem.storeWord(previous + HEADER_SIZE, next);
+                else heap.largeFree = next;
+                block = candidate;
+                size = candidateSize;
+                break;
+            }
+            previous = candidate;
+            candidate = next;
+        }
+        if (!block) block = heapTake(size);
+        if (!block) return 0;
+    }
+
+    mem.storeWord(block, size);
+    mem.storeWord(block + 4, LIVE_TAG);
+    heap.liveBytes += size - HEADER_SIZE;
+    heap.peakBytes = std::max(heap.peakBytes, heap.liveBytes);
+    return block + HEADER_SIZE;
+}
+
+unsigned int Machine::heapBlockSize(unsigned int addr, const char* operation)
+{
+    unsigned int block = addr - HEADER_SIZE;
+    unsigned int tag = (addr & 7) == 0 ? mem.fetchWord(block + 4) : 0;
+    if (tag == LIVE_TAG) return mem.fetchWord(block);
+
+    std::ostringstream message;
+    message << operation << " of 0x" << std::hex << addr
+            << (tag == FREE_TAG ? ", which is already free" : ", which malloc did not return");
+    warn(message.str());
+    return 0;
+}
+
+bool Machine::heapFree(unsigned int addr)
+{
+    unsigned int size = heapBlockSize(addr, "free");
+    if (size == 0) return false;
+    pushFreeBlock(addr - HEADER_SIZE, size);
+    heap.liveBytes -= size - HEADER_SIZE;
+    return true;
+}
+
+void Machine::executeHeapSyscall(unsigned int v0)
+{
+    const unsigned int a0 = regFile.get(REG_A0);
+    const unsigned int a1 = regFile.get(REG_A1);
+
+    switch (v0)
+    {
+        case 104:
+        {
+            heap.mallocs++;
+            regFile.set(REG_V0, heapAllocate(a0));
+            break;
+        }
+        case 105:
+        {
+            if (a0 != 0 && heapFree(a0)) heap.frees++;
+            break;
+        }
+        case 106:
+        {
+            heap.reallocs++;
+            unsigned int result = 0;
+            if (a0 == 0)
+            {
+                result = heapAllocate(a1);
+            }
+            else if (a1 == 0)
+            {
+                heapFree(a0);
+            }
+            else
+            {
+                // Shrinking keeps the block; growing moves it
+                unsigned int size = heapBlockSize(a0, "realloc");
+                if (size != 0 && a1 <= size - HEADER_SIZE)
+                {
+                    result = a0;
+                }
+                else if (size != 0)
+                {
+                    result = heapAllocate(a1);
+                    if (result)
+                    {
+                        mem.copyBlock(result, a0, size - HEADER_SIZE);
+                        heapFree(a0);
+                    }
+                }
+            }
+            regFile.set(REG_V0, result);
+            break;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+/*
+File: guest_heap.h
+Author: Brysen Landis
+*/
+
+#ifndef GUEST_HEAP_H
+#define GUEST_HEAP_H
+
+// Host side of the malloc, free and realloc syscalls (guest_heap.cpp).
+//
+// Blocks come in size classes, carved from spans the allocator takes from
+// the sbrk break. Every block has an 8-byte header in guest memory (its
+// usable size and a tag marking it live or free), and free blocks of each
+// class are linked through their first word. So this plain struct, a few
+// list heads and counters, is the allocator's whole state besides memory,
+// and snapshots and checkpoints copy it as it is.
+struct GuestHeap
+{
+    static const unsigned int CLASS_COUNT = 17;
+    static const unsigned int LARGEST_CLASS = 4096;     // block size with header
+    static const unsigned int SPAN_SIZE = 64 * 1024;
+
+    unsigned int freeLists[CLASS_COUNT];    // first free block of each class, 0 if none
+    unsigned int largeFree;                 // free blocks bigger than every class
+    unsigned int spanNext, spanEnd;         // unused part of the current span
+
+    unsigned long long liveBytes;           // usable bytes of blocks not yet freed
+    unsigned long long peakBytes;
+    unsigned long long arenaBytes;          // bytes taken from the break
+    unsigned long long mallocs, frees, reallocs;
+};
+
+#endif
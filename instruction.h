@@ -0,0 +1,67 @@
+/*
+File: instruction.h
+Author: Brysen Landis
+*/
+
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <map>
+#include <string>
+
+// Every mnemonic the interpreter understands, decoded once at load time
+enum Opcode : unsigned char
+{
+    // R-Type
+    OP_ADD, OP_ADDU, OP_SUB, OP_SUBU,
+    OP_AND, OP_OR, OP_XOR, OP_NOR,
+    OP_SLT, OP_SLTU,
+    OP_SLL, OP_SRL, OP_SRA, OP_SLLV, OP_SRLV, OP_SRAV,
+    OP_MULT, OP_MULTU, OP_DIV, OP_DIVU,
+    OP_MFHI, OP_MFLO, OP_MTHI, OP_MTLO,
+    OP_JR, OP_JALR,
+
+    // I-Type
+    OP_ADDI, OP_ADDIU, OP_ANDI, OP_ORI, OP_XORI, OP_SLTI, OP_SLTIU, OP_LUI,
+    OP_LW, OP_LH, OP_LHU, OP_LB, OP_LBU, OP_SW, OP_SH, OP_SB,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BLE, OP_BGT, OP_BGE,
+    OP_BLTZ, OP_BLEZ, OP_BGTZ, OP_BGEZ,
+
+    // J-Type
+    OP_J, OP_JAL,
+
+    // Special
+    OP_SYSCALL, OP_NOP,
+
+    // Pseudo-instructions
+    OP_LI, OP_LA, OP_MOVE, OP_CLEAR, OP_NOT,
+
+    // Could not be decoded; executes as a nop
+    OP_INVALID,
+
+    // A whole byte-copy loop, fused after loading (copy_loops.h)
+    OP_COPY_LOOP,
+
+    // A debugger breakpoint patched over an instruction (breakpoints.cpp)
+    OP_BREAKPOINT,
+
+    OP_COUNT
+};
+
+// Label name to address. The comparator is transparent so the assembler can
+// look labels up by string_view.
+typedef std::map<std::string, unsigned int, std::less<>> LabelTable;
+
+// A fully decoded instruction: register numbers are range-checked,
+// immediates are sign-extended and branch/jump targets are absolute
+struct DecodedInstruction
+{
+    Opcode op;
+    unsigned char rd;
+    unsigned char rs;
+    unsigned char rt;
+    int imm;
+    unsigned int target;
+};
+
+#endif
@@ -4,13 +4,16 @@ Author: Brysen Landis
 */
 
 #include "interpreter.h"
-#include <cctype>
+#include "encoding.h"
+#include <charconv>
 
 MIPSInterpreter::MIPSInterpreter() 
-    : PC(TEXT_BASE), HI(0), LO(0), currentDataAddr(DATA_BASE), 
-      inDataSection(false), halted(false)
+    : Machine(std::make_shared<Program>()), engine(ENGINE_SWITCH), messages(&std::cout),
+      fusionEnabled(true), blockCount(0), fusionSites(), fusionHits(),
+      jitEnabled(true), sampleRate(0), sampleDue(nullptr), nextBreakpoint(1), watchHit(0), watchAddress(0),
+      watchPC(0), watchOld(0)
 {
-    regFile.setReg("$sp", STACK_BASE);
+    reset();
 }
 
 void MIPSInterpreter::clearScreen()
@@ -35,977 +38,197 @@ void MIPSInterpreter::printBanner(const std::string& mode)
 }
 
 
-std::string MIPSInterpreter::cleanLine(const std::string& line)
+void MIPSInterpreter::executeInstruction(std::string_view instr)
 {
-    // Remove comments
-    size_t commentPos = line.find('#');
-    std::string cleaned = (commentPos != std::string::npos) ? line.substr(0, commentPos) : line;
-    
-    // Trim whitespace
-    size_t start = cleaned.find_first_not_of(" \t\r\n");
-    size_t end = cleaned.find_last_not_of(" \t\r\n");
-    
-    if (start == std::string::npos) return "";
-    return cleaned.substr(start, end - start + 1);
+    if (halted) return;
+    if (history) history->clear();
+    std::vector<std::string_view> tokens;
+    tokenize(instr, tokens);
+    Assembler line(prog->labels, PC);
+    execute(line.decodeInstruction(tokens, instr, PC));
+    flushOutput();
 }
 
-std::vector<std::string> MIPSInterpreter::tokenize(const std::string& line)
+bool MIPSInterpreter::loadFile(const std::string& filename)
 {
-    std::vector<std::string> tokens;
-    std::stringstream ss(line);
-    std::string token;
-    
-    while (ss >> token)
+    std::shared_ptr<const Program> program = Program::load(filename, loadSettings, *messages);
+    if (!program)
     {
-        // Remove commas
-        token.erase(std::remove(token.begin(), token.end(), ','), token.end());
-        
-        // Handle parentheses for memory operations: offset($reg)
-        size_t parenPos = token.find('(');
-        if (parenPos != std::string::npos)
-        {
-            std::string offset = token.substr(0, parenPos);
-            std::string reg = token.substr(parenPos + 1, token.find(')') - parenPos - 1);
-            if (!offset.empty()) tokens.push_back(offset);
-            tokens.push_back(reg);
-        }
-        else
-        {
-            tokens.push_back(token);
-        }
+        reset();
+        return false;
     }
-    return tokens;
+    loadProgram(std::move(program));
+    return true;
 }
 
-void MIPSInterpreter::parseFile(const std::string& filename)
+void MIPSInterpreter::run()
 {
-    std::ifstream file(filename);
-    if (!file.is_open())
+    if (!breakpoints.empty())
     {
-        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        *messages << continueRun() << "\n";
         return;
     }
     
-    std::string line;
-    unsigned int instructionCount = 0;
-    
-    while (std::getline(file, line))
+    if (!tracePath.empty())
     {
-        std::string cleaned = cleanLine(line);
-        if (cleaned.empty()) continue;
-        
-        // Check for section directives
-        if (cleaned == ".text")
-        {
-            inDataSection = false;
-            continue;
-        }
-        else if (cleaned == ".data")
-        {
-            inDataSection = true;
-            continue;
-        }
-        else if (cleaned.substr(0, 6) == ".globl" || cleaned.substr(0, 7) == ".global")
-        {
-            // Ignore global directive
-            continue;
-        }
-        
-        // Check for labels
-        size_t colonPos = cleaned.find(':');
-        if (colonPos != std::string::npos)
-        {
-            std::string label = cleaned.substr(0, colonPos);
-            if (inDataSection)
-            {
-                labels[label] = currentDataAddr;
-            }
-            else
-            {
-                labels[label] = TEXT_BASE + (instructionCount * 4);
-            }
-            
-            // Process rest of line after label
-            if (colonPos + 1 < cleaned.length())
-            {
-                cleaned = cleanLine(cleaned.substr(colonPos + 1));
-                if (cleaned.empty()) continue;
-            }
-            else
-            {
-                continue;
-            }
-        }
-        
-        if (inDataSection)
-        {
-            std::vector<std::string> tokens = tokenize(cleaned);
-            processDataDirective(tokens);
-        }
-        else
-        {
-            textSegment.push_back(cleaned);
-            addressToInstruction[TEXT_BASE + (instructionCount * 4)] = cleaned;
-            instructionCount++;
-        }
+        runTraced();
     }
-    
-    file.close();
-    PC = TEXT_BASE;
-    
-    std::cout << "Loaded " << instructionCount << " instructions from " << filename << std::endl;
-    std::cout << "Found " << labels.size() << " labels" << std::endl;
-}
-
-void MIPSInterpreter::processDataDirective(const std::vector<std::string>& tokens)
-{
-    if (tokens.empty()) return;
-    
-    if (tokens[0] == ".word")
+    else if (sampleRate > 0)
     {
-        for (size_t i = 1; i < tokens.size(); i++)
-        {
-            int value = parseImmediate(tokens[i]);
-            mem.storeWord(currentDataAddr, value);
-            currentDataAddr += 4;
-        }
+        runSampled();
     }
-    else if (tokens[0] == ".byte")
+    else if (!profilePath.empty())
     {
-        for (size_t i = 1; i < tokens.size(); i++)
-        {
-            int value = parseImmediate(tokens[i]);
-            mem.store(currentDataAddr, static_cast<unsigned char>(value));
-            currentDataAddr += 1;
-        }
+        runProfiled();
     }
-    else if (tokens[0] == ".asciiz" || tokens[0] == ".ascii")
+    else if (engine == ENGINE_THREADED)
     {
-        // Find the string between quotes
-        std::string fullLine;
-        for (size_t i = 1; i < tokens.size(); i++)
-        {
-            fullLine += tokens[i];
-            if (i < tokens.size() - 1) fullLine += " ";
-        }
-        
-        size_t start = fullLine.find('"');
-        size_t end = fullLine.rfind('"');
-        if (start != std::string::npos && end != std::string::npos && start < end)
-        {
-            std::string str = fullLine.substr(start + 1, end - start - 1);
-            
-            // Process escape sequences
-            for (size_t i = 0; i < str.length(); i++)
-            {
-                if (str[i] == '\\' && i + 1 < str.length())
-                {
-                    char nextChar = str[i + 1];
-                    if (nextChar == 'n')
-                    {
-                        mem.store(currentDataAddr++, '\n');
-                        i++;
-                    }
-                    else if (nextChar == 't')
-                    {
-                        mem.store(currentDataAddr++, '\t');
-                        i++;
-                    }
-                    else if (nextChar == '0')
-                    {
-                        mem.store(currentDataAddr++, '\0');
-                        i++;
-                    }
-                }
-                else
-                {
-                    mem.store(currentDataAddr++, str[i]);
-                }
-            }
-            
-            if (tokens[0] == ".asciiz")
-            {
-                mem.store(currentDataAddr++, '\0');
-            }
-        }
+        runThreaded();
     }
-    else if (tokens[0] == ".space")
+    else if (engine == ENGINE_JIT)
     {
-        if (tokens.size() > 1)
-        {
-            int space = parseImmediate(tokens[1]);
-            currentDataAddr += space;
-        }
+        runTiered();
     }
-}
-
-int MIPSInterpreter::parseImmediate(const std::string& str)
-{
-    if (str.empty()) return 0;
-    
-    // Check for label reference
-    if (labels.find(str) != labels.end())
+    else
     {
-        return static_cast<int>(labels[str]);
+        runSwitch();
     }
+    flushOutput();
     
-    // Handle hex
-    if (str.substr(0, 2) == "0x" || str.substr(0, 2) == "0X")
+    if (!halted)
     {
-        return static_cast<int>(std::stoul(str, nullptr, 16));
+        *messages << "Program complete.\n";
     }
-    
-    // Handle decimal (including negative)
-    return std::stoi(str);
 }
 
-int MIPSInterpreter::getRegisterNumber(const std::string& regName)
+void MIPSInterpreter::runCheckpointed(const std::string& checkpoint, unsigned long long interval)
 {
-    std::string clean = regName;
-    if (clean[0] == '$') clean = clean.substr(1);
-    
-    // Check if it's a number
-    if (std::isdigit(clean[0]))
+    bool saving = true;
+    while (saving && runFor(interval))
     {
-        return std::stoi(clean);
+        saving = saveCheckpoint(checkpoint);
     }
+    if (!saving) runSwitch();
     
-    // Use register file map
-    return regFile.getRegNumber(clean);
-}
-
-bool MIPSInterpreter::isLabel(const std::string& token)
-{
-    return labels.find(token) != labels.end();
-}
-
-unsigned int MIPSInterpreter::getLabelAddress(const std::string& label)
-{
-    if (labels.find(label) != labels.end())
+    if (!halted)
     {
-        return labels[label];
+        *messages << "Program complete.\n";
     }
-    std::cerr << "Error: Label " << label << " not found" << std::endl;
-    return PC;
 }
 
-void MIPSInterpreter::executeInstruction(const std::string& instr)
+bool MIPSInterpreter::resume(const std::string& checkpoint)
 {
-    if (halted) return;
-    
-    std::vector<std::string> tokens = tokenize(instr);
-    if (tokens.empty()) return;
-    
-    std::string opcode = tokens[0];
-    
-    // R-Type instructions
-    if (opcode == "add" || opcode == "addu" || opcode == "sub" || opcode == "subu" ||
-        opcode == "and" || opcode == "or" || opcode == "xor" || opcode == "nor" ||
-        opcode == "slt" || opcode == "sltu" || opcode == "sll" || opcode == "srl" ||
-        opcode == "sra" || opcode == "sllv" || opcode == "srlv" || opcode == "srav" ||
-        opcode == "mult" || opcode == "multu" || opcode == "div" || opcode == "divu" ||
-        opcode == "mfhi" || opcode == "mflo" || opcode == "mthi" || opcode == "mtlo" ||
-        opcode == "jr" || opcode == "jalr")
-    {
-        executeRType(tokens);
-    }
-    // I-Type instructions
-    else if (opcode == "addi" || opcode == "addiu" || opcode == "andi" || opcode == "ori" ||
-             opcode == "xori" || opcode == "slti" || opcode == "sltiu" ||
-             opcode == "lw" || opcode == "lh" || opcode == "lhu" || opcode == "lb" ||
-             opcode == "lbu" || opcode == "sw" || opcode == "sh" || opcode == "sb" ||
-             opcode == "beq" || opcode == "bne" || opcode == "blt" || opcode == "ble" ||
-             opcode == "bgt" || opcode == "bge" || opcode == "bltz" || opcode == "blez" ||
-             opcode == "bgtz" || opcode == "bgez" || opcode == "lui")
-    {
-        executeIType(tokens);
-    }
-    // J-Type instructions
-    else if (opcode == "j" || opcode == "jal")
-    {
-        executeJType(tokens);
-    }
-    // Special instructions
-    else if (opcode == "syscall")
-    {
-        executeSyscall();
-        PC += 4;
-    }
-    else if (opcode == "nop")
-    {
-        PC += 4;
-    }
-    // Pseudo-instructions
-    else if (opcode == "li" || opcode == "la" || opcode == "move" || 
-             opcode == "clear" || opcode == "not")
-    {
-        executePseudoInstruction(tokens);
-    }
-    else
-    {
-        std::cerr << "Warning: Unsupported instruction: " << opcode << std::endl;
-        PC += 4;
-    }
+    std::string program;
+    if (!checkpointProgram(checkpoint, program) || !loadFile(program)) return false;
+    if (!resumeCheckpoint(checkpoint)) return false;
+    if (history) history->clear();
+    *messages << "Resumed at PC 0x" << std::hex << PC << std::dec << " after " << executedCount
+              << " instructions" << std::endl;
+    return true;
 }
 
-void MIPSInterpreter::executeRType(const std::vector<std::string>& tokens)
+void MIPSInterpreter::step()
 {
-    std::string opcode = tokens[0];
-    
-    if (opcode == "add" || opcode == "addu")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs) + regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "sub" || opcode == "subu")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs) - regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "and")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs) & regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "or")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs) | regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "xor")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs) ^ regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "nor")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, ~(regFile.getRegByNum(rs) | regFile.getRegByNum(rt)));
-        PC += 4;
-    }
-    else if (opcode == "slt")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        int val1 = static_cast<int>(regFile.getRegByNum(rs));
-        int val2 = static_cast<int>(regFile.getRegByNum(rt));
-        regFile.setRegByNum(rd, (val1 < val2) ? 1 : 0);
-        PC += 4;
-    }
-    else if (opcode == "sltu")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int rt = getRegisterNumber(tokens[3]);
-        regFile.setRegByNum(rd, (regFile.getRegByNum(rs) < regFile.getRegByNum(rt)) ? 1 : 0);
-        PC += 4;
-    }
-    else if (opcode == "sll")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        int shamt = parseImmediate(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rt) << shamt);
-        PC += 4;
-    }
-    else if (opcode == "srl")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        int shamt = parseImmediate(tokens[3]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rt) >> shamt);
-        PC += 4;
-    }
-    else if (opcode == "sra")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        int shamt = parseImmediate(tokens[3]);
-        int val = static_cast<int>(regFile.getRegByNum(rt));
-        regFile.setRegByNum(rd, static_cast<unsigned int>(val >> shamt));
-        PC += 4;
-    }
-    else if (opcode == "mult")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        long long result = static_cast<long long>(static_cast<int>(regFile.getRegByNum(rs))) * 
-                          static_cast<long long>(static_cast<int>(regFile.getRegByNum(rt)));
-        LO = static_cast<unsigned int>(result & 0xFFFFFFFF);
-        HI = static_cast<unsigned int>((result >> 32) & 0xFFFFFFFF);
-        PC += 4;
-    }
-    else if (opcode == "multu")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        unsigned long long result = static_cast<unsigned long long>(regFile.getRegByNum(rs)) * 
-                                   static_cast<unsigned long long>(regFile.getRegByNum(rt));
-        LO = static_cast<unsigned int>(result & 0xFFFFFFFF);
-        HI = static_cast<unsigned int>((result >> 32) & 0xFFFFFFFF);
-        PC += 4;
-    }
-    else if (opcode == "div")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        int dividend = static_cast<int>(regFile.getRegByNum(rs));
-        int divisor = static_cast<int>(regFile.getRegByNum(rt));
-        if (divisor != 0)
-        {
-            LO = static_cast<unsigned int>(dividend / divisor);
-            HI = static_cast<unsigned int>(dividend % divisor);
-        }
-        PC += 4;
-    }
-    else if (opcode == "divu")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        unsigned int dividend = regFile.getRegByNum(rs);
-        unsigned int divisor = regFile.getRegByNum(rt);
-        if (divisor != 0)
-        {
-            LO = dividend / divisor;
-            HI = dividend % divisor;
-        }
-        PC += 4;
-    }
-    else if (opcode == "mfhi")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        regFile.setRegByNum(rd, HI);
-        PC += 4;
-    }
-    else if (opcode == "mflo")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        regFile.setRegByNum(rd, LO);
-        PC += 4;
-    }
-    else if (opcode == "mthi")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        HI = regFile.getRegByNum(rs);
-        PC += 4;
-    }
-    else if (opcode == "mtlo")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        LO = regFile.getRegByNum(rs);
-        PC += 4;
-    }
-    else if (opcode == "jr")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        PC = regFile.getRegByNum(rs);
-    }
-    else if (opcode == "jalr")
+    if (halted)
     {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        regFile.setRegByNum(rd, PC + 4);
-        PC = regFile.getRegByNum(rs);
+        std::cout << "Program halted.\n";
+        return;
     }
-}
-
-void MIPSInterpreter::executeIType(const std::vector<std::string>& tokens)
-{
-    std::string opcode = tokens[0];
     
-    if (opcode == "addi" || opcode == "addiu")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int imm = parseImmediate(tokens[3]);
-        regFile.setRegByNum(rt, regFile.getRegByNum(rs) + imm);
-        PC += 4;
-    }
-    else if (opcode == "andi")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        unsigned int imm = static_cast<unsigned int>(parseImmediate(tokens[3])) & 0xFFFF;
-        regFile.setRegByNum(rt, regFile.getRegByNum(rs) & imm);
-        PC += 4;
-    }
-    else if (opcode == "ori")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        unsigned int imm = static_cast<unsigned int>(parseImmediate(tokens[3])) & 0xFFFF;
-        regFile.setRegByNum(rt, regFile.getRegByNum(rs) | imm);
-        PC += 4;
-    }
-    else if (opcode == "xori")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        unsigned int imm = static_cast<unsigned int>(parseImmediate(tokens[3])) & 0xFFFF;
-        regFile.setRegByNum(rt, regFile.getRegByNum(rs) ^ imm);
-        PC += 4;
-    }
-    else if (opcode == "slti")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        int imm = parseImmediate(tokens[3]);
-        int val = static_cast<int>(regFile.getRegByNum(rs));
-        regFile.setRegByNum(rt, (val < imm) ? 1 : 0);
-        PC += 4;
-    }
-    else if (opcode == "sltiu")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        unsigned int imm = static_cast<unsigned int>(parseImmediate(tokens[3]));
-        regFile.setRegByNum(rt, (regFile.getRegByNum(rs) < imm) ? 1 : 0);
-        PC += 4;
-    }
-    else if (opcode == "lui")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        unsigned int imm = static_cast<unsigned int>(parseImmediate(tokens[2])) & 0xFFFF;
-        regFile.setRegByNum(rt, imm << 16);
-        PC += 4;
-    }
-    else if (opcode == "lw")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        regFile.setRegByNum(rt, mem.fetchWord(addr));
-        PC += 4;
-    }
-    else if (opcode == "lh")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        short value = static_cast<short>(mem.fetchHalfword(addr));
-        regFile.setRegByNum(rt, static_cast<unsigned int>(static_cast<int>(value)));
-        PC += 4;
-    }
-    else if (opcode == "lhu")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        regFile.setRegByNum(rt, mem.fetchHalfword(addr));
-        PC += 4;
-    }
-    else if (opcode == "lb")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        char value = static_cast<char>(mem.fetch(addr));
-        regFile.setRegByNum(rt, static_cast<unsigned int>(static_cast<int>(value)));
-        PC += 4;
-    }
-    else if (opcode == "lbu")
+    unsigned int index = (PC - TEXT_BASE) >> 2;
+    if ((PC & 3) == 0 && index < prog->code.size())
     {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        regFile.setRegByNum(rt, mem.fetch(addr));
-        PC += 4;
-    }
-    else if (opcode == "sw")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        mem.storeWord(addr, regFile.getRegByNum(rt));
-        PC += 4;
-    }
-    else if (opcode == "sh")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        mem.storeHalfword(addr, static_cast<unsigned short>(regFile.getRegByNum(rt)));
-        PC += 4;
-    }
-    else if (opcode == "sb")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int offset = parseImmediate(tokens[2]);
-        int base = getRegisterNumber(tokens[3]);
-        unsigned int addr = regFile.getRegByNum(base) + offset;
-        mem.store(addr, static_cast<unsigned char>(regFile.getRegByNum(rt)));
-        PC += 4;
-    }
-    else if (opcode == "beq")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        if (regFile.getRegByNum(rs) == regFile.getRegByNum(rt))
-        {
-            if (isLabel(tokens[3]))
-            {
-                PC = getLabelAddress(tokens[3]);
-            }
-            else
-            {
-                int offset = parseImmediate(tokens[3]);
-                PC = PC + 4 + (offset << 2);
-            }
-        }
-        else
-        {
-            PC += 4;
-        }
-    }
-    else if (opcode == "bne")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = getRegisterNumber(tokens[2]);
-        if (regFile.getRegByNum(rs) != regFile.getRegByNum(rt))
-        {
-            if (isLabel(tokens[3]))
-            {
-                PC = getLabelAddress(tokens[3]);
-            }
-            else
-            {
-                int offset = parseImmediate(tokens[3]);
-                PC = PC + 4 + (offset << 2);
-            }
-        }
-        else
-        {
-            PC += 4;
-        }
-    }
-    else if (opcode == "blt" || opcode == "bltz")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int rt = 0;
-        std::string label = tokens[2];
-        
-        if (opcode == "blt")
-        {
-            rt = getRegisterNumber(tokens[2]);
-            label = tokens[3];
-        }
-        
-        int val1 = static_cast<int>(regFile.getRegByNum(rs));
-        int val2 = static_cast<int>(regFile.getRegByNum(rt));
-        
-        if (val1 < val2)
-        {
-            PC = isLabel(label) ? getLabelAddress(label) : PC + 4 + (parseImmediate(label) << 2);
-        }
-        else
-        {
-            PC += 4;
-        }
-    }
-    else if (opcode == "blez")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int val = static_cast<int>(regFile.getRegByNum(rs));
-        
-        if (val <= 0)
-        {
-            if (isLabel(tokens[2]))
-            {
-                PC = getLabelAddress(tokens[2]);
-            }
-            else
-            {
-                int offset = parseImmediate(tokens[2]);
-                PC = PC + 4 + (offset << 2);
-            }
-        }
-        else
-        {
-            PC += 4;
-        }
-    }
-    else if (opcode == "bgtz")
-    {
-        int rs = getRegisterNumber(tokens[1]);
-        int val = static_cast<int>(regFile.getRegByNum(rs));
-        
-        if (val > 0)
+        std::cout << "[0x" << std::hex << std::setw(8) << std::setfill('0') << PC << "] " 
+                  << std::dec << prog->listing[index] << "\n";
+        if (history)
         {
-            if (isLabel(tokens[2]))
-            {
-                PC = getLabelAddress(tokens[2]);
-            }
-            else
-            {
-                int offset = parseImmediate(tokens[2]);
-                PC = PC + 4 + (offset << 2);
-            }
+            runRecorded(*history, 1);
         }
         else
         {
-            PC += 4;
+            Machine::step();
         }
     }
-    else if (opcode == "bgez")
+    else
     {
-        int rs = getRegisterNumber(tokens[1]);
-        int val = static_cast<int>(regFile.getRegByNum(rs));
-        
-        if (val >= 0)
-        {
-            if (isLabel(tokens[2]))
-            {
-                PC = getLabelAddress(tokens[2]);
-            }
-            else
-            {
-                int offset = parseImmediate(tokens[2]);
-                PC = PC + 4 + (offset << 2);
-            }
-        }
-        else
-        {
-            PC += 4;
-        }
+        std::cout << "No instruction at PC: 0x" << std::hex << PC << "\n";
+        halted = true;
     }
 }
 
-void MIPSInterpreter::executeJType(const std::vector<std::string>& tokens)
+void MIPSInterpreter::setHistory(bool enabled)
 {
-    std::string opcode = tokens[0];
-    
-    if (opcode == "j")
+    if (!enabled)
     {
-        if (isLabel(tokens[1]))
-        {
-            PC = getLabelAddress(tokens[1]);
-        }
-        else
-        {
-            unsigned int addr = parseImmediate(tokens[1]);
-            PC = (PC & 0xF0000000) | ((addr & 0x03FFFFFF) << 2);
-        }
+        history.reset();
     }
-    else if (opcode == "jal")
+    else if (!history)
     {
-        regFile.setReg("$ra", PC + 4);
-        if (isLabel(tokens[1]))
-        {
-            PC = getLabelAddress(tokens[1]);
-        }
-        else
-        {
-            unsigned int addr = parseImmediate(tokens[1]);
-            PC = (PC & 0xF0000000) | ((addr & 0x03FFFFFF) << 2);
-        }
+        history = std::make_unique<UndoLog>();
     }
 }
 
-void MIPSInterpreter::executePseudoInstruction(const std::vector<std::string>& tokens)
+unsigned long long MIPSInterpreter::stepBack(unsigned long long count)
 {
-    std::string opcode = tokens[0];
-    
-    if (opcode == "li")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        int imm = parseImmediate(tokens[2]);
-        
-        // Check if immediate fits in 16 bits
-        if (imm >= -32768 && imm <= 32767)
-        {
-            regFile.setRegByNum(rt, static_cast<unsigned int>(imm));
-        }
-        else
-        {
-            // Use lui and ori for larger values
-            unsigned int upper = (imm >> 16) & 0xFFFF;
-            unsigned int lower = imm & 0xFFFF;
-            regFile.setRegByNum(rt, (upper << 16) | lower);
-        }
-        PC += 4;
-    }
-    else if (opcode == "la")
-    {
-        int rt = getRegisterNumber(tokens[1]);
-        unsigned int addr;
-        
-        if (isLabel(tokens[2]))
-        {
-            addr = getLabelAddress(tokens[2]);
-        }
-        else
-        {
-            addr = parseImmediate(tokens[2]);
-        }
-        
-        regFile.setRegByNum(rt, addr);
-        PC += 4;
-    }
-    else if (opcode == "move")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        regFile.setRegByNum(rd, regFile.getRegByNum(rs));
-        PC += 4;
-    }
-    else if (opcode == "clear")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        regFile.setRegByNum(rd, 0);
-        PC += 4;
-    }
-    else if (opcode == "not")
-    {
-        int rd = getRegisterNumber(tokens[1]);
-        int rs = getRegisterNumber(tokens[2]);
-        regFile.setRegByNum(rd, ~regFile.getRegByNum(rs));
-        PC += 4;
-    }
+    return history ? Machine::stepBack(*history, count) : 0;
 }
 
-void MIPSInterpreter::executeSyscall()
+bool MIPSInterpreter::reverseContinue(std::string_view target)
 {
-    unsigned int v0 = regFile.getReg("$v0");
+    if (!history) return false;
+    unsigned int reg;
+    if (parseRegister(target, reg)) return reverseToRegisterWrite(*history, reg);
     
-    switch (v0)
-    {
-        case 1: // print integer
-        {
-            int value = static_cast<int>(regFile.getReg("$a0"));
-            std::cout << value;
-            break;
-        }
-        case 4: // print string
-        {
-            unsigned int addr = regFile.getReg("$a0");
-            while (true)
-            {
-                unsigned char ch = mem.fetch(addr);
-                if (ch == 0) break;
-                std::cout << ch;
-                addr++;
-            }
-            break;
-        }
-        case 5: // read integer
-        {
-            int value;
-            std::cin >> value;
-            regFile.setReg("$v0", static_cast<unsigned int>(value));
-            break;
-        }
-        case 8: // read string
-        {
-            unsigned int addr = regFile.getReg("$a0");
-            int maxLen = static_cast<int>(regFile.getReg("$a1"));
-            std::string input;
-            std::getline(std::cin, input);
-            
-            for (int i = 0; i < maxLen - 1 && i < static_cast<int>(input.length()); i++)
-            {
-                mem.store(addr + i, input[i]);
-            }
-            mem.store(addr + std::min(maxLen - 1, static_cast<int>(input.length())), '\0');
-            break;
-        }
-        case 9: // sbrk (allocate heap memory)
-        {
-            unsigned int bytes = regFile.getReg("$a0");
-            static unsigned int heapPtr = DATA_BASE + 0x10000;
-            regFile.setReg("$v0", heapPtr);
-            heapPtr += bytes;
-            break;
-        }
-        case 10:
-        {
-            halted = true;
-            break;
-        }
-        case 11: // print character
-        {
-            char ch = static_cast<char>(regFile.getReg("$a0"));
-            std::cout << ch;
-            break;
-        }
-        case 12: // read character
-        {
-            char ch;
-            std::cin >> ch;
-            regFile.setReg("$v0", static_cast<unsigned int>(ch));
-            break;
-        }
-        default:
-        {
-            std::cerr << "Warning: Unsupported syscall: " << v0 << std::endl;
-            break;
-        }
-    }
+    unsigned int addr, length;
+    return parseRange(target, addr, length) && reverseToMemoryWrite(*history, addr, length);
 }
 
-void MIPSInterpreter::loadFile(const std::string& filename)
+bool MIPSInterpreter::parseAddress(std::string_view text, unsigned int& addr)
 {
-    reset();
-    parseFile(filename);
-}
-
-void MIPSInterpreter::run()
-{
-    while (!halted && PC >= TEXT_BASE && 
-           addressToInstruction.find(PC) != addressToInstruction.end())
+    auto label = prog->labels.find(text);
+    if (label != prog->labels.end())
     {
-        executeInstruction(addressToInstruction[PC]);
+        addr = label->second;
+        return true;
     }
-    
-    if (!halted)
+    int base = 10;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
     {
-        std::cout << "Program complete.\n";
+        text.remove_prefix(2);
+        base = 16;
     }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), addr, base);
+    return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
 }
 
-void MIPSInterpreter::step()
+bool MIPSInterpreter::parseRange(std::string_view text, unsigned int& addr, unsigned int& length)
 {
-    if (halted)
-    {
-        std::cout << "Program halted.\n";
-        return;
-    }
-    
-    if (addressToInstruction.find(PC) != addressToInstruction.end())
+    size_t comma = text.find(',');
+    length = 4;
+    if (!parseAddress(text.substr(0, comma), addr)) return false;
+    return comma == std::string_view::npos || (parseAddress(text.substr(comma + 1), length) && length > 0);
+}
+
+bool MIPSInterpreter::parseRegister(std::string_view text, unsigned int& reg)
+{
+    if (text == "$hi" || text == "hi" || text == "$lo" || text == "lo")
     {
-        std::cout << "[0x" << std::hex << std::setw(8) << std::setfill('0') << PC << "] " 
-                  << std::dec << addressToInstruction[PC] << "\n";
-        executeInstruction(addressToInstruction[PC]);
+        reg = text.back() == 'i' ? 32 : 33;
+        return true;
     }
-    else
+    if (text.size() < 2 || text[0] != '$') return false;
+    for (unsigned int i = 0; i < 32; i++)
     {
-        std::cout << "No instruction at PC: 0x" << std::hex << PC << "\n";
-        halted = true;
+        if (text == registerName(i))
+        {
+            reg = i;
+            return true;
+        }
     }
+    
+    // $0 to $31; names it does not know are not registers, rather than $zero
+    auto result = std::from_chars(text.data() + 1, text.data() + text.size(), reg);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size() && reg < 32;
 }
 
 void MIPSInterpreter::displayState()
@@ -1016,37 +239,77 @@ void MIPSInterpreter::displayState()
               << " | LO: " << std::setw(4) << LO << "\n";
 }
 
+void MIPSInterpreter::displayHeapStats()
+{
+    if (heap.mallocs == 0 && heap.reallocs == 0) return;
+    
+    // Arena bytes not holding live blocks: headers, rounding, free blocks
+    // and unused span
+    double unused = heap.arenaBytes ? 100.0 * (heap.arenaBytes - heap.liveBytes) / heap.arenaBytes : 0.0;
+    std::cout << "\n=== Heap ===\n" << std::dec
+              << "malloc " << heap.mallocs << ", free " << heap.frees << ", realloc " << heap.reallocs << "\n"
+              << "live " << heap.liveBytes << " bytes, peak " << heap.peakBytes << " bytes\n"
+              << "arena " << heap.arenaBytes << " bytes, " << std::fixed << std::setprecision(1) << unused
+              << "% unused\n" << std::defaultfloat;
+}
+
+void MIPSInterpreter::copySettings(const MIPSInterpreter& other)
+{
+    engine = other.engine;
+    fusionEnabled = other.fusionEnabled;
+    jitEnabled = other.jitEnabled;
+    loadSettings = other.loadSettings;
+    fileRoot = other.fileRoot;
+}
+
 void MIPSInterpreter::reset()
 {
-    PC = TEXT_BASE;
-    HI = 0;
-    LO = 0;
-    currentDataAddr = DATA_BASE;
-    halted = false;
-    textSegment.clear();
-    labels.clear();
-    addressToInstruction.clear();
-    regFile = RegisterFile();
-    mem = Memory();
-    regFile.setReg("$sp", STACK_BASE);
+    // A fresh Program, so machines sharing the previous one are unaffected
+    auto empty = std::make_shared<Program>();
+    empty->entry = TEXT_BASE;
+    empty->dataEnd = DATA_BASE;
+    prog = empty;
+    blockCount = 0;
+    std::fill(fusionSites, fusionSites + FUSE_COUNT, 0);
+    std::fill(fusionHits, fusionHits + FUSE_COUNT, 0);
+    jitBlocks.clear();
+    jitHotness.clear();
+    jitBlockEnd.clear();
+    if (jit) jit->clear();
+    if (history) history->clear();
+    breakpoints.clear();
+    nextBreakpoint = 1;
+    patchedCode.clear();
+    patchedSlots.clear();
+    callSites.clear();
+    mem.clearWatches();
+    restart();
+}
+
+void MIPSInterpreter::loadProgram(std::shared_ptr<const Program> program)
+{
+    reset();
+    prog = std::move(program);
+    restart();
 }
 
 void MIPSInterpreter::runInteractive()
 {
-    std::string input;
+    std::string input, reply;
     clearScreen();
     printBanner("INTERACTIVE MODE");
-    std::cout << "Commands: load <file>, run, step, regs, manual, reset, quit\n\n";
+    std::cout << "Commands: load <file>, run, step [n], continue, until, finish, regs, break, watch, delete, breaks, manual, reset, quit\n\n";
     
     while (true)
     {
         std::cout << "> ";
         if (!std::getline(std::cin, input)) break;
         
-        std::string cleaned = cleanLine(input);
+        std::string_view cleaned = cleanLine(input);
         if (cleaned.empty()) continue;
         
-        std::vector<std::string> tokens = tokenize(cleaned);
+        std::vector<std::string_view> tokens;
+        tokenize(cleaned, tokens);
         
         if (tokens[0] == "quit" || tokens[0] == "exit" || tokens[0] == "q")
         {
@@ -1054,13 +317,13 @@ void MIPSInterpreter::runInteractive()
         }
         else if (tokens[0] == "load" && tokens.size() > 1)
         {
-            loadFile(tokens[1]);
+            loadFile(std::string(tokens[1]));
         }
         else if (tokens[0] == "run")
         {
             run();
         }
-        else if (tokens[0] == "step")
+        else if (tokens[0] == "step" && tokens.size() == 1)
         {
             step();
         }
@@ -1069,21 +332,25 @@ void MIPSInterpreter::runInteractive()
             clearScreen();
             printBanner("INTERACTIVE MODE");
             displayState();
-            std::cout << "\nCommands: load <file>, run, step, regs, manual, reset, quit\n\n";
+            std::cout << "\nCommands: load <file>, run, step [n], continue, until, finish, regs, break, watch, delete, breaks, manual, reset, quit\n\n";
         }
         else if (tokens[0] == "reset")
         {
             reset();
             clearScreen();
             printBanner("INTERACTIVE MODE");
-            std::cout << "Reset.\n\nCommands: load <file>, run, step, regs, manual, reset, quit\n\n";
+            std::cout << "Reset.\n\nCommands: load <file>, run, step [n], continue, until, finish, regs, break, watch, delete, breaks, manual, reset, quit\n\n";
         }
         else if (tokens[0] == "manual" || tokens[0] == "m")
         {
             runManualMode();
             clearScreen();
             printBanner("INTERACTIVE MODE");
-            std::cout << "Commands: load <file>, run, step, regs, manual, reset, quit\n\n";
+            std::cout << "Commands: load <file>, run, step [n], continue, until, finish, regs, break, watch, delete, breaks, manual, reset, quit\n\n";
+        }
+        else if (runCommand(cleaned, reply) || breakpointCommand(cleaned, reply))
+        {
+            std::cout << reply << "\n";
         }
         else
         {
@@ -1105,7 +372,7 @@ void MIPSInterpreter::runManualMode()
         std::cout << "PC:0x" << std::hex << std::setw(8) << std::setfill('0') << PC << "> " << std::dec;
         if (!std::getline(std::cin, input)) break;
         
-        std::string cleaned = cleanLine(input);
+        std::string_view cleaned = cleanLine(input);
         if (cleaned.empty()) continue;
         
         if (cleaned == "back" || cleaned == "exit" || cleaned == "quit")
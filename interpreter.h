@@ -9,68 +9,262 @@ Author: Brysen Landis
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <iomanip>
-#include "register_file.h"
-#include "memory.h"
+#include "machine.h"
+#include "assembler.h"
+#include "instruction.h"
+#include "superinstructions.h"
+#include "jit.h"
+#include "undo_log.h"
+#include <memory>
 
-class MIPSInterpreter
+// The command-line front end: loads programs with Program::load() and runs
+// them on the engine chosen, adding the interactive and step modes
+class MIPSInterpreter : public Machine
 {
 public:
+    enum Engine
+    {
+        ENGINE_SWITCH,   // switch over the decoded instruction
+        ENGINE_THREADED, // direct-threaded dispatch (threaded_engine.cpp)
+        ENGINE_JIT       // interpreter plus native code for hot blocks (tiered_engine.cpp)
+    };
+    
     MIPSInterpreter();
     
+    void setEngine(Engine e) { engine = e; }
+    Engine getEngine() const { return engine; }
+    void setFusion(bool enabled) { fusionEnabled = enabled; }
+    void displayFusionStats();
+    void setJit(bool enabled) { jitEnabled = enabled; }
+    size_t jitCompiledBlocks() const;
+    
+    // Makes run() count every instruction on the switch engine, writing a
+    // report to path and folded call stacks to path.folded (profiler.cpp).
+    // An empty path turns profiling off.
+    void setProfile(const std::string& path) { profilePath = path; }
+    
+    // Makes run() sample the running program rate times a second instead,
+    // writing the same two files (profile.txt unless set above). 0 stops
+    // sampling.
+    void setSampleRate(unsigned int rate) { sampleRate = rate; }
+    
+    // Makes run() record every instruction executed, with the register and
+    // memory it changed, to a binary trace at path on the switch engine
+    // (trace.cpp). Takes precedence over profiling; empty turns it off.
+    void setTrace(const std::string& path) { tracePath = path; }
+    
+    // Replace byte-copy loops in programs loaded from now on with one block
+    // copy each (copy_loops.h)
+    void setCopyLoops(bool enabled) { loadSettings.copyLoops = enabled; }
+    
+    // Compares registers, PC, HI and LO against another run; prints mismatches
+    bool compareState(const MIPSInterpreter& reference);
+    
+    // Translates the loaded program to a standalone C++ file (cpp_emitter.cpp)
+    bool emitCpp(const std::string& filename);
+    
+    // Writes the assembled program as a big-endian ELF32 executable, or as a
+    // raw text image if the name ends in .bin (binary_image.cpp)
+    bool saveBinary(const std::string& filename);
+    
+    // Caches assembled source programs in dir, keyed by a hash of the source
+    // (program_cache.cpp). An empty dir disables the cache.
+    void setCacheDir(const std::string& dir) { loadSettings.cacheDir = dir; }
+    
+    // Threads used to assemble large source files; 0 uses every hardware thread
+    void setAssemblerThreads(unsigned int threads) { loadSettings.assemblerThreads = threads; }
+    
+    // How loadFile() loads, for loading a Program to share without a machine
+    const LoadSettings& getLoadSettings() const { return loadSettings; }
+    
+    size_t sourceLinesRead() const { return prog->sourceLines; }
+    
+    // Stream for status messages such as "Loaded N instructions"
+    void setMessages(std::ostream& out) { messages = &out; }
+    
+    // Takes engine, fusion, JIT, copy loop, cache, assembler and file root
+    // settings from other
+    void copySettings(const MIPSInterpreter& other);
+    
+    // The loaded program, for other machines to share, and loading one
+    // shared that way instead of reading a file
+    std::shared_ptr<const Program> sharedProgram() const { return prog; }
+    void loadProgram(std::shared_ptr<const Program> program);
+    
     // Main execution modes
     void runInteractive();
     void runManualMode();
-    void loadFile(const std::string& filename);
+    bool loadFile(const std::string& filename);
     void run();  // Run all instructions
+    
+    // Runs on the switch engine, saving a checkpoint every interval
+    // instructions, and loads a program at a checkpoint saved that way
+    void runCheckpointed(const std::string& checkpoint, unsigned long long interval);
+    bool resume(const std::string& checkpoint);
     void step(); // Execute one instruction
+    
+    // Step history (undo_log.h): while enabled, step() logs what each
+    // instruction overwrites. stepBack() undoes up to count instructions and
+    // returns how many it undid. reverseContinue() goes back to just before
+    // the last write to target, a register ($t0, $hi, $lo) or an address or
+    // label with an optional ",length"; false if target is malformed or no
+    // write is in the history. Restarting, loading or running the program
+    // another way drops the history.
+    void setHistory(bool enabled);
+    unsigned long long stepBack(unsigned long long count);
+    bool reverseContinue(std::string_view target);
+    unsigned long long historyDepth() const { return history ? history->depth() : 0; }
+    
+    // Breakpoints and watchpoints (breakpoints.cpp), set by commands shared
+    // by the interactive and step modes:
+    //
+    //     break <label|addr> [if <cond>]   stop before that instruction
+    //     break if <cond>                  stop where cond becomes true
+    //     watch <label|addr>[,len]         stop after a write to those bytes
+    //     delete [n]                       remove one, or all
+    //     breaks                           list them
+    //
+    // where cond is a register, one of == != < <= > >= and a register or
+    // number, compared signed. Breakpoints at an address are patched into a
+    // copy of the program, and only writes to a watched page are checked, so
+    // without a "break if" nothing is tested per instruction. Returns false
+    // if line is not one of these commands, else sets reply to the result.
+    bool breakpointCommand(std::string_view line, std::string& reply);
+    
+    // Runs on the switch engine from PC until the program ends or something
+    // above stops it, first stepping over any breakpoint at PC, and returns
+    // why it stopped. Recorded for stepping back while history is on.
+    std::string continueRun();
+    bool hasBreakpoints() const { return !breakpoints.empty(); }
+    
+    // Run commands shared by the interactive and step modes, each running
+    // like continueRun() with nothing redrawn until it stops:
+    //
+    //     continue                 to the next stop
+    //     step N                   at most N instructions
+    //     until <label|addr>       until PC gets there
+    //     finish                   until the current function returns
+    //
+    // until and finish stop at temporary breakpoints, patched at the
+    // address, or at every call and return so finish can count them. Runs
+    // lasting over a second print a status line each second. Returns false
+    // if line is not one of these commands, else sets reply to why the run
+    // stopped.
+    bool runCommand(std::string_view line, std::string& reply);
+    
     void displayState();
+    void displayHeapStats(); // if the program called malloc
     void reset();
     
 private:
-    RegisterFile regFile;
-    Memory mem;
+    LoadSettings loadSettings;
+    Engine engine;
+    std::ostream* messages;
+    
+    // Superinstruction fusion in the threaded engine
+    bool fusionEnabled;
+    size_t blockCount;
+    unsigned int fusionSites[FUSE_COUNT];
+    unsigned long long fusionHits[FUSE_COUNT];
+    
+    // Tiered JIT state, indexed like program
+    static const unsigned int JIT_THRESHOLD = 50;
+    bool jitEnabled;
+    std::unique_ptr<JitCompiler> jit;
+    std::vector<JitBlock> jitBlocks;
+    std::vector<unsigned int> jitHotness;
+    std::vector<unsigned int> jitBlockEnd;
+    
+    std::string profilePath;
+    unsigned int sampleRate;
+    void runProfiled();
+    void runSampled();
+    
+    // Set by runSampled() around the engine it runs, which tests sampleDue
+    // between basic blocks and calls takeSample() with PC at the next one
+    const std::atomic<bool>* sampleDue;
+    std::function<void()> takeSample;
+    
+    std::string tracePath;
+    void runTraced();
     
-    unsigned int PC;
-    unsigned int HI, LO;
+    std::unique_ptr<UndoLog> history;
     
-    std::vector<std::string> textSegment;
-    std::map<std::string, unsigned int> labels;
-    std::map<unsigned int, std::string> addressToInstruction;
+    struct Condition
+    {
+        enum Compare { EQ, NE, LT, LE, GT, GE } compare;
+        unsigned int reg;
+        bool registerOperand;
+        unsigned int operand;           // register number or value
+    };
     
-    // Memory addresses
-    static const unsigned int TEXT_BASE = 0x00400000;
-    static const unsigned int DATA_BASE = 0x10010000;
-    static const unsigned int STACK_BASE = 0x7ffffffc;
+    struct Breakpoint
+    {
+        enum Kind { AT, WHEN, WATCH } kind;
+        unsigned int number;
+        unsigned int address;           // AT and WATCH
+        unsigned int length;            // WATCH
+        bool conditional;               // AT; always true for WHEN
+        Condition condition;
+        std::string text;               // operands as given
+    };
     
-    unsigned int currentDataAddr;
-    bool inDataSection;
-    bool halted;
+    std::vector<Breakpoint> breakpoints;
+    unsigned int nextBreakpoint;
+    std::vector<unsigned int> patchedSlots;     // slots of patchedCode holding a breakpoint
+    std::vector<unsigned int> callSites;        // every jal, jalr and jr $ra, found by the first finish
     
-    // Parsing functions
-    std::vector<std::string> tokenize(const std::string& line);
-    std::string cleanLine(const std::string& line);
-    void parseFile(const std::string& filename);
-    void processDataDirective(const std::vector<std::string>& tokens);
+    // The first watched write of a run: the watchpoint's number (0 for
+    // none), the address written, the instruction writing and the watched
+    // bytes' value before, if there are at most four
+    unsigned int watchHit;
+    unsigned int watchAddress;
+    unsigned int watchPC;
+    unsigned int watchOld;
+    
+    // Puts back the slots patched last time, then patches every
+    // breakpoint's address into patchedCode and sets the watches. Costs the
+    // number of breakpoints, once the code has been copied.
+    void applyBreakpoints();
+
+    // Patches an OP_BREAKPOINT over addr, unless one is there already, and
+    // adds its slot to patched so the caller can put it back
+    void patchStop(unsigned int addr, std::vector<unsigned int>& patched);
+    void watchedWrite(unsigned int addr);
+    bool parseCondition(std::string_view text, Condition& condition);
+    bool holds(const Condition& condition) const;
+    bool atBreakpoint() const;
+    
+    // Runs at most limit instructions like runFor(), stepping over a
+    // breakpoint at PC and stopping at the next, recorded if history is on
+    bool advance(unsigned long long limit);
+    
+    // What a debugger run aims for besides the next stop
+    enum RunGoal { GOAL_NONE, GOAL_UNTIL, GOAL_FINISH };
+    std::string debugRun(unsigned long long limit, RunGoal goal, unsigned int target);
+    
+    // Debugger operands: a number or label, or a register name with $hi and
+    // $lo as 32 and 33; false if text is neither
+    bool parseAddress(std::string_view text, unsigned int& addr);
+    bool parseRegister(std::string_view text, unsigned int& reg);
+    
+    // An address with an optional ",length", which is otherwise 4
+    bool parseRange(std::string_view text, unsigned int& addr, unsigned int& length);
     
     // Instruction execution
-    void executeInstruction(const std::string& instr);
-    void executeRType(const std::vector<std::string>& tokens);
-    void executeIType(const std::vector<std::string>& tokens);
-    void executeJType(const std::vector<std::string>& tokens);
-    void executePseudoInstruction(const std::vector<std::string>& tokens);
-    void executeSyscall();
+    void executeInstruction(std::string_view instr);
     
-    // Helper functions
-    int parseImmediate(const std::string& str);
-    int getRegisterNumber(const std::string& regName);
-    bool isLabel(const std::string& token);
-    unsigned int getLabelAddress(const std::string& label);
+    // Execution engines used by run(), besides Machine::runSwitch()
+    void runThreaded();
+    void runTiered();
     
+    // Helper functions
     void clearScreen();
     void printBanner(const std::string& mode);
 };
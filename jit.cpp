@@ -0,0 +1,542 @@
+/*
+File: jit.cpp
+Author: Brysen Landis
+*/
+
+#include "jit.h"
+#include "register_file.h"
+#include <cstring>
+
+#if JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+// Memory helpers called from compiled code (System V: rdi, rsi, rdx)
+static unsigned int jitLoadWord(Memory* mem, unsigned int addr)
+{
+    return mem->fetchWord(addr);
+}
+
+static unsigned int jitLoadHalf(Memory* mem, unsigned int addr)
+{
+    return static_cast<unsigned int>(static_cast<int>(static_cast<short>(mem->fetchHalfword(addr))));
+}
+
+static unsigned int jitLoadHalfUnsigned(Memory* mem, unsigned int addr)
+{
+    return mem->fetchHalfword(addr);
+}
+
+static unsigned int jitLoadByte(Memory* mem, unsigned int addr)
+{
+    return static_cast<unsigned int>(static_cast<int>(static_cast<signed char>(mem->fetch(addr))));
+}
+
+static unsigned int jitLoadByteUnsigned(Memory* mem, unsigned int addr)
+{
+    return mem->fetch(addr);
+}
+
+static void jitStoreWord(Memory* mem, unsigned int addr, unsigned int value)
+{
+    mem->storeWord(addr, value);
+}
+
+static void jitStoreHalf(Memory* mem, unsigned int addr, unsigned int value)
+{
+    mem->storeHalfword(addr, static_cast<unsigned short>(value));
+}
+
+static void jitStoreByte(Memory* mem, unsigned int addr, unsigned int value)
+{
+    mem->store(addr, static_cast<unsigned char>(value));
+}
+
+// Minimal x86-64 encoder. Compiled code keeps the guest register array in
+// rbx, the JitContext in r12 and the Memory object in r13.
+class X86Emitter
+{
+public:
+    enum Reg32 { EAX = 0, ECX = 1, EDX = 2, ESI = 6 };
+
+    // Condition codes for setcc/cmovcc
+    enum Cond { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+    // Two-operand ALU opcodes in the "r32, r/m32" form
+    enum AluOp { ALU_ADD = 0x03, ALU_OR = 0x0B, ALU_AND = 0x23, ALU_SUB = 0x2B, ALU_XOR = 0x33, ALU_CMP = 0x3B };
+
+    std::vector<unsigned char> bytes;
+    std::vector<size_t> chainFixups;
+    size_t bodyStart = 0;
+    size_t countAt = 0;
+    unsigned int blockAddr = 0;
+    bool interruptible = false;
+
+    void byte(unsigned char b) { bytes.push_back(b); }
+
+    void imm32(unsigned int v)
+    {
+        for (int i = 0; i < 4; i++) byte(static_cast<unsigned char>(v >> (i * 8)));
+    }
+
+    static unsigned char guestDisp(int reg) { return static_cast<unsigned char>(reg * 4); }
+
+    void prologue()
+    {
+        byte(0x53);                                 // push rbx
+        byte(0x41); byte(0x54);                     // push r12
+        byte(0x41); byte(0x55);                     // push r13
+        if (interruptible)
+        {
+            byte(0x41); byte(0x56);                 // push r14
+            byte(0x41); byte(0x57);                 // push r15, keeping rsp aligned for helpers
+            byte(0x4C); byte(0x8B); byte(0x77);     // mov r14, [rdi + interrupt]
+            byte(static_cast<unsigned char>(offsetof(JitContext, interrupt)));
+        }
+        byte(0x49); byte(0x89); byte(0xFC);         // mov r12, rdi
+        byte(0x48); byte(0x8B); byte(0x5F);         // mov rbx, [rdi + regs]
+        byte(static_cast<unsigned char>(offsetof(JitContext, regs)));
+        byte(0x4C); byte(0x8B); byte(0x6F);         // mov r13, [rdi + mem]
+        byte(static_cast<unsigned char>(offsetof(JitContext, mem)));
+    }
+
+    // add qword [r12 + executed], imm32; the count is filled in by setCount
+    void countInstructions()
+    {
+        byte(0x49); byte(0x81); byte(0x44); byte(0x24);
+        byte(static_cast<unsigned char>(offsetof(JitContext, executed)));
+        countAt = bytes.size();
+        imm32(0);
+    }
+
+    void setCount(unsigned int count)
+    {
+        for (int i = 0; i < 4; i++) bytes[countAt + i] = static_cast<unsigned char>(count >> (i * 8));
+    }
+
+    // Returns with the next guest PC already in eax
+    void epilogue()
+    {
+        if (interruptible)
+        {
+            byte(0x41); byte(0x5F);                 // pop r15
+            byte(0x41); byte(0x5E);                 // pop r14
+        }
+        byte(0x41); byte(0x5D);                     // pop r13
+        byte(0x41); byte(0x5C);                     // pop r12
+        byte(0x5B);                                 // pop rbx
+        byte(0xC3);                                 // ret
+    }
+
+    // Clears ZF if the interrupt flag, kept in r14, is set
+    void testInterrupt()
+    {
+        static_assert(sizeof(std::atomic<bool>) == 1, "the interrupt flag is read as a byte");
+        byte(0x41); byte(0x80); byte(0x3E); byte(0x00);  // cmp byte [r14], 0
+    }
+
+    // Leaves the block for the guest PC in eax
+    void jumpChain()
+    {
+        byte(0xE9);                                 // jmp chain (patched in finish)
+        chainFixups.push_back(bytes.size());
+        imm32(0);
+    }
+
+    void exitTo(unsigned int pc)
+    {
+        if (pc == blockAddr)
+        {
+            // Tight loop back to this block's own start, or out through the
+            // shared exit once interrupted
+            if (interruptible)
+            {
+                testInterrupt();
+                byte(0x75); byte(5);                // jnz past the loop
+            }
+            byte(0xE9);
+            imm32(static_cast<unsigned int>(bodyStart - (bytes.size() + 4)));
+            if (!interruptible) return;
+        }
+        movImm(EAX, pc);
+        jumpChain();
+    }
+
+    // Shared exit: jump straight into the compiled block for eax if there is
+    // one (past its prologue, since the frame is already set up), else return.
+    // Interruptible blocks return whenever the interrupt flag is set.
+    void finish()
+    {
+        size_t chain = bytes.size();
+        for (size_t fixup : chainFixups)
+        {
+            unsigned int rel = static_cast<unsigned int>(chain - (fixup + 4));
+            for (int i = 0; i < 4; i++) bytes[fixup + i] = static_cast<unsigned char>(rel >> (i * 8));
+        }
+
+        size_t interrupted = 0;
+        if (interruptible)
+        {
+            testInterrupt();
+            byte(0x75); interrupted = bytes.size(); byte(0);                    // jnz out
+        }
+
+        byte(0x89); byte(0xC1);                     // mov ecx, eax
+        byte(0x41); byte(0x2B); byte(0x4C); byte(0x24);
+        byte(static_cast<unsigned char>(offsetof(JitContext, textBase)));   // sub ecx, [r12 + textBase]
+        byte(0xF6); byte(0xC1); byte(0x03);         // test cl, 3
+        byte(0x75); size_t miss1 = bytes.size(); byte(0);                   // jnz out
+        byte(0xC1); byte(0xE9); byte(0x02);         // shr ecx, 2
+        byte(0x41); byte(0x3B); byte(0x4C); byte(0x24);
+        byte(static_cast<unsigned char>(offsetof(JitContext, blockCount))); // cmp ecx, [r12 + blockCount]
+        byte(0x73); size_t miss2 = bytes.size(); byte(0);                   // jae out
+        byte(0x49); byte(0x8B); byte(0x54); byte(0x24);
+        byte(static_cast<unsigned char>(offsetof(JitContext, blocks)));     // mov rdx, [r12 + blocks]
+        byte(0x48); byte(0x8B); byte(0x14); byte(0xCA);                     // mov rdx, [rdx + rcx*8]
+        byte(0x48); byte(0x85); byte(0xD2);         // test rdx, rdx
+        byte(0x74); size_t miss3 = bytes.size(); byte(0);                   // jz out
+        byte(0x48); byte(0x83); byte(0xC2); byte(static_cast<unsigned char>(bodyStart)); // add rdx, prologue
+        byte(0xFF); byte(0xE2);                     // jmp rdx
+
+        size_t out = bytes.size();
+        bytes[miss1] = static_cast<unsigned char>(out - (miss1 + 1));
+        bytes[miss2] = static_cast<unsigned char>(out - (miss2 + 1));
+        bytes[miss3] = static_cast<unsigned char>(out - (miss3 + 1));
+        if (interruptible) bytes[interrupted] = static_cast<unsigned char>(out - (interrupted + 1));
+        epilogue();
+    }
+
+    void loadGuest(Reg32 r, int guest)              // mov r, [rbx + 4*guest]
+    {
+        byte(0x8B); byte(static_cast<unsigned char>(0x43 | (r << 3))); byte(guestDisp(guest));
+    }
+
+    void storeGuest(int guest, Reg32 r)             // mov [rbx + 4*guest], r
+    {
+        if (guest == REG_ZERO) return;
+        byte(0x89); byte(static_cast<unsigned char>(0x43 | (r << 3))); byte(guestDisp(guest));
+    }
+
+    void storeGuestImm(int guest, unsigned int v)   // mov dword [rbx + 4*guest], imm32
+    {
+        if (guest == REG_ZERO) return;
+        byte(0xC7); byte(0x43); byte(guestDisp(guest)); imm32(v);
+    }
+
+    void aluGuest(AluOp op, int guest)              // op eax, [rbx + 4*guest]
+    {
+        byte(static_cast<unsigned char>(op)); byte(0x43); byte(guestDisp(guest));
+    }
+
+    void aluImm(AluOp op, unsigned int v)           // op eax, imm32
+    {
+        byte(static_cast<unsigned char>(op + 2)); imm32(v);
+    }
+
+    void movImm(Reg32 r, unsigned int v)            // mov r, imm32
+    {
+        byte(static_cast<unsigned char>(0xB8 + r)); imm32(v);
+    }
+
+    void notEax() { byte(0xF7); byte(0xD0); }
+
+    void shiftImm(unsigned char ext, int amount)    // shl/shr/sar eax, imm8
+    {
+        byte(0xC1); byte(static_cast<unsigned char>(0xC0 | (ext << 3))); byte(static_cast<unsigned char>(amount));
+    }
+
+    void shiftCl(unsigned char ext)                 // shl/shr/sar eax, cl
+    {
+        byte(0xD3); byte(static_cast<unsigned char>(0xC0 | (ext << 3)));
+    }
+
+    void setccEax(Cond cc)                          // setcc al; movzx eax, al
+    {
+        byte(0x0F); byte(static_cast<unsigned char>(0x90 | cc)); byte(0xC0);
+        byte(0x0F); byte(0xB6); byte(0xC0);
+    }
+
+    void cmovEaxEcx(Cond cc)                        // cmovcc eax, ecx
+    {
+        byte(0x0F); byte(static_cast<unsigned char>(0x40 | cc)); byte(0xC1);
+    }
+
+    void mulGuest(bool isSigned, int guest)         // imul/mul dword [rbx + 4*guest]
+    {
+        byte(0xF7); byte(isSigned ? 0x6B : 0x63); byte(guestDisp(guest));
+    }
+
+    void loadContext(Reg32 r, size_t offset)        // mov r, [r12 + offset]
+    {
+        byte(0x41); byte(0x8B); byte(static_cast<unsigned char>(0x44 | (r << 3))); byte(0x24);
+        byte(static_cast<unsigned char>(offset));
+    }
+
+    void storeContext(size_t offset, Reg32 r)       // mov [r12 + offset], r
+    {
+        byte(0x41); byte(0x89); byte(static_cast<unsigned char>(0x44 | (r << 3))); byte(0x24);
+        byte(static_cast<unsigned char>(offset));
+    }
+
+    void callHelper(const void* fn)
+    {
+        byte(0x4C); byte(0x89); byte(0xEF);         // mov rdi, r13
+        byte(0x48); byte(0xB8);                     // mov rax, imm64
+        unsigned long long target = reinterpret_cast<unsigned long long>(fn);
+        for (int i = 0; i < 8; i++) byte(static_cast<unsigned char>(target >> (i * 8)));
+        byte(0xFF); byte(0xD0);                     // call rax
+    }
+
+    // esi = guest[base] + offset
+    void effectiveAddress(int base, int offset)
+    {
+        loadGuest(ESI, base);
+        if (offset != 0)
+        {
+            byte(0x81); byte(0xC6); imm32(static_cast<unsigned int>(offset));
+        }
+    }
+};
+
+JitCompiler::JitCompiler()
+    : buffer(nullptr), used(0), blockCount(0), interruptible(false)
+{
+#if JIT_SUPPORTED
+    void* mapped = mmap(nullptr, CAPACITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped != MAP_FAILED)
+    {
+        buffer = static_cast<unsigned char*>(mapped);
+        mprotect(buffer, CAPACITY, PROT_READ | PROT_EXEC);
+    }
+#endif
+}
+
+JitCompiler::~JitCompiler()
+{
+#if JIT_SUPPORTED
+    if (buffer) munmap(buffer, CAPACITY);
+#endif
+}
+
+bool JitCompiler::supports(Opcode op)
+{
+    switch (op)
+    {
+        case OP_DIV: case OP_DIVU:
+        case OP_SYSCALL: case OP_INVALID: case OP_COPY_LOOP: case OP_BREAKPOINT: case OP_COUNT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool isBranch(Opcode op)
+{
+    switch (op)
+    {
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+        case OP_BLTZ: case OP_BLEZ: case OP_BGTZ: case OP_BGEZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+JitBlock JitCompiler::compile(const DecodedInstruction* code, unsigned int first, unsigned int end,
+                              unsigned int addr)
+{
+    if (!buffer || first >= end || !supports(code[first].op)) return nullptr;
+
+    typedef X86Emitter X;
+    X e;
+    e.interruptible = interruptible;
+    e.prologue();
+    e.bodyStart = e.bytes.size();
+    e.blockAddr = addr;
+    e.countInstructions();
+
+    unsigned int pc = addr;
+    unsigned int compiled = 0;
+    bool exited = false;
+
+    for (unsigned int i = first; i < end && i - first < MAX_BLOCK_INSTRUCTIONS; i++, pc += 4)
+    {
+        const DecodedInstruction& d = code[i];
+        if (!supports(d.op)) break;
+        compiled++;
+
+        switch (d.op)
+        {
+            case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU:
+            case OP_AND: case OP_OR: case OP_XOR: case OP_NOR:
+            {
+                X::AluOp op = X::ALU_ADD;
+                if (d.op == OP_SUB || d.op == OP_SUBU) op = X::ALU_SUB;
+                else if (d.op == OP_AND) op = X::ALU_AND;
+                else if (d.op == OP_OR || d.op == OP_NOR) op = X::ALU_OR;
+                else if (d.op == OP_XOR) op = X::ALU_XOR;
+                e.loadGuest(X::EAX, d.rs);
+                e.aluGuest(op, d.rt);
+                if (d.op == OP_NOR) e.notEax();
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            }
+            case OP_SLT:
+            case OP_SLTU:
+                e.loadGuest(X::EAX, d.rs);
+                e.aluGuest(X::ALU_CMP, d.rt);
+                e.setccEax(d.op == OP_SLT ? X::CC_L : X::CC_B);
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            case OP_SLL: case OP_SRL: case OP_SRA:
+                e.loadGuest(X::EAX, d.rt);
+                e.shiftImm(d.op == OP_SLL ? 4 : (d.op == OP_SRL ? 5 : 7), d.imm);
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            case OP_SLLV: case OP_SRLV: case OP_SRAV:
+                e.loadGuest(X::ECX, d.rs);
+                e.loadGuest(X::EAX, d.rt);
+                e.shiftCl(d.op == OP_SLLV ? 4 : (d.op == OP_SRLV ? 5 : 7));
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            case OP_MULT: case OP_MULTU:
+                e.loadGuest(X::EAX, d.rs);
+                e.mulGuest(d.op == OP_MULT, d.rt);
+                e.storeContext(offsetof(JitContext, lo), X::EAX);
+                e.storeContext(offsetof(JitContext, hi), X::EDX);
+                break;
+            case OP_MFHI: case OP_MFLO:
+                e.loadContext(X::EAX, d.op == OP_MFHI ? offsetof(JitContext, hi) : offsetof(JitContext, lo));
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            case OP_MTHI: case OP_MTLO:
+                e.loadGuest(X::EAX, d.rs);
+                e.storeContext(d.op == OP_MTHI ? offsetof(JitContext, hi) : offsetof(JitContext, lo), X::EAX);
+                break;
+            case OP_ADDI: case OP_ADDIU: case OP_ANDI: case OP_ORI: case OP_XORI:
+            {
+                X::AluOp op = X::ALU_ADD;
+                if (d.op == OP_ANDI) op = X::ALU_AND;
+                else if (d.op == OP_ORI) op = X::ALU_OR;
+                else if (d.op == OP_XORI) op = X::ALU_XOR;
+                e.loadGuest(X::EAX, d.rs);
+                e.aluImm(op, static_cast<unsigned int>(d.imm));
+                e.storeGuest(d.rt, X::EAX);
+                break;
+            }
+            case OP_SLTI: case OP_SLTIU:
+                e.loadGuest(X::EAX, d.rs);
+                e.aluImm(X::ALU_CMP, static_cast<unsigned int>(d.imm));
+                e.setccEax(d.op == OP_SLTI ? X::CC_L : X::CC_B);
+                e.storeGuest(d.rt, X::EAX);
+                break;
+            case OP_LUI: case OP_LI: case OP_LA:
+                e.storeGuestImm(d.rt, static_cast<unsigned int>(d.imm));
+                break;
+            case OP_CLEAR:
+                e.storeGuestImm(d.rd, 0);
+                break;
+            case OP_MOVE: case OP_NOT:
+                e.loadGuest(X::EAX, d.rs);
+                if (d.op == OP_NOT) e.notEax();
+                e.storeGuest(d.rd, X::EAX);
+                break;
+            case OP_NOP:
+                break;
+            case OP_LW: case OP_LH: case OP_LHU: case OP_LB: case OP_LBU:
+            {
+                const void* fn = reinterpret_cast<const void*>(&jitLoadWord);
+                if (d.op == OP_LH) fn = reinterpret_cast<const void*>(&jitLoadHalf);
+                else if (d.op == OP_LHU) fn = reinterpret_cast<const void*>(&jitLoadHalfUnsigned);
+                else if (d.op == OP_LB) fn = reinterpret_cast<const void*>(&jitLoadByte);
+                else if (d.op == OP_LBU) fn = reinterpret_cast<const void*>(&jitLoadByteUnsigned);
+                e.effectiveAddress(d.rs, d.imm);
+                e.callHelper(fn);
+                e.storeGuest(d.rt, X::EAX);
+                break;
+            }
+            case OP_SW: case OP_SH: case OP_SB:
+            {
+                const void* fn = reinterpret_cast<const void*>(&jitStoreWord);
+                if (d.op == OP_SH) fn = reinterpret_cast<const void*>(&jitStoreHalf);
+                else if (d.op == OP_SB) fn = reinterpret_cast<const void*>(&jitStoreByte);
+                e.effectiveAddress(d.rs, d.imm);
+                e.loadGuest(X::EDX, d.rt);
+                e.callHelper(fn);
+                break;
+            }
+            case OP_J:
+                e.exitTo(d.target);
+                exited = true;
+                break;
+            case OP_JAL:
+                e.storeGuestImm(REG_RA, pc + 4);
+                e.exitTo(d.target);
+                exited = true;
+                break;
+            case OP_JR:
+                e.loadGuest(X::EAX, d.rs);
+                e.jumpChain();
+                exited = true;
+                break;
+            case OP_JALR:
+                e.loadGuest(X::EAX, d.rs);
+                e.storeGuestImm(d.rd, pc + 4);
+                e.jumpChain();
+                exited = true;
+                break;
+            default:
+                if (isBranch(d.op))
+                {
+                    X::Cond cc = X::CC_E;
+                    e.loadGuest(X::EAX, d.rs);
+                    if (d.op >= OP_BLTZ)
+                    {
+                        e.aluImm(X::ALU_CMP, 0);
+                    }
+                    else
+                    {
+                        e.aluGuest(X::ALU_CMP, d.rt);
+                    }
+                    switch (d.op)
+                    {
+                        case OP_BEQ:  cc = X::CC_E; break;
+                        case OP_BNE:  cc = X::CC_NE; break;
+                        case OP_BLT: case OP_BLTZ: cc = X::CC_L; break;
+                        case OP_BLE: case OP_BLEZ: cc = X::CC_LE; break;
+                        case OP_BGT: case OP_BGTZ: cc = X::CC_G; break;
+                        default:      cc = X::CC_GE; break;
+                    }
+                    e.movImm(X::EAX, pc + 4);
+                    e.movImm(X::ECX, d.target);
+                    e.cmovEaxEcx(cc);
+                    e.jumpChain();
+                    exited = true;
+                }
+                break;
+        }
+
+        if (exited) break;
+    }
+
+    if (!exited)
+    {
+        e.exitTo(pc);
+    }
+    e.setCount(compiled);
+    e.finish();
+
+    if (used + e.bytes.size() > CAPACITY) return nullptr;
+
+#if JIT_SUPPORTED
+    unsigned char* dest = buffer + used;
+    mprotect(buffer, CAPACITY, PROT_READ | PROT_WRITE);
+    std::memcpy(dest, e.bytes.data(), e.bytes.size());
+    mprotect(buffer, CAPACITY, PROT_READ | PROT_EXEC);
+    used += (e.bytes.size() + 15) & ~static_cast<size_t>(15);
+    blockCount++;
+    return reinterpret_cast<JitBlock>(dest);
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,87 @@
+/*
+File: jit.h
+Author: Brysen Landis
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include "instruction.h"
+#include "memory.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+struct JitContext;
+
+// A compiled block runs until control reaches a slot with no compiled code,
+// then returns that guest PC
+typedef unsigned int (*JitBlock)(JitContext* ctx);
+
+// Guest state seen by compiled code. Registers are used in place; HI and LO
+// are copied in and out around each call. Blocks chain directly into each
+// other through the blocks table, which is indexed like the program, and
+// each adds its instruction count to executed as it starts. Blocks compiled
+// interruptible return instead of chaining once *interrupt is set.
+struct JitContext
+{
+    unsigned int* regs;
+    Memory* mem;
+    const JitBlock* blocks;
+    unsigned int blockCount;
+    unsigned int textBase;
+    unsigned int hi;
+    unsigned int lo;
+    unsigned long long executed;
+    const std::atomic<bool>* interrupt;
+};
+
+// Translates straight-line runs of decoded instructions into x86-64 code
+// placed in an mmap'd executable buffer
+class JitCompiler
+{
+public:
+    JitCompiler();
+    ~JitCompiler();
+
+    bool available() const { return buffer != nullptr; }
+
+    // Compiles code[first, end) starting at guest address addr, stopping
+    // early at the first instruction the JIT does not handle. Returns
+    // nullptr if not even the first instruction can be compiled.
+    JitBlock compile(const DecodedInstruction* code, unsigned int first, unsigned int end,
+                     unsigned int addr);
+
+    // Discards all compiled code
+    void clear() { used = 0; blockCount = 0; }
+
+    // Blocks compiled from now on check ctx->interrupt at each exit, at
+    // the cost of a compare per exit
+    void setInterruptible(bool on) { interruptible = on; }
+    bool isInterruptible() const { return interruptible; }
+
+    size_t compiledBlocks() const { return blockCount; }
+    size_t codeBytes() const { return used; }
+
+    static bool supports(Opcode op);
+
+private:
+    static const size_t CAPACITY = 16 * 1024 * 1024;
+    static const size_t MAX_BLOCK_INSTRUCTIONS = 256;
+
+    unsigned char* buffer;
+    size_t used;
+    size_t blockCount;
+    bool interruptible;
+
+    JitCompiler(const JitCompiler&) = delete;
+    JitCompiler& operator=(const JitCompiler&) = delete;
+};
+
+#endif
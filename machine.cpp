@@ -0,0 +1,697 @@
+/*
+File: machine.cpp
+Author: Brysen Landis
+*/
+
+#include "machine.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+Machine::Machine(std::shared_ptr<const Program> program)
+    : prog(std::move(program)), PC(0), HI(0), LO(0), heapPtr(HEAP_BASE), halted(false), executedCount(0),
+      stopped(false), inputPreloaded(false), fileRoot(".")
+{
+    setIO(std::cin, std::cout);
+    setErrorOutput(std::cerr);
+    restart();
+}
+
+void Machine::restart()
+{
+    regFile = RegisterFile();
+    regFile.set(REG_SP, STACK_BASE);
+    mem = prog->image;
+    PC = prog->entry;
+    HI = 0;
+    LO = 0;
+    heapPtr = heapStart(*prog);
+    heap = GuestHeap();
+    halted = false;
+    executedCount = 0;
+    stopped = false;
+    files.clear();
+}
+
+unsigned int Machine::heapStart(const Program& program)
+{
+    unsigned int dataPages = (program.dataEnd + Memory::PAGE_MASK) & ~Memory::PAGE_MASK;
+    return dataPages > HEAP_BASE ? dataPages : HEAP_BASE;
+}
+
+void Machine::setIO(std::istream& in, std::ostream& out)
+{
+    setInput(in);
+    setOutput(out);
+}
+
+void Machine::setInput(std::istream& in)
+{
+    host.readInt = [&in](int& value) { return static_cast<bool>(in >> value); };
+    host.readLine = [&in](std::string& line) { return static_cast<bool>(std::getline(in, line)); };
+    host.readChar = [&in](char& ch) { return static_cast<bool>(in >> ch); };
+    host.read = [&in](char* buffer, size_t length)
+    {
+        // Up to the end of the line, so a terminal read returns once a line is typed
+        size_t count = 0;
+        int ch;
+        while (count < length && (ch = in.get()) != std::char_traits<char>::eof())
+        {
+            buffer[count++] = static_cast<char>(ch);
+            if (ch == '\n') break;
+        }
+        return count;
+    };
+    inputPreloaded = false;
+}
+
+void Machine::setOutput(std::ostream& out)
+{
+    host.write = [&out](const char* text, size_t length)
+    {
+        out.write(text, static_cast<std::streamsize>(length));
+        out.flush();
+    };
+}
+
+void Machine::setErrorOutput(std::ostream& out)
+{
+    host.writeError = [&out](const char* text, size_t length)
+    {
+        out.write(text, static_cast<std::streamsize>(length));
+        out.flush();
+    };
+}
+
+void Machine::flushOutput()
+{
+    if (output.empty()) return;
+    host.write(output.data(), output.size());
+    output.clear();
+}
+
+void Machine::warn(const std::string& message)
+{
+    flushOutput();
+    std::string line = "Warning: " + message + "\n";
+    if (host.writeError) host.writeError(line.data(), line.size());
+}
+
+namespace
+{
+    struct InputText
+    {
+        std::string text;
+        size_t pos = 0;
+
+        // Like a stream, numbers and characters skip leading whitespace
+        void skipSpace()
+        {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) pos++;
+        }
+    };
+}
+
+void Machine::setInput(std::string text)
+{
+    auto input = std::make_shared<InputText>();
+    input->text = std::move(text);
+
+    host.readInt = [input](int& value)
+    {
+        input->skipSpace();
+        const char* first = input->text.data() + input->pos;
+        const char* last = input->text.data() + input->text.size();
+        if (first < last && *first == '+') first++;
+        auto result = std::from_chars(first, last, value);
+        if (result.ec != std::errc()) return false;
+        input->pos = static_cast<size_t>(result.ptr - input->text.data());
+        return true;
+    };
+    host.readLine = [input](std::string& line)
+    {
+        if (input->pos >= input->text.size()) return false;
+        size_t end = input->text.find('\n', input->pos);
+        if (end == std::string::npos) end = input->text.size();
+        line.assign(input->text, input->pos, end - input->pos);
+        input->pos = std::min(end + 1, input->text.size());
+        return true;
+    };
+    host.readChar = [input](char& ch)
+    {
+        input->skipSpace();
+        if (input->pos >= input->text.size()) return false;
+        ch = input->text[input->pos++];
+        return true;
+    };
+    host.read = [input](char* buffer, size_t length)
+    {
+        size_t count = std::min(length, input->text.size() - input->pos);
+        std::memcpy(buffer, input->text.data() + input->pos, count);
+        input->pos += count;
+        return count;
+    };
+    inputPreloaded = true;
+}
+
+bool Machine::run()
+{
+    runSwitch();
+    return halted;
+}
+
+bool Machine::step()
+{
+    unsigned int index = (PC - TEXT_BASE) >> 2;
+    if (halted || (PC & 3) != 0 || index >= prog->code.size()) return false;
+    execute(instructionAt(index));
+    executedCount++;
+    flushOutput();
+    return !halted;
+}
+
+bool Machine::runUntil(unsigned int address)
+{
+    const DecodedInstruction* code = prog->code.data();
+    const size_t count = prog->code.size();
+    unsigned long long executed = 0;
+    
+    while (!halted && PC != address)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        execute(code[index]);
+        executed++;
+    }
+    executedCount += executed;
+    flushOutput();
+    return !halted && PC == address;
+}
+
+bool Machine::runFor(unsigned long long limit)
+{
+    const DecodedInstruction* code = debugCode();
+    const size_t count = prog->code.size();
+    unsigned long long executed = 0;
+    
+    while (!halted && executed < limit)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        execute(code[index]);
+        executed++;
+    }
+    executedCount += executed;
+    flushOutput();
+    unsigned int index = (PC - TEXT_BASE) >> 2;
+    return !halted && (PC & 3) == 0 && index < count;
+}
+
+Machine::Snapshot Machine::snapshot() const
+{
+    // A machine the debugger stopped has not halted
+    return Snapshot{regFile, mem, PC, HI, LO, heapPtr, heap, halted && !stopped, executedCount};
+}
+
+void Machine::restore(const Snapshot& state)
+{
+    regFile = state.regFile;
+    mem = state.mem;
+    PC = state.PC;
+    HI = state.HI;
+    LO = state.LO;
+    heapPtr = state.heapPtr;
+    heap = state.heap;
+    halted = state.halted;
+    executedCount = state.executedCount;
+    stopped = false;
+}
+
+void Machine::runSwitch()
+{
+    const DecodedInstruction* code = prog->code.data();
+    const size_t count = prog->code.size();
+    unsigned long long executed = 0;
+    
+    while (!halted)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        execute(code[index]);
+        executed++;
+    }
+    executedCount += executed;
+    flushOutput();
+}
+
+bool Machine::runUntilSet(const std::atomic<bool>& flag, const unsigned int* blockEnds)
+{
+    const DecodedInstruction* code = prog->code.data();
+    const size_t count = prog->code.size();
+    unsigned long long executed = 0;
+    
+    while (!halted)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        
+        if (flag.load(std::memory_order_relaxed))
+        {
+            executedCount += executed;
+            return true;
+        }
+        
+        const unsigned int end = blockEnds[index];
+        for (unsigned int i = index; i < end; i++)
+        {
+            execute(code[i]);
+        }
+        executed += end - index;
+    }
+    executedCount += executed;
+    return false;
+}
+
+void Machine::execute(const DecodedInstruction& d)
+{
+    switch (d.op)
+    {
+        // R-Type instructions
+        case OP_ADD:
+        case OP_ADDU:
+            regFile.set(d.rd, regFile.get(d.rs) + regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_SUB:
+        case OP_SUBU:
+            regFile.set(d.rd, regFile.get(d.rs) - regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_AND:
+            regFile.set(d.rd, regFile.get(d.rs) & regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_OR:
+            regFile.set(d.rd, regFile.get(d.rs) | regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_XOR:
+            regFile.set(d.rd, regFile.get(d.rs) ^ regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_NOR:
+            regFile.set(d.rd, ~(regFile.get(d.rs) | regFile.get(d.rt)));
+            PC += 4;
+            break;
+        case OP_SLT:
+            regFile.set(d.rd, (static_cast<int>(regFile.get(d.rs)) < static_cast<int>(regFile.get(d.rt))) ? 1 : 0);
+            PC += 4;
+            break;
+        case OP_SLTU:
+            regFile.set(d.rd, (regFile.get(d.rs) < regFile.get(d.rt)) ? 1 : 0);
+            PC += 4;
+            break;
+        case OP_SLL:
+            regFile.set(d.rd, regFile.get(d.rt) << d.imm);
+            PC += 4;
+            break;
+        case OP_SRL:
+            regFile.set(d.rd, regFile.get(d.rt) >> d.imm);
+            PC += 4;
+            break;
+        case OP_SRA:
+            regFile.set(d.rd, static_cast<unsigned int>(static_cast<int>(regFile.get(d.rt)) >> d.imm));
+            PC += 4;
+            break;
+        case OP_SLLV:
+            regFile.set(d.rd, regFile.get(d.rt) << (regFile.get(d.rs) & 0x1F));
+            PC += 4;
+            break;
+        case OP_SRLV:
+            regFile.set(d.rd, regFile.get(d.rt) >> (regFile.get(d.rs) & 0x1F));
+            PC += 4;
+            break;
+        case OP_SRAV:
+            regFile.set(d.rd, static_cast<unsigned int>(static_cast<int>(regFile.get(d.rt)) >> (regFile.get(d.rs) & 0x1F)));
+            PC += 4;
+            break;
+        case OP_MULT:
+        {
+            long long result = static_cast<long long>(static_cast<int>(regFile.get(d.rs))) * 
+                               static_cast<long long>(static_cast<int>(regFile.get(d.rt)));
+            LO = static_cast<unsigned int>(result & 0xFFFFFFFF);
+            HI = static_cast<unsigned int>((result >> 32) & 0xFFFFFFFF);
+            PC += 4;
+            break;
+        }
+        case OP_MULTU:
+        {
+            unsigned long long result = static_cast<unsigned long long>(regFile.get(d.rs)) * 
+                                        static_cast<unsigned long long>(regFile.get(d.rt));
+            LO = static_cast<unsigned int>(result & 0xFFFFFFFF);
+            HI = static_cast<unsigned int>((result >> 32) & 0xFFFFFFFF);
+            PC += 4;
+            break;
+        }
+        case OP_DIV:
+        {
+            int dividend = static_cast<int>(regFile.get(d.rs));
+            int divisor = static_cast<int>(regFile.get(d.rt));
+            if (divisor == -1)
+            {
+                LO = 0u - static_cast<unsigned int>(dividend); // avoids INT_MIN / -1 overflow
+                HI = 0;
+            }
+            else if (divisor != 0)
+            {
+                LO = static_cast<unsigned int>(dividend / divisor);
+                HI = static_cast<unsigned int>(dividend % divisor);
+            }
+            PC += 4;
+            break;
+        }
+        case OP_DIVU:
+        {
+            unsigned int dividend = regFile.get(d.rs);
+            unsigned int divisor = regFile.get(d.rt);
+            if (divisor != 0)
+            {
+                LO = dividend / divisor;
+                HI = dividend % divisor;
+            }
+            PC += 4;
+            break;
+        }
+        case OP_MFHI:
+            regFile.set(d.rd, HI);
+            PC += 4;
+            break;
+        case OP_MFLO:
+            regFile.set(d.rd, LO);
+            PC += 4;
+            break;
+        case OP_MTHI:
+            HI = regFile.get(d.rs);
+            PC += 4;
+            break;
+        case OP_MTLO:
+            LO = regFile.get(d.rs);
+            PC += 4;
+            break;
+        case OP_JR:
+            PC = regFile.get(d.rs);
+            break;
+        case OP_JALR:
+        {
+            unsigned int target = regFile.get(d.rs);
+            regFile.set(d.rd, PC + 4);
+            PC = target;
+            break;
+        }
+        
+        // I-Type instructions
+        case OP_ADDI:
+        case OP_ADDIU:
+            regFile.set(d.rt, regFile.get(d.rs) + d.imm);
+            PC += 4;
+            break;
+        case OP_ANDI:
+            regFile.set(d.rt, regFile.get(d.rs) & d.imm);
+            PC += 4;
+            break;
+        case OP_ORI:
+            regFile.set(d.rt, regFile.get(d.rs) | d.imm);
+            PC += 4;
+            break;
+        case OP_XORI:
+            regFile.set(d.rt, regFile.get(d.rs) ^ d.imm);
+            PC += 4;
+            break;
+        case OP_SLTI:
+            regFile.set(d.rt, (static_cast<int>(regFile.get(d.rs)) < d.imm) ? 1 : 0);
+            PC += 4;
+            break;
+        case OP_SLTIU:
+            regFile.set(d.rt, (regFile.get(d.rs) < static_cast<unsigned int>(d.imm)) ? 1 : 0);
+            PC += 4;
+            break;
+        case OP_LUI:
+            regFile.set(d.rt, d.imm);
+            PC += 4;
+            break;
+        case OP_LW:
+            regFile.set(d.rt, mem.fetchWord(regFile.get(d.rs) + d.imm));
+            PC += 4;
+            break;
+        case OP_LH:
+            regFile.set(d.rt, static_cast<unsigned int>(static_cast<int>(static_cast<short>(mem.fetchHalfword(regFile.get(d.rs) + d.imm)))));
+            PC += 4;
+            break;
+        case OP_LHU:
+            regFile.set(d.rt, mem.fetchHalfword(regFile.get(d.rs) + d.imm));
+            PC += 4;
+            break;
+        case OP_LB:
+            regFile.set(d.rt, static_cast<unsigned int>(static_cast<int>(static_cast<signed char>(mem.fetch(regFile.get(d.rs) + d.imm)))));
+            PC += 4;
+            break;
+        case OP_LBU:
+            regFile.set(d.rt, mem.fetch(regFile.get(d.rs) + d.imm));
+            PC += 4;
+            break;
+        case OP_SW:
+            mem.storeWord(regFile.get(d.rs) + d.imm, regFile.get(d.rt));
+            PC += 4;
+            break;
+        case OP_SH:
+            mem.storeHalfword(regFile.get(d.rs) + d.imm, static_cast<unsigned short>(regFile.get(d.rt)));
+            PC += 4;
+            break;
+        case OP_SB:
+            mem.store(regFile.get(d.rs) + d.imm, static_cast<unsigned char>(regFile.get(d.rt)));
+            PC += 4;
+            break;
+        case OP_BEQ:
+            PC = (regFile.get(d.rs) == regFile.get(d.rt)) ? d.target : PC + 4;
+            break;
+        case OP_BNE:
+            PC = (regFile.get(d.rs) != regFile.get(d.rt)) ? d.target : PC + 4;
+            break;
+        case OP_BLT:
+            PC = (static_cast<int>(regFile.get(d.rs)) < static_cast<int>(regFile.get(d.rt))) ? d.target : PC + 4;
+            break;
+        case OP_BLE:
+            PC = (static_cast<int>(regFile.get(d.rs)) <= static_cast<int>(regFile.get(d.rt))) ? d.target : PC + 4;
+            break;
+        case OP_BGT:
+            PC = (static_cast<int>(regFile.get(d.rs)) > static_cast<int>(regFile.get(d.rt))) ? d.target : PC + 4;
+            break;
+        case OP_BGE:
+            PC = (static_cast<int>(regFile.get(d.rs)) >= static_cast<int>(regFile.get(d.rt))) ? d.target : PC + 4;
+            break;
+        case OP_BLTZ:
+            PC = (static_cast<int>(regFile.get(d.rs)) < 0) ? d.target : PC + 4;
+            break;
+        case OP_BLEZ:
+            PC = (static_cast<int>(regFile.get(d.rs)) <= 0) ? d.target : PC + 4;
+            break;
+        case OP_BGTZ:
+            PC = (static_cast<int>(regFile.get(d.rs)) > 0) ? d.target : PC + 4;
+            break;
+        case OP_BGEZ:
+            PC = (static_cast<int>(regFile.get(d.rs)) >= 0) ? d.target : PC + 4;
+            break;
+        
+        // J-Type instructions
+        case OP_J:
+            PC = d.target;
+            break;
+        case OP_JAL:
+            regFile.set(REG_RA, PC + 4);
+            PC = d.target;
+            break;
+        
+        // Special instructions
+        case OP_SYSCALL:
+            executeSyscall();
+            PC += 4;
+            break;
+        case OP_NOP:
+        case OP_INVALID:
+        case OP_COUNT:
+            PC += 4;
+            break;
+        case OP_COPY_LOOP:
+            executeCopyLoop(prog->copyLoops[d.imm]);
+            break;
+        case OP_BREAKPOINT:
+            // Runs nothing, and the run loop's count of it is taken back
+            stopped = halted = true;
+            executedCount--;
+            break;
+        
+        // Pseudo-instructions
+        case OP_LI:
+        case OP_LA:
+            regFile.set(d.rt, d.imm);
+            PC += 4;
+            break;
+        case OP_MOVE:
+            regFile.set(d.rd, regFile.get(d.rs));
+            PC += 4;
+            break;
+        case OP_CLEAR:
+            regFile.set(d.rd, 0);
+            PC += 4;
+            break;
+        case OP_NOT:
+            regFile.set(d.rd, ~regFile.get(d.rs));
+            PC += 4;
+            break;
+    }
+}
+
+void Machine::executeCopyLoop(const CopyLoop& loop)
+{
+    const unsigned int src = regFile.get(loop.src);
+    const unsigned int dst = regFile.get(loop.dst);
+    const unsigned int bytes = loop.endPointer ? regFile.get(loop.bound) - src : regFile.get(loop.bound);
+
+    // Run the loop as written when no single copy matches it: a count that
+    // wraps before it ends, addresses that wrap, or a destination just ahead
+    // of the source, where the loop repeats its first bytes
+    if (bytes == 0 || src + bytes < src || dst + bytes < dst || (dst > src && dst - src < bytes))
+    {
+        execute(loop.load);
+        return;
+    }
+
+    mem.copyBlock(dst, src, bytes);
+    const unsigned char last = mem.fetch(src + bytes - 1);
+    regFile.set(loop.temp, loop.load.op == OP_LB ? static_cast<unsigned int>(static_cast<int>(static_cast<signed char>(last)))
+                                                 : last);
+    regFile.set(loop.src, src + bytes);
+    regFile.set(loop.dst, dst + bytes);
+    if (!loop.endPointer) regFile.set(loop.bound, 0);
+    PC = loop.exit;
+    executedCount += static_cast<unsigned long long>(loop.length) * bytes - 1;
+}
+
+void Machine::executeSyscall()
+{
+    unsigned int v0 = regFile.get(REG_V0);
+    
+    switch (v0)
+    {
+        case 1: // print integer
+        {
+            char text[16];
+            char* end = std::to_chars(text, text + sizeof(text), static_cast<int>(regFile.get(REG_A0))).ptr;
+            output.append(text, end);
+            if (output.size() >= OUTPUT_BUFFER_SIZE) flushOutput();
+            break;
+        }
+        case 4: // print string
+        {
+            mem.appendString(regFile.get(REG_A0), output);
+            if (output.size() >= OUTPUT_BUFFER_SIZE) flushOutput();
+            break;
+        }
+        case 5: // read integer
+        {
+            if (!inputPreloaded) flushOutput();
+            int value = 0;
+            host.readInt(value);
+            regFile.set(REG_V0, static_cast<unsigned int>(value));
+            break;
+        }
+        case 8: // read string
+        {
+            unsigned int addr = regFile.get(REG_A0);
+            int maxLen = static_cast<int>(regFile.get(REG_A1));
+            if (!inputPreloaded) flushOutput();
+            std::string input;
+            host.readLine(input);
+            if (maxLen <= 0) break;
+            
+            // Truncated to leave room for the terminator, which is copied too
+            size_t length = std::min(static_cast<size_t>(maxLen - 1), input.length());
+            input.resize(length);
+            mem.writeBlock(addr, reinterpret_cast<const unsigned char*>(input.c_str()), length + 1);
+            break;
+        }
+        case 9: // sbrk (allocate heap memory)
+        {
+            unsigned int bytes = regFile.get(REG_A0);
+            regFile.set(REG_V0, heapPtr);
+            heapPtr += bytes;
+            break;
+        }
+        case 10:
+        {
+            halted = true;
+            flushOutput();
+            break;
+        }
+        case 11: // print character
+        {
+            output.push_back(static_cast<char>(regFile.get(REG_A0)));
+            if (output.size() >= OUTPUT_BUFFER_SIZE) flushOutput();
+            break;
+        }
+        case 12: // read character
+        {
+            if (!inputPreloaded) flushOutput();
+            char ch = 0;
+            host.readChar(ch);
+            regFile.set(REG_V0, static_cast<unsigned int>(ch));
+            break;
+        }
+        case 13: // open file
+        case 14: // read from file
+        case 15: // write to file
+        case 16: // close file
+        {
+            executeFileSyscall(v0);
+            break;
+        }
+
+        // Extensions past the MARS numbers: the C library's block operations,
+        // done on whole page spans instead of a guest loop per byte
+        case 100: // memcpy $a0 = dst, $a1 = src, $a2 = bytes -> $v0 = dst
+        {
+            mem.copyBlock(regFile.get(REG_A0), regFile.get(REG_A1), regFile.get(REG_A2));
+            regFile.set(REG_V0, regFile.get(REG_A0));
+            break;
+        }
+        case 101: // memset $a0 = dst, $a1 = byte, $a2 = bytes -> $v0 = dst
+        {
+            mem.setBlock(regFile.get(REG_A0), static_cast<unsigned char>(regFile.get(REG_A1)), regFile.get(REG_A2));
+            regFile.set(REG_V0, regFile.get(REG_A0));
+            break;
+        }
+        case 102: // memcmp $a0, $a1, $a2 = bytes -> $v0 = -1, 0 or 1
+        {
+            int result = mem.compareBlock(regFile.get(REG_A0), regFile.get(REG_A1), regFile.get(REG_A2));
+            regFile.set(REG_V0, static_cast<unsigned int>(result < 0 ? -1 : result > 0 ? 1 : 0));
+            break;
+        }
+        case 103: // strlen $a0 -> $v0
+        {
+            regFile.set(REG_V0, static_cast<unsigned int>(mem.stringLength(regFile.get(REG_A0))));
+            break;
+        }
+        case 104: // malloc
+        case 105: // free
+        case 106: // realloc
+        {
+            executeHeapSyscall(v0);
+            break;
+        }
+        default:
+        {
+            warn("Unsupported syscall: " + std::to_string(v0));
+            break;
+        }
+    }
+}
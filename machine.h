@@ -0,0 +1,224 @@
+/*
+File: machine.h
+Author: Brysen Landis
+*/
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "guest_heap.h"
+#include "program.h"
+#include "register_file.h"
+#include "memory.h"
+
+class UndoLog;
+struct CallProfile;
+
+// Host side of the console syscalls. The read functions return false at the
+// end of input, leaving the value at 0.
+struct HostIO
+{
+    std::function<void(const char* text, size_t length)> write;
+    // Writes to descriptor 2, passed on at once
+    std::function<void(const char* text, size_t length)> writeError;
+    std::function<bool(int& value)> readInt;
+    std::function<bool(std::string& line)> readLine;
+    std::function<bool(char& ch)> readChar;
+    // Raw bytes for reads from descriptor 0; returns how many, 0 at the end
+    std::function<size_t(char* buffer, size_t length)> read;
+};
+
+// One execution of a shared Program: registers, PC, HI/LO, the heap break and
+// a copy-on-write view of the program's memory image. A Machine costs only
+// the pages it writes, so many can run one Program side by side.
+class Machine
+{
+public:
+    // Memory layout
+    static const unsigned int TEXT_BASE = 0x00400000;
+    static const unsigned int DATA_BASE = 0x10010000;
+    static const unsigned int HEAP_BASE = 0x10020000;
+    static const unsigned int STACK_BASE = 0x7ffffffc;
+
+    // Everything a run changes. Memory is held copy-on-write, so taking a
+    // snapshot copies no pages and restoring one costs only the pages
+    // written since.
+    struct Snapshot
+    {
+        RegisterFile regFile;
+        Memory mem;
+        unsigned int PC, HI, LO;
+        unsigned int heapPtr;
+        GuestHeap heap;
+        bool halted;
+        unsigned long long executedCount;
+    };
+
+    explicit Machine(std::shared_ptr<const Program> program);
+
+    // First sbrk address: HEAP_BASE, or the page after the data segment if
+    // that reaches past it
+    static unsigned int heapStart(const Program& program);
+
+    // Back to the program's entry point and initial memory image
+    void restart();
+
+    // Console syscalls use std::cin, std::cout and std::cerr unless set. Output is
+    // buffered and passed to the host when the buffer fills, before a read
+    // from a stream, at exit and when a run or step returns.
+    void setIO(const HostIO& io) { host = io; }
+    void setIO(std::istream& in, std::ostream& out);
+    void setInput(std::istream& in);
+    void setOutput(std::ostream& out);
+    void setErrorOutput(std::ostream& out);
+    void flushOutput();
+
+    // Reads come from text, parsed like a stream would be, so they never
+    // wait on a terminal
+    void setInput(std::string text);
+
+    // Files the program opens are taken relative to dir, which paths cannot
+    // leave; the current directory unless set
+    void setFileRoot(const std::string& dir) { fileRoot = dir; }
+
+    // Runs until the program exits or PC leaves the text segment. Returns
+    // true if it exited through syscall 10.
+    bool run();
+
+    // Executes one instruction, never stopping at a breakpoint; false once
+    // the machine cannot continue
+    bool step();
+
+    // Runs until PC reaches address, stopping before that instruction.
+    // Returns false if the program ended first.
+    bool runUntil(unsigned int address);
+
+    // Runs at most limit instructions; false once the program has ended
+    bool runFor(unsigned long long limit);
+
+    Snapshot snapshot() const;
+    void restore(const Snapshot& state);
+
+    // Debugger history (undo_log.cpp). runRecorded() runs at most limit
+    // instructions like runFor(), logging what each overwrites; stepBack()
+    // then undoes up to count of them and returns how many it undid. The
+    // reverse functions step back to just before the latest write to a
+    // register (32 for HI, 33 for LO) or to any byte of [addr, addr +
+    // length), returning false, at the oldest logged step, if there is none.
+    // A log is dropped and begun again if the machine ran without it.
+    bool runRecorded(UndoLog& log, unsigned long long limit);
+    unsigned long long stepBack(UndoLog& log, unsigned long long count);
+    bool reverseToRegisterWrite(UndoLog& log, unsigned int reg);
+    bool reverseToMemoryWrite(UndoLog& log, unsigned int addr, unsigned int length);
+
+    // Checkpoint files (checkpoint.cpp) hold the machine state, every
+    // resident memory page and the program's path and fingerprint. Pages
+    // are page-aligned in the file, so resuming maps them instead of
+    // reading them. Resuming needs the machine to be running the same
+    // program, which checkpointProgram() names; both return false with a
+    // message on std::cerr if the file is unusable.
+    bool saveCheckpoint(const std::string& path) const;
+    bool resumeCheckpoint(const std::string& path);
+    static bool checkpointProgram(const std::string& path, std::string& program);
+
+    bool isHalted() const { return halted; }
+    unsigned int getPC() const { return PC; }
+    unsigned int getRegister(int regNum) const { return regFile.get(regNum); }
+    void setRegister(int regNum, unsigned int value) { regFile.set(regNum, value); }
+    Memory& memory() { return mem; }
+    const Program& program() const { return *prog; }
+
+    // Allocator state and counters of the malloc syscalls
+    const GuestHeap& heapStats() const { return heap; }
+
+    // Instructions retired since the last restart, by every engine and
+    // debugger run. A fused copy loop counts every instruction of every
+    // iteration, and a superinstruction both of its own.
+    unsigned long long instructionsExecuted() const { return executedCount; }
+
+protected:
+    std::shared_ptr<const Program> prog;
+    RegisterFile regFile;
+    Memory mem;
+
+    unsigned int PC;
+    unsigned int HI, LO;
+    unsigned int heapPtr;       // next sbrk address
+    bool halted;
+    unsigned long long executedCount;
+    
+    // Set along with halted by an OP_BREAKPOINT or a watched write, which
+    // ends any run loop the way an exit does; the debugger clears both
+    // (breakpoints.cpp)
+    bool stopped;
+    HostIO host;
+
+    static const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+    std::string output;         // console output not yet passed to host.write
+    bool inputPreloaded;
+
+    // "Warning: message" on a line of the host's error output, after any
+    // console output so far
+    void warn(const std::string& message);
+
+    // Guest file descriptors 3 and up, with null for closed slots
+    // (file_syscalls.cpp). Closed on restart.
+    static const unsigned int FIRST_FILE = 3;
+    static const size_t MAX_FILES = 64;
+    std::string fileRoot;
+    std::vector<std::shared_ptr<std::FILE>> files;
+    void executeFileSyscall(unsigned int v0);
+    bool resolveGuestPath(const std::string& guestPath, std::string& hostPath) const;
+
+    // malloc, free and realloc (guest_heap.cpp). Reset on restart.
+    GuestHeap heap;
+    void executeHeapSyscall(unsigned int v0);
+    unsigned int heapAllocate(unsigned int bytes);
+    bool heapFree(unsigned int addr);
+    unsigned int heapBlockSize(unsigned int addr, const char* operation);
+    unsigned int heapTake(unsigned int bytes);
+    void pushFreeBlock(unsigned int block, unsigned int size);
+
+    void rewindTo(UndoLog& log, unsigned long long step);
+    void seek(UndoLog& log, unsigned long long step);
+    bool reverseToWrite(UndoLog& log, bool memory, unsigned int reg, unsigned int addr, unsigned int length);
+
+    // prog's code with an OP_BREAKPOINT over each breakpoint, for this
+    // machine alone (breakpoints.cpp). Copied from prog the first time one
+    // is set and patched in place after that; empty until then.
+    std::vector<DecodedInstruction> patchedCode;
+
+    // The code the debugger's run loops execute: patchedCode once there is
+    // one, else prog's
+    const DecodedInstruction* debugCode() const
+    {
+        return patchedCode.empty() ? prog->code.data() : patchedCode.data();
+    }
+
+    // The instruction in slot index, under any breakpoint patched over it
+    const DecodedInstruction& instructionAt(size_t index) const { return prog->code[index]; }
+    
+    void execute(const DecodedInstruction& d);
+    void executeCopyLoop(const CopyLoop& loop);
+    void executeSyscall();
+    void runSwitch();
+
+    // Runs like runSwitch(), a basic block at a time, counting each run
+    // through a block at its first slot and following calls and returns in
+    // profile's shadow call stack (profiler.cpp). Output is not flushed.
+    void runCounting(CallProfile& profile);
+
+    // Runs a basic block at a time like runCounting(), checking flag, which
+    // another thread may set, before each block. True once flag is found
+    // set, with PC at the block about to run; false once the program ends.
+    bool runUntilSet(const std::atomic<bool>& flag, const unsigned int* blockEnds);
+};
+
+#endif
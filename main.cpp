@@ -6,7 +6,51 @@ Author: Brysen Landis
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <streambuf>
 #include "interpreter.h"
+#include "mapped_file.h"
+#include "batch_runner.h"
+#include "fan_out.h"
+#include "trace.h"
+
+// Passes a stream's characters through, keeping every one that is read so
+// a second run can be given the same input
+class RecordingBuffer : public std::streambuf
+{
+public:
+    explicit RecordingBuffer(std::streambuf* source) : source(source) {}
+    const std::string& recorded() const { return text; }
+
+protected:
+    int_type underflow() override { return source->sgetc(); }
+    int_type uflow() override
+    {
+        int_type ch = source->sbumpc();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) text.push_back(traits_type::to_char_type(ch));
+        return ch;
+    }
+
+private:
+    std::streambuf* source;
+    std::string text;
+};
+
+// A thread count given on the command line: the whole argument as a number
+// from 0 (every hardware thread) to 1024, or -1 if it is anything else
+int parseThreadCount(const char* text)
+{
+    int count = -1;
+    const char* last = text + std::strlen(text);
+    auto result = std::from_chars(text, last, count);
+    if (result.ec != std::errc() || result.ptr != last || count > 1024) return -1;
+    return count;
+}
 
 void printHelp()
 {
@@ -26,7 +70,37 @@ void printHelp()
     std::cout << "  USAGE:\n";
     std::cout << "    ./a.out                 → Interactive mode\n";
     std::cout << "    ./a.out <file>          → Load and run program\n";
-    std::cout << "    ./a.out <file> -step    → Step through execution\n\n";
+    std::cout << "    ./a.out <file> -step    → Step through execution\n";
+    std::cout << "    ./a.out --batch <list>  → Run every job in a manifest concurrently\n";
+    std::cout << "    ./a.out <file> --fan-out <label> <inputs...>\n";
+    std::cout << "                            → Run to label once, then finish once per input file\n";
+    std::cout << "    ./a.out --resume <ckpt> → Continue a run from a checkpoint\n\n";
+    std::cout << "  OPTIONS:\n";
+    std::cout << "    --engine=switch         → Switch-dispatch engine (default)\n";
+    std::cout << "    --engine=threaded       → Direct-threaded engine\n";
+    std::cout << "    --engine=jit            → Compile hot blocks to native code\n";
+    std::cout << "    --no-jit                → Interpret only (with --engine=jit)\n";
+    std::cout << "    --jit-diff              → Check JIT registers against the interpreter\n";
+    std::cout << "    --no-fusion             → Disable superinstructions (threaded)\n";
+    std::cout << "    --fusion-stats          → Report superinstructions after a run\n";
+    std::cout << "    --copy-loops            → Run byte-copy loops as one block copy\n";
+    std::cout << "    --profile <file>        → Count instructions per address and label (switch engine)\n";
+    std::cout << "    --sample-profile <hz>   → Sample PC and callers instead of counting\n";
+    std::cout << "    --trace <file>          → Record every instruction to a binary trace\n";
+    std::cout << "    --read-trace <file>     → Print a trace as text instead of running\n";
+    std::cout << "    --trace-range <lo:hi>   → Only records whose PC or address is in range\n";
+    std::cout << "    --emit-cpp <out.cpp>    → Translate the program to C++ instead of running\n";
+    std::cout << "    --assemble <out>        → Save an ELF executable (or raw .bin) instead of running\n";
+    std::cout << "    --cache <dir>           → Reuse assembled programs (or set MIPS_CACHE_DIR)\n";
+    std::cout << "    --asm-threads <n>       → Threads for assembling large files (default: all)\n";
+    std::cout << "    --time-load             → Report assembler speed in lines/sec and exit\n";
+    std::cout << "    --stdin <file>          → Read syscall input from file, loaded up front\n";
+    std::cout << "    --stdout <file>         → Write program output to file\n";
+    std::cout << "    --preload-stdin         → Read all of standard input before running\n";
+    std::cout << "    --file-root <dir>       → Directory the program's files open in (default: .)\n";
+    std::cout << "    --checkpoint <file>     → Save the run to file periodically (switch engine)\n";
+    std::cout << "    --checkpoint-every <n>  → Instructions between checkpoints (default: 100000000)\n";
+    std::cout << "    --jobs <n>              → Worker threads for --batch and --fan-out (default: all)\n\n";
     std::cout << "Press Enter to start interactive mode...";
     std::cin.get();
 }
@@ -35,14 +109,321 @@ int main(int argc, char* argv[])
 {
     MIPSInterpreter interpreter;
     
-    if (argc == 1)
+    // Pull out --options so the positional arguments keep their meaning
+    std::vector<std::string> args;
+    bool fusionStats = false;
+    bool jitDiff = false;
+    std::string emitCppFile;
+    std::string assembleFile;
+    bool timeLoad = false;
+    std::string batchManifest;
+    unsigned int batchJobs = 0;
+    std::string fanOutLabel;
+    std::string checkpointFile;
+    unsigned long long checkpointEvery = 100000000;
+    std::string resumeFile;
+    std::string stdinFile;
+    std::string stdoutFile;
+    bool preloadStdin = false;
+    std::string readTraceFile;
+    unsigned int traceFrom = 1, traceTo = 0;
+    if (const char* cacheDir = std::getenv("MIPS_CACHE_DIR"))
+    {
+        interpreter.setCacheDir(cacheDir);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--engine=threaded")
+        {
+            interpreter.setEngine(MIPSInterpreter::ENGINE_THREADED);
+        }
+        else if (arg == "--engine=switch")
+        {
+            interpreter.setEngine(MIPSInterpreter::ENGINE_SWITCH);
+        }
+        else if (arg == "--engine=jit")
+        {
+            interpreter.setEngine(MIPSInterpreter::ENGINE_JIT);
+        }
+        else if (arg == "--no-jit")
+        {
+            interpreter.setJit(false);
+        }
+        else if (arg == "--jit-diff")
+        {
+            jitDiff = true;
+        }
+        else if (arg == "--no-fusion")
+        {
+            interpreter.setFusion(false);
+        }
+        else if (arg == "--fusion-stats")
+        {
+            fusionStats = true;
+        }
+        else if (arg == "--copy-loops")
+        {
+            interpreter.setCopyLoops(true);
+        }
+        else if (arg == "--profile")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --profile needs an output file" << std::endl;
+                return 1;
+            }
+            interpreter.setProfile(argv[++i]);
+        }
+        else if (arg == "--sample-profile")
+        {
+            int rate = i + 1 < argc ? std::atoi(argv[i + 1]) : 0;
+            if (rate <= 0 || rate > 100000)
+            {
+                std::cerr << "Error: --sample-profile needs a rate from 1 to 100000 Hz" << std::endl;
+                return 1;
+            }
+            interpreter.setSampleRate(static_cast<unsigned int>(rate));
+            i++;
+        }
+        else if (arg == "--trace")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --trace needs an output file" << std::endl;
+                return 1;
+            }
+            interpreter.setTrace(argv[++i]);
+        }
+        else if (arg == "--read-trace")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --read-trace needs a trace file" << std::endl;
+                return 1;
+            }
+            readTraceFile = argv[++i];
+        }
+        else if (arg == "--trace-range")
+        {
+            char* end = nullptr;
+            if (i + 1 < argc)
+            {
+                traceFrom = static_cast<unsigned int>(std::strtoul(argv[i + 1], &end, 0));
+                if (*end == ':') traceTo = static_cast<unsigned int>(std::strtoul(end + 1, &end, 0));
+            }
+            if (!end || *end != '\0' || traceFrom > traceTo)
+            {
+                std::cerr << "Error: --trace-range needs addresses lo:hi" << std::endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--emit-cpp")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --emit-cpp needs an output file" << std::endl;
+                return 1;
+            }
+            emitCppFile = argv[++i];
+        }
+        else if (arg == "--assemble")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --assemble needs an output file" << std::endl;
+                return 1;
+            }
+            assembleFile = argv[++i];
+        }
+        else if (arg == "--asm-threads")
+        {
+            int threads = i + 1 < argc ? parseThreadCount(argv[i + 1]) : -1;
+            if (threads < 0)
+            {
+                std::cerr << "Error: --asm-threads needs a count from 0 (all) to 1024" << std::endl;
+                return 1;
+            }
+            interpreter.setAssemblerThreads(static_cast<unsigned int>(threads));
+            i++;
+        }
+        else if (arg == "--batch")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --batch needs a manifest file" << std::endl;
+                return 1;
+            }
+            batchManifest = argv[++i];
+        }
+        else if (arg == "--fan-out")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --fan-out needs a label" << std::endl;
+                return 1;
+            }
+            fanOutLabel = argv[++i];
+        }
+        else if (arg == "--stdin")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --stdin needs a file" << std::endl;
+                return 1;
+            }
+            stdinFile = argv[++i];
+        }
+        else if (arg == "--stdout")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --stdout needs a file" << std::endl;
+                return 1;
+            }
+            stdoutFile = argv[++i];
+        }
+        else if (arg == "--preload-stdin")
+        {
+            preloadStdin = true;
+        }
+        else if (arg == "--file-root")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --file-root needs a directory" << std::endl;
+                return 1;
+            }
+            interpreter.setFileRoot(argv[++i]);
+        }
+        else if (arg == "--checkpoint")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --checkpoint needs a file" << std::endl;
+                return 1;
+            }
+            checkpointFile = argv[++i];
+        }
+        else if (arg == "--checkpoint-every")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --checkpoint-every needs a count" << std::endl;
+                return 1;
+            }
+            checkpointEvery = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--resume")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --resume needs a checkpoint file" << std::endl;
+                return 1;
+            }
+            resumeFile = argv[++i];
+        }
+        else if (arg == "--jobs")
+        {
+            int jobs = i + 1 < argc ? parseThreadCount(argv[i + 1]) : -1;
+            if (jobs < 0)
+            {
+                std::cerr << "Error: --jobs needs a count from 0 (all) to 1024" << std::endl;
+                return 1;
+            }
+            batchJobs = static_cast<unsigned int>(jobs);
+            i++;
+        }
+        else if (arg == "--time-load")
+        {
+            timeLoad = true;
+        }
+        else if (arg == "--cache")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: --cache needs a directory" << std::endl;
+                return 1;
+            }
+            interpreter.setCacheDir(argv[++i]);
+        }
+        else if (arg.compare(0, 9, "--engine=") == 0)
+        {
+            std::cerr << "Error: Unknown engine: " << arg.substr(9) << std::endl;
+            return 1;
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+    
+    if (!readTraceFile.empty())
+    {
+        return printTrace(readTraceFile, traceFrom, traceTo);
+    }
+    
+    if (!batchManifest.empty())
+    {
+        return runBatch(batchManifest, interpreter, batchJobs);
+    }
+    
+    // Program I/O; status messages and the register display stay on the console
+    std::ofstream outputFile;
+    if (!stdoutFile.empty())
+    {
+        outputFile.open(stdoutFile, std::ios::binary);
+        if (!outputFile.is_open())
+        {
+            std::cerr << "Error: Cannot write file " << stdoutFile << std::endl;
+            return 1;
+        }
+        interpreter.setOutput(outputFile);
+    }
+    std::string inputText;
+    if (!stdinFile.empty())
+    {
+        MappedFile input(stdinFile);
+        if (!input.isOpen())
+        {
+            std::cerr << "Error: Cannot open file " << stdinFile << std::endl;
+            return 1;
+        }
+        inputText.assign(reinterpret_cast<const char*>(input.data()), input.size());
+        interpreter.setInput(inputText);
+    }
+    else if (preloadStdin)
+    {
+        inputText.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        interpreter.setInput(inputText);
+    }
+    
+    if (!resumeFile.empty())
+    {
+        if (!interpreter.resume(resumeFile)) return 1;
+        if (!checkpointFile.empty())
+        {
+            interpreter.runCheckpointed(checkpointFile, checkpointEvery);
+        }
+        else
+        {
+            interpreter.run();
+        }
+        std::cout << "\n";
+        interpreter.displayState();
+        interpreter.displayHeapStats();
+        return 0;
+    }
+    
+    if (args.empty())
     {
         printHelp();
         interpreter.runInteractive();
     }
-    else if (argc >= 2)
+    else
     {
-        std::string filename = argv[1];
+        std::string filename = args[0];
         
         if (filename == "-h" || filename == "--help")
         {
@@ -50,9 +431,70 @@ int main(int argc, char* argv[])
             return 0;
         }
         
+        if (!fanOutLabel.empty())
+        {
+            std::vector<std::string> inputs(args.begin() + 1, args.end());
+            return runFanOut(filename, fanOutLabel, inputs, interpreter, batchJobs);
+        }
+        
+        if (jitDiff)
+        {
+            // Run once on the plain interpreter, then again with the JIT on
+            // the same input: what the first run read from standard input is
+            // recorded and replayed, so a terminal is only read once
+            MIPSInterpreter reference;
+            reference.copySettings(interpreter);
+            reference.setEngine(MIPSInterpreter::ENGINE_SWITCH);
+            reference.setJit(false);
+            RecordingBuffer recorder(std::cin.rdbuf());
+            std::istream recordedInput(&recorder);
+            bool replay = stdinFile.empty() && !preloadStdin;
+            if (replay)
+            {
+                reference.setInput(recordedInput);
+            }
+            else
+            {
+                reference.setInput(inputText);
+            }
+            reference.loadFile(filename);
+            reference.run();
+            
+            if (replay) interpreter.setInput(recorder.recorded());
+            interpreter.setEngine(MIPSInterpreter::ENGINE_JIT);
+            interpreter.loadFile(filename);
+            interpreter.run();
+            
+            bool same = interpreter.compareState(reference);
+            std::cout << "\nJIT compiled " << interpreter.jitCompiledBlocks() << " blocks: "
+                      << (same ? "state matches interpreter" : "STATE MISMATCH") << "\n";
+            return same ? 0 : 1;
+        }
+        
+        if (timeLoad)
+        {
+            auto start = std::chrono::steady_clock::now();
+            interpreter.loadFile(filename);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            size_t lines = interpreter.sourceLinesRead();
+            std::cout << "Assembled " << lines << " lines in " << static_cast<long>(seconds * 1000) << " ms ("
+                      << static_cast<long>(seconds > 0 ? lines / seconds : 0) << " lines/sec)\n";
+            return 0;
+        }
+        
         interpreter.loadFile(filename);
         
-        if (argc > 2 && std::string(argv[2]) == "-step")
+        if (!emitCppFile.empty())
+        {
+            return interpreter.emitCpp(emitCppFile) ? 0 : 1;
+        }
+        
+        if (!assembleFile.empty())
+        {
+            return interpreter.saveBinary(assembleFile) ? 0 : 1;
+        }
+        
+        if (args.size() > 1 && args[1] == "-step")
         {
             std::cout << "\033[2J\033[H";
             std::cout << "╔════════════════════════════════════════════════════════════════════════════════════════════════════╗\n";
@@ -68,39 +510,84 @@ int main(int argc, char* argv[])
             std::cout << "║                                                                                                    ║\n";
             std::cout << "╚════════════════════════════════════════════════════════════════════════════════════════════════════╝\n\n";
             
+            interpreter.setHistory(true);
             interpreter.displayState();
-            std::cout << "\nPress Enter=next, r=regs, q=quit\n";
-            std::string input;
+            const char* help = "\nPress Enter=next, r=regs, c=continue, s <n>=step n, u <label|addr>=until, finish, q=quit\n"
+                               "back [n], rc <reg|addr[,len]>=reverse-continue, break <label|addr> [if <cond>], break if <cond>,\n"
+                               "watch <addr>[,len], delete [n], breaks\n";
+            std::cout << help;
+            std::string input, reply;
+            
+            auto redraw = [&](const std::string& note)
+            {
+                std::cout << "\033[2J\033[H";
+                std::cout << "╔════════════════════════════════════════════════════════════════════════════════════════════════════╗\n";
+                std::cout << "║                                       STEP MODE                                                    ║\n";
+                std::cout << "╚════════════════════════════════════════════════════════════════════════════════════════════════════╝\n\n";
+                interpreter.displayState();
+                if (!note.empty()) std::cout << "\n" << note << "\n";
+                std::cout << help;
+            };
             
             while (true)
             {
                 std::cout << "\n> ";
-                std::getline(std::cin, input);
+                if (!std::getline(std::cin, input)) break;
+                std::istringstream words(input);
+                std::string command, operand;
+                words >> command >> operand;
                 
-                if (input == "q" || input == "quit") break;
-                if (input == "r" || input == "regs") {
-                    std::cout << "\033[2J\033[H";
-                    std::cout << "╔════════════════════════════════════════════════════════════════════════════════════════════════════╗\n";
-                    std::cout << "║                                       STEP MODE                                                    ║\n";
-                    std::cout << "╚════════════════════════════════════════════════════════════════════════════════════════════════════╝\n\n";
-                    interpreter.displayState();
-                    std::cout << "\nPress Enter=next, r=regs, q=quit\n";
-                } else {
+                if (command == "q" || command == "quit") break;
+                if (command == "r" || command == "regs")
+                {
+                    redraw("");
+                }
+                else if (command == "back")
+                {
+                    unsigned long long count = operand.empty() ? 1 : std::strtoull(operand.c_str(), nullptr, 10);
+                    unsigned long long undone = interpreter.stepBack(count);
+                    std::string note = "Stepped back " + std::to_string(undone) + " instruction" + (undone == 1 ? "" : "s");
+                    if (undone < count) note += " (start of history)";
+                    redraw(note);
+                }
+                else if (command == "reverse-continue" || command == "rc")
+                {
+                    if (operand.empty())
+                    {
+                        redraw("reverse-continue needs a register or address");
+                    }
+                    else
+                    {
+                        bool found = interpreter.reverseContinue(operand);
+                        redraw(found ? "Stopped before the last write to " + operand
+                                     : "No earlier write to " + operand + " in history");
+                    }
+                }
+                else if (interpreter.runCommand(input, reply) || interpreter.breakpointCommand(input, reply))
+                {
+                    redraw(reply);
+                }
+                else
+                {
                     interpreter.step();
-                    std::cout << "\033[2J\033[H";
-                    std::cout << "╔════════════════════════════════════════════════════════════════════════════════════════════════════╗\n";
-                    std::cout << "║                                       STEP MODE                                                    ║\n";
-                    std::cout << "╚════════════════════════════════════════════════════════════════════════════════════════════════════╝\n\n";
-                    interpreter.displayState();
-                    std::cout << "\nPress Enter=next, r=regs, q=quit\n";
+                    redraw("");
                 }
             }
         }
         else
         {
-            interpreter.run();
+            if (!checkpointFile.empty())
+            {
+                interpreter.runCheckpointed(checkpointFile, checkpointEvery);
+            }
+            else
+            {
+                interpreter.run();
+            }
             std::cout << "\n";
             interpreter.displayState();
+            interpreter.displayHeapStats();
+            if (fusionStats) interpreter.displayFusionStats();
         }
     }
     
@@ -0,0 +1,88 @@
+/*
+File: mapped_file.cpp
+Author: Brysen Landis
+*/
+
+#include "mapped_file.h"
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define MAPPED_FILE_MMAP 0
+#endif
+
+MappedFile::MappedFile(const std::string& path, bool privateWrites)
+    : bytes(nullptr), length(0), opened(false), mapped(false)
+{
+#if MAPPED_FILE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return;
+    }
+    opened = true;
+    if (!S_ISREG(info.st_mode) || info.st_size == 0)
+    {
+        // Pipes, terminals and files like those in /proc report no size,
+        // or not the one they have, so they are read to the end instead
+        unsigned char chunk[65536];
+        ssize_t got;
+        while ((got = ::read(fd, chunk, sizeof(chunk))) > 0) buffer.insert(buffer.end(), chunk, chunk + got);
+        if (got < 0) opened = false;
+        bytes = buffer.data();
+        length = buffer.size();
+    }
+    else
+    {
+        length = static_cast<size_t>(info.st_size);
+        int protection = privateWrites ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* view = ::mmap(nullptr, length, protection, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            bytes = static_cast<unsigned char*>(view);
+            mapped = true;
+        }
+        else
+        {
+            opened = false;
+        }
+    }
+    ::close(fd);
+#else
+    (void)privateWrites; // the buffer is always private
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return;
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    bytes = buffer.data();
+    length = buffer.size();
+    opened = true;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if MAPPED_FILE_MMAP
+    if (mapped) ::munmap(bytes, length);
+#endif
+}
+
+unsigned long long hashBytes(const unsigned char* data, size_t length)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,42 @@
+/*
+File: mapped_file.h
+Author: Brysen Landis
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// View of a whole file. A regular file is memory-mapped where the platform
+// supports it; anything else, such as a pipe or /dev/stdin, is read to its
+// end into a buffer. A private view can be written to, but the writes never
+// reach the file.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path, bool privateWrites = false);
+    ~MappedFile();
+
+    bool isOpen() const { return opened; }
+    const unsigned char* data() const { return bytes; }
+    unsigned char* privateData() { return bytes; } // only with privateWrites
+    size_t size() const { return length; }
+
+private:
+    unsigned char* bytes;
+    size_t length;
+    bool opened;
+    bool mapped;
+    std::vector<unsigned char> buffer;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// FNV-1a, 64-bit
+unsigned long long hashBytes(const unsigned char* data, size_t length);
+
+#endif
@@ -1,61 +1,296 @@
 #include "memory.h"
 #include <iomanip>
+#include <algorithm>
 
-unsigned char Memory::fetch(unsigned int addr)
+Memory::Memory()
+    : pageCount(0), lastPageNum(NO_PAGE), lastPage(nullptr), writePageNum(NO_PAGE), writePage(nullptr)
 {
-    if (mem.find(addr) != mem.end())
+}
+
+Memory::Memory(const Memory& other)
+    : directory(other.directory), pageCount(other.pageCount), lastPageNum(NO_PAGE), lastPage(nullptr),
+      writePageNum(NO_PAGE), writePage(nullptr)
+{
+    // Only touched when set, so copying a Memory nobody writes stays read-only
+    if (other.writePage)
     {
-        return mem[addr];
+        other.writePageNum = NO_PAGE;
+        other.writePage = nullptr;
     }
-    return 0; // Uninitialized memory returns 0
 }
 
-void Memory::store(unsigned int addr, unsigned char value)
+Memory& Memory::operator=(const Memory& other)
 {
-    mem[addr] = value;
+    if (this != &other)
+    {
+        directory = other.directory;
+        pageCount = other.pageCount;
+        lastPageNum = writePageNum = NO_PAGE;
+        lastPage = writePage = nullptr;
+        if (other.writePage)
+        {
+            other.writePageNum = NO_PAGE;
+            other.writePage = nullptr;
+        }
+    }
+    return *this;
 }
 
-unsigned short Memory::fetchHalfword(unsigned int addr)
+unsigned char* Memory::lookupPage(unsigned int pageNum)
 {
-    // MIPS is big-endian, but we'll use little-endian for simplicity
-    unsigned short result = 0;
-    result = fetch(addr) | (fetch(addr + 1) << 8);
-    return result;
+    if (!directory) return nullptr;
+    const std::shared_ptr<PageTable>& table = directory->tables[pageNum >> TABLE_BITS];
+    if (!table) return nullptr;
+    const std::shared_ptr<Page>& page = table->pages[pageNum & (TABLE_SIZE - 1)];
+    if (!page) return nullptr;
+
+    lastPageNum = pageNum;
+    lastPage = page->bytes;
+    return lastPage;
 }
 
-void Memory::storeHalfword(unsigned int addr, unsigned short value)
+std::shared_ptr<Memory::Page>& Memory::pageSlot(unsigned int pageNum)
 {
-    store(addr, static_cast<unsigned char>(value & 0xFF));
-    store(addr + 1, static_cast<unsigned char>((value >> 8) & 0xFF));
+    // Unshare each level on the way down, so the slot belongs to this
+    // Memory alone
+    if (!directory)
+    {
+        directory = std::make_shared<Directory>();
+    }
+    else if (directory.use_count() > 1)
+    {
+        directory = std::make_shared<Directory>(*directory);
+    }
+
+    std::shared_ptr<PageTable>& table = directory->tables[pageNum >> TABLE_BITS];
+    if (!table)
+    {
+        table = std::make_shared<PageTable>();
+    }
+    else if (table.use_count() > 1)
+    {
+        table = std::make_shared<PageTable>(*table);
+    }
+    return table->pages[pageNum & (TABLE_SIZE - 1)];
 }
 
-unsigned int Memory::fetchWord(unsigned int addr)
+unsigned char* Memory::writablePage(unsigned int addr, size_t length)
 {
-    unsigned int result = 0;
-    result = fetch(addr) | 
-            (fetch(addr + 1) << 8) | 
-            (fetch(addr + 2) << 16) | 
-            (fetch(addr + 3) << 24);
-    return result;
+    const unsigned int pageNum = addr >> PAGE_BITS;
+    const unsigned long long first = static_cast<unsigned long long>(pageNum) << PAGE_BITS;
+    const unsigned long long end = static_cast<unsigned long long>(addr) + length;
+    bool watched = false, reported = false;
+    for (const Watch& w : watches)
+    {
+        const unsigned long long last = static_cast<unsigned long long>(w.addr) + w.length;
+        if (w.addr >= first + PAGE_SIZE || last <= first) continue;
+        watched = true;
+        if (!reported && watchHook && w.addr < end && addr < last)
+        {
+            reported = true;
+            watchHook(std::max(addr, w.addr));
+        }
+    }
+
+    std::shared_ptr<Page>& page = pageSlot(pageNum);
+    if (!page)
+    {
+        page = std::make_shared<Page>(); // value-initialized, so fresh pages read as 0
+        pageCount++;
+    }
+    else if (page.use_count() > 1)
+    {
+        page = std::make_shared<Page>(*page);
+    }
+
+    lastPageNum = pageNum;
+    lastPage = page->bytes;
+    if (!watched)
+    {
+        writePageNum = pageNum;
+        writePage = page->bytes;
+    }
+    return page->bytes;
+}
+
+void Memory::watch(unsigned int addr, unsigned int length)
+{
+    watches.push_back({addr, length});
+    writePageNum = NO_PAGE;
+    writePage = nullptr;
 }
 
-void Memory::storeWord(unsigned int addr, unsigned int value)
+void Memory::clearWatches()
 {
-    store(addr, static_cast<unsigned char>(value & 0xFF));
-    store(addr + 1, static_cast<unsigned char>((value >> 8) & 0xFF));
-    store(addr + 2, static_cast<unsigned char>((value >> 16) & 0xFF));
-    store(addr + 3, static_cast<unsigned char>((value >> 24) & 0xFF));
+    watches.clear();
+}
+
+void Memory::attachPage(unsigned int pageNum, std::shared_ptr<void> owner, unsigned char* bytes)
+{
+    std::shared_ptr<Page>& page = pageSlot(pageNum);
+    if (!page) pageCount++;
+    page = std::shared_ptr<Page>(std::move(owner), reinterpret_cast<Page*>(bytes));
+
+    lastPageNum = writePageNum = NO_PAGE;
+    lastPage = writePage = nullptr;
+}
+
+void Memory::readBlock(unsigned int addr, unsigned char* out, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = std::min<size_t>(length, PAGE_SIZE - (addr & PAGE_MASK));
+        const unsigned char* page = findPage(addr);
+        if (page)
+        {
+            std::memcpy(out, page + (addr & PAGE_MASK), chunk);
+        }
+        else
+        {
+            std::memset(out, 0, chunk);
+        }
+        addr += static_cast<unsigned int>(chunk);
+        out += chunk;
+        length -= chunk;
+    }
+}
+
+void Memory::writeBlock(unsigned int addr, const unsigned char* data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = std::min<size_t>(length, PAGE_SIZE - (addr & PAGE_MASK));
+        std::memcpy(touchPage(addr, chunk) + (addr & PAGE_MASK), data, chunk);
+        addr += static_cast<unsigned int>(chunk);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void Memory::appendString(unsigned int addr, std::string& out)
+{
+    while (true)
+    {
+        const unsigned char* page = findPage(addr);
+        if (!page) return; // unallocated memory reads as 0
+        const char* start = reinterpret_cast<const char*>(page + (addr & PAGE_MASK));
+        size_t available = PAGE_SIZE - (addr & PAGE_MASK);
+        const void* end = std::memchr(start, 0, available);
+        if (end)
+        {
+            out.append(start, static_cast<const char*>(end) - start);
+            return;
+        }
+        out.append(start, available);
+        addr += static_cast<unsigned int>(available);
+    }
+}
+
+void Memory::copyBlock(unsigned int dst, unsigned int src, size_t length)
+{
+    if (dst == src || length == 0) return;
+
+    // Copy one span lying within a single page on each side
+    auto copySpan = [this](unsigned int to, unsigned int from, size_t chunk)
+    {
+        const unsigned char* source = findPage(from);
+        if (!source && !findPage(to)) return; // zeros over zeros
+        unsigned char* target = touchPage(to, chunk) + (to & PAGE_MASK);
+        source = findPage(from); // the write may have unshared the source page
+        if (source)
+        {
+            std::memmove(target, source + (from & PAGE_MASK), chunk);
+        }
+        else
+        {
+            std::memset(target, 0, chunk);
+        }
+    };
+
+    if (dst - src >= length)
+    {
+        while (length > 0)
+        {
+            size_t chunk = std::min<size_t>({ length, PAGE_SIZE - (src & PAGE_MASK), PAGE_SIZE - (dst & PAGE_MASK) });
+            copySpan(dst, src, chunk);
+            dst += static_cast<unsigned int>(chunk);
+            src += static_cast<unsigned int>(chunk);
+            length -= chunk;
+        }
+    }
+    else
+    {
+        // The destination starts inside the source, so copy from the end
+        // down and read every byte before it is overwritten
+        unsigned int dstEnd = dst + static_cast<unsigned int>(length);
+        unsigned int srcEnd = src + static_cast<unsigned int>(length);
+        while (length > 0)
+        {
+            size_t chunk = std::min<size_t>({ length, ((srcEnd - 1) & PAGE_MASK) + 1, ((dstEnd - 1) & PAGE_MASK) + 1 });
+            dstEnd -= static_cast<unsigned int>(chunk);
+            srcEnd -= static_cast<unsigned int>(chunk);
+            copySpan(dstEnd, srcEnd, chunk);
+            length -= chunk;
+        }
+    }
+}
+
+void Memory::setBlock(unsigned int addr, unsigned char value, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = std::min<size_t>(length, PAGE_SIZE - (addr & PAGE_MASK));
+        if (value != 0 || findPage(addr))
+        {
+            std::memset(touchPage(addr, chunk) + (addr & PAGE_MASK), value, chunk);
+        }
+        addr += static_cast<unsigned int>(chunk);
+        length -= chunk;
+    }
+}
+
+int Memory::compareBlock(unsigned int a, unsigned int b, size_t length)
+{
+    static const unsigned char zeros[PAGE_SIZE] = {};
+    while (length > 0)
+    {
+        size_t chunk = std::min<size_t>({ length, PAGE_SIZE - (a & PAGE_MASK), PAGE_SIZE - (b & PAGE_MASK) });
+        const unsigned char* pageA = findPage(a);
+        const unsigned char* pageB = findPage(b);
+        int result = std::memcmp(pageA ? pageA + (a & PAGE_MASK) : zeros,
+                                 pageB ? pageB + (b & PAGE_MASK) : zeros, chunk);
+        if (result != 0) return result;
+        a += static_cast<unsigned int>(chunk);
+        b += static_cast<unsigned int>(chunk);
+        length -= chunk;
+    }
+    return 0;
+}
+
+size_t Memory::stringLength(unsigned int addr)
+{
+    size_t length = 0;
+    while (true)
+    {
+        const unsigned char* page = findPage(addr);
+        if (!page) return length; // unallocated memory reads as 0
+        size_t available = PAGE_SIZE - (addr & PAGE_MASK);
+        const void* end = std::memchr(page + (addr & PAGE_MASK), 0, available);
+        if (end) return length + (static_cast<const unsigned char*>(end) - (page + (addr & PAGE_MASK)));
+        length += available;
+        addr += static_cast<unsigned int>(available);
+    }
 }
 
 void Memory::displayMemoryRange(unsigned int start, unsigned int end)
 {
     std::cout << "\n=== Memory [0x" << std::hex << start << " - 0x" << end << "] ===" << std::endl;
-    
+
     for (unsigned int addr = start; addr <= end; addr += 4)
     {
         unsigned int word = fetchWord(addr);
-        std::cout << "0x" << std::hex << std::setw(8) << std::setfill('0') << addr 
-                  << ": 0x" << std::setw(8) << std::setfill('0') << word 
+        std::cout << "0x" << std::hex << std::setw(8) << std::setfill('0') << addr
+                  << ": 0x" << std::setw(8) << std::setfill('0') << word
                   << " (" << std::dec << static_cast<int>(word) << ")" << std::endl;
     }
 }
@@ -1,31 +1,272 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
-#include <map>
+#include <algorithm>
+#include <memory>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <vector>
 
+// Guest memory is a two-level page table of 4 KiB pages allocated on first
+// write. Reads of untouched memory return 0 without allocating anything.
+//
+// Copies are copy-on-write: a copy shares the page tables and pages of the
+// original, and whichever side writes to a shared page first gets its own.
+// Copying a Memory no other thread is writing is safe from any thread.
 class Memory
 {
 public:
-    Memory() {}
-    
+    static const unsigned int PAGE_BITS = 12;
+    static const unsigned int PAGE_SIZE = 1u << PAGE_BITS;
+    static const unsigned int PAGE_MASK = PAGE_SIZE - 1;
+
+    Memory();
+    Memory(const Memory& other);
+    Memory& operator=(const Memory& other);
+
     // Byte operations
     unsigned char fetch(unsigned int addr);
     void store(unsigned int addr, unsigned char value);
-    
+
     // Halfword operations (16-bit)
     unsigned short fetchHalfword(unsigned int addr);
     void storeHalfword(unsigned int addr, unsigned short value);
-    
+
     // Word operations (32-bit)
     unsigned int fetchWord(unsigned int addr);
     void storeWord(unsigned int addr, unsigned int value);
+
+    // Bulk copies, a page at a time
+    void readBlock(unsigned int addr, unsigned char* out, size_t length);
+    void writeBlock(unsigned int addr, const unsigned char* data, size_t length);
+
+    // Appends the NUL-terminated string at addr to out
+    void appendString(unsigned int addr, std::string& out);
+
+    // C library operations on guest memory, run a page span at a time with
+    // the host's memmove, memset, memcmp and memchr. copyBlock allows the
+    // ranges to overlap; setBlock leaves unallocated pages alone when
+    // clearing; compareBlock returns <0, 0 or >0 like memcmp.
+    void copyBlock(unsigned int dst, unsigned int src, size_t length);
+    void setBlock(unsigned int addr, unsigned char value, size_t length);
+    int compareBlock(unsigned int a, unsigned int b, size_t length);
+    size_t stringLength(unsigned int addr);
+
+    // Hand [addr, addr + length) to visit(bytes, length) a page at a time,
+    // as writable page memory for fillBlock and readable memory (zeros for
+    // unallocated pages) for drainBlock, so a host read or write can use
+    // guest pages directly. Both stop early when visit takes fewer bytes
+    // than it was given, and return the bytes taken.
+    template <typename Visit>
+    size_t fillBlock(unsigned int addr, size_t length, Visit visit);
+    template <typename Visit>
+    size_t drainBlock(unsigned int addr, size_t length, Visit visit);
     
     void displayMemoryRange(unsigned int start, unsigned int end);
-    
+
+    size_t residentPages() const { return pageCount; }
+
+    // Calls visit(pageNum, bytes) for every allocated page, in address order
+    template <typename Visit>
+    void forEachPage(Visit visit) const;
+
+    // Installs PAGE_SIZE bytes kept alive by owner as the page at pageNum.
+    // They are written in place once no other Memory shares them, so they
+    // must be writable.
+    void attachPage(unsigned int pageNum, std::shared_ptr<void> owner, unsigned char* bytes);
+
+    // Watchpoints: a write reaching a watched byte calls the watch hook with
+    // its address before writing. Pages holding watched bytes are kept out of
+    // the write cache, so only writes to those pages are checked. Watches
+    // and the hook belong to this Memory object, not its contents: copies
+    // start without them, and assigning another Memory keeps them.
+    void watch(unsigned int addr, unsigned int length);
+    void clearWatches();
+    void setWatchHook(std::function<void(unsigned int addr)> hook) { watchHook = std::move(hook); }
+
 private:
-    std::map<unsigned int, unsigned char> mem;
+    static const unsigned int TABLE_BITS = 10;
+    static const unsigned int TABLE_SIZE = 1u << TABLE_BITS;
+    static const unsigned int NO_PAGE = 0xFFFFFFFF;
+
+    struct Page
+    {
+        unsigned char bytes[PAGE_SIZE];
+    };
+
+    struct PageTable
+    {
+        std::shared_ptr<Page> pages[TABLE_SIZE];
+    };
+
+    struct Directory
+    {
+        std::shared_ptr<PageTable> tables[TABLE_SIZE];
+    };
+
+    std::shared_ptr<Directory> directory; // null until the first write
+    size_t pageCount;
+
+    // One-entry caches of the most recently read page and the most recently
+    // written one. The write cache only ever holds a page this Memory owns
+    // alone, so copying clears it on both sides.
+    unsigned int lastPageNum;
+    unsigned char* lastPage;
+    mutable unsigned int writePageNum;
+    mutable unsigned char* writePage;
+
+    struct Watch
+    {
+        unsigned int addr;
+        unsigned int length;
+    };
+    std::vector<Watch> watches;
+    std::function<void(unsigned int addr)> watchHook;
+
+    // touchPage() returns the page holding addr for a write of length bytes
+    unsigned char* findPage(unsigned int addr);
+    unsigned char* touchPage(unsigned int addr, size_t length);
+    unsigned char* lookupPage(unsigned int pageNum);
+    std::shared_ptr<Page>& pageSlot(unsigned int pageNum);
+    unsigned char* writablePage(unsigned int addr, size_t length);
 };
 
+template <typename Visit>
+void Memory::forEachPage(Visit visit) const
+{
+    if (!directory) return;
+    for (unsigned int t = 0; t < TABLE_SIZE; t++)
+    {
+        const std::shared_ptr<PageTable>& table = directory->tables[t];
+        if (!table) continue;
+        for (unsigned int p = 0; p < TABLE_SIZE; p++)
+        {
+            if (table->pages[p]) visit((t << TABLE_BITS) | p, static_cast<const unsigned char*>(table->pages[p]->bytes));
+        }
+    }
+}
+
+template <typename Visit>
+size_t Memory::fillBlock(unsigned int addr, size_t length, Visit visit)
+{
+    size_t total = 0;
+    while (total < length)
+    {
+        size_t chunk = std::min<size_t>(length - total, PAGE_SIZE - (addr & PAGE_MASK));
+        size_t taken = visit(touchPage(addr, chunk) + (addr & PAGE_MASK), chunk);
+        total += taken;
+        if (taken < chunk) break;
+        addr += static_cast<unsigned int>(chunk);
+    }
+    return total;
+}
+
+template <typename Visit>
+size_t Memory::drainBlock(unsigned int addr, size_t length, Visit visit)
+{
+    static const unsigned char zeros[PAGE_SIZE] = {};
+    size_t total = 0;
+    while (total < length)
+    {
+        size_t chunk = std::min<size_t>(length - total, PAGE_SIZE - (addr & PAGE_MASK));
+        const unsigned char* page = findPage(addr);
+        size_t taken = visit(page ? page + (addr & PAGE_MASK) : zeros, chunk);
+        total += taken;
+        if (taken < chunk) break;
+        addr += static_cast<unsigned int>(chunk);
+    }
+    return total;
+}
+
+inline unsigned char* Memory::findPage(unsigned int addr)
+{
+    unsigned int pageNum = addr >> PAGE_BITS;
+    if (pageNum == lastPageNum) return lastPage;
+    return lookupPage(pageNum);
+}
+
+inline unsigned char* Memory::touchPage(unsigned int addr, size_t length)
+{
+    unsigned int pageNum = addr >> PAGE_BITS;
+    if (pageNum == writePageNum) return writePage;
+    return writablePage(addr, length);
+}
+
+inline unsigned char Memory::fetch(unsigned int addr)
+{
+    const unsigned char* page = findPage(addr);
+    return page ? page[addr & PAGE_MASK] : 0; // Uninitialized memory returns 0
+}
+
+inline void Memory::store(unsigned int addr, unsigned char value)
+{
+    touchPage(addr, 1)[addr & PAGE_MASK] = value;
+}
+
+// Guest words are little-endian; aligned accesses never cross a page, so they
+// copy straight out of the page on a little-endian host
+inline unsigned short Memory::fetchHalfword(unsigned int addr)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if ((addr & 1) == 0)
+    {
+        const unsigned char* page = findPage(addr);
+        if (!page) return 0;
+        unsigned short value;
+        std::memcpy(&value, page + (addr & PAGE_MASK), sizeof(value));
+        return value;
+    }
+#endif
+    return fetch(addr) | (fetch(addr + 1) << 8);
+}
+
+inline void Memory::storeHalfword(unsigned int addr, unsigned short value)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if ((addr & 1) == 0)
+    {
+        std::memcpy(touchPage(addr, sizeof(value)) + (addr & PAGE_MASK), &value, sizeof(value));
+        return;
+    }
+#endif
+    store(addr, static_cast<unsigned char>(value & 0xFF));
+    store(addr + 1, static_cast<unsigned char>((value >> 8) & 0xFF));
+}
+
+inline unsigned int Memory::fetchWord(unsigned int addr)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if ((addr & 3) == 0)
+    {
+        const unsigned char* page = findPage(addr);
+        if (!page) return 0;
+        unsigned int value;
+        std::memcpy(&value, page + (addr & PAGE_MASK), sizeof(value));
+        return value;
+    }
+#endif
+    return fetch(addr) |
+          (fetch(addr + 1) << 8) |
+          (fetch(addr + 2) << 16) |
+          (static_cast<unsigned int>(fetch(addr + 3)) << 24);
+}
+
+inline void Memory::storeWord(unsigned int addr, unsigned int value)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if ((addr & 3) == 0)
+    {
+        std::memcpy(touchPage(addr, sizeof(value)) + (addr & PAGE_MASK), &value, sizeof(value));
+        return;
+    }
+#endif
+    store(addr, static_cast<unsigned char>(value & 0xFF));
+    store(addr + 1, static_cast<unsigned char>((value >> 8) & 0xFF));
+    store(addr + 2, static_cast<unsigned char>((value >> 16) & 0xFF));
+    store(addr + 3, static_cast<unsigned char>((value >> 24) & 0xFF));
+}
+
 #endif
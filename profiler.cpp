@@ -0,0 +1,544 @@
+/*
+File: profiler.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+#include "profiler.h"
+#include "encoding.h"
+#include "basic_blocks.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// --profile runs the switch engine a basic block at a time, counting runs
+// through each block in a flat array indexed by instruction slot; summing
+// along each block afterwards gives the count of every instruction.
+// Everything per label and per opcode is summed from those counters when the
+// report is written, so the only other work during the run is following
+// jal/jalr and jr $ra, in the same loop, to keep a shadow call stack for the
+// folded output. A call made again from the stack it was last made from, as
+// in any loop, takes one comparison against a per-slot cache.
+
+LabelRegions::LabelRegions(const Program& program, unsigned int textBase)
+    : textBase(textBase)
+{
+    const unsigned int textEnd = textBase + static_cast<unsigned int>(program.code.size() * 4);
+    std::vector<std::pair<unsigned int, std::string>> text;
+    for (const auto& label : program.labels)
+    {
+        if (label.second >= textBase && label.second < textEnd) text.emplace_back(label.second, label.first);
+    }
+    std::stable_sort(text.begin(), text.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // Code ahead of the first label gets a region of its own
+    if (!program.code.empty() && (text.empty() || text.front().first != textBase))
+    {
+        starts.push_back(textBase);
+        names.push_back("(text)");
+    }
+    for (const auto& label : text)
+    {
+        if (!starts.empty() && starts.back() == label.first) continue; // one name per address
+        starts.push_back(label.first);
+        names.push_back(label.second);
+    }
+
+    slotRegion.resize(program.code.size());
+    unsigned int region = 0;
+    for (size_t slot = 0; slot < slotRegion.size(); slot++)
+    {
+        unsigned int addr = textBase + static_cast<unsigned int>(slot * 4);
+        while (region + 1 < starts.size() && starts[region + 1] <= addr) region++;
+        slotRegion[slot] = region;
+    }
+}
+
+unsigned int LabelRegions::regionOf(unsigned int addr) const
+{
+    if ((addr & 3) != 0 || addr < textBase) return NONE;
+    return regionOfSlot((addr - textBase) >> 2);
+}
+
+namespace
+{
+    bool isLoad(Opcode op)
+    {
+        return op == OP_LW || op == OP_LH || op == OP_LHU || op == OP_LB || op == OP_LBU;
+    }
+
+    bool isStore(Opcode op)
+    {
+        return op == OP_SW || op == OP_SH || op == OP_SB;
+    }
+
+    std::string percent(unsigned long long part, unsigned long long total)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << (total ? 100.0 * part / total : 0.0) << "%";
+        return out.str();
+    }
+
+    void writeReport(std::ostream& out, const Program& program, unsigned int textBase, const LabelRegions& regions,
+                     const std::vector<unsigned long long>& counts, const std::vector<unsigned long long>& calls)
+    {
+        struct RegionTotals
+        {
+            unsigned long long instructions = 0, loads = 0, stores = 0;
+        };
+        std::vector<RegionTotals> byRegion(regions.size());
+        std::vector<unsigned long long> byOpcode(OP_COUNT, 0);
+        unsigned long long total = 0;
+        for (size_t slot = 0; slot < counts.size(); slot++)
+        {
+            if (counts[slot] == 0) continue;
+            Opcode op = program.code[slot].op;
+            RegionTotals& region = byRegion[regions.regionOfSlot(slot)];
+            region.instructions += counts[slot];
+            if (isLoad(op)) region.loads += counts[slot];
+            if (isStore(op)) region.stores += counts[slot];
+            byOpcode[op] += counts[slot];
+            total += counts[slot];
+        }
+
+        out << "Profile of " << (program.source.empty() ? "program" : program.source) << ": "
+            << total << " instructions\n\n";
+
+        std::vector<unsigned int> order(regions.size());
+        for (unsigned int r = 0; r < order.size(); r++) order[r] = r;
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+        {
+            return byRegion[a].instructions > byRegion[b].instructions;
+        });
+        out << "By label\n" << std::setw(16) << "instructions" << std::setw(9) << "%" << std::setw(14) << "loads"
+            << std::setw(14) << "stores" << std::setw(12) << "calls" << "  label\n";
+        for (unsigned int r : order)
+        {
+            if (byRegion[r].instructions == 0 && calls[r] == 0) continue;
+            out << std::setw(16) << byRegion[r].instructions << std::setw(9) << percent(byRegion[r].instructions, total)
+                << std::setw(14) << byRegion[r].loads << std::setw(14) << byRegion[r].stores
+                << std::setw(12) << calls[r] << "  " << regions.name(r) << "\n";
+        }
+
+        std::vector<unsigned int> ops;
+        for (unsigned int op = 0; op < OP_COUNT; op++)
+        {
+            if (byOpcode[op]) ops.push_back(op);
+        }
+        std::stable_sort(ops.begin(), ops.end(), [&](unsigned int a, unsigned int b) { return byOpcode[a] > byOpcode[b]; });
+        out << "\nBy opcode\n" << std::setw(16) << "instructions" << std::setw(9) << "%" << "  opcode\n";
+        for (unsigned int op : ops)
+        {
+            out << std::setw(16) << byOpcode[op] << std::setw(9) << percent(byOpcode[op], total)
+                << "  " << mnemonic(static_cast<Opcode>(op)) << "\n";
+        }
+
+        const size_t HOTTEST = 40;
+        std::vector<size_t> slots;
+        for (size_t slot = 0; slot < counts.size(); slot++)
+        {
+            if (counts[slot]) slots.push_back(slot);
+        }
+        size_t shown = std::min(HOTTEST, slots.size());
+        std::partial_sort(slots.begin(), slots.begin() + shown, slots.end(), [&](size_t a, size_t b)
+        {
+            return counts[a] > counts[b] || (counts[a] == counts[b] && a < b);
+        });
+        out << "\nHottest instructions\n" << std::setw(16) << "instructions" << std::setw(9) << "%"
+            << "  address     label: source\n";
+        for (size_t i = 0; i < shown; i++)
+        {
+            size_t slot = slots[i];
+            out << std::setw(16) << counts[slot] << std::setw(9) << percent(counts[slot], total) << "  0x"
+                << std::hex << std::setw(8) << std::setfill('0') << textBase + slot * 4 << std::dec << std::setfill(' ')
+                << "  " << regions.name(regions.regionOfSlot(slot)) << ": " << program.listing[slot] << "\n";
+        }
+    }
+}
+
+CallProfile::CallProfile(const Program& program, const LabelRegions& regions, std::vector<unsigned int> blockEnds,
+                         unsigned int entry)
+    : regions(regions), blockEnds(std::move(blockEnds)), transfers(program.code.size(), NONE),
+      counts(program.code.size(), 0), calls(regions.size(), 0), current(0), depth(1), overflow(0),
+      sites(program.code.size(), {LabelRegions::NONE, LabelRegions::NONE, 0})
+{
+    for (size_t i = 0; i < program.code.size(); i++)
+    {
+        const DecodedInstruction& last = program.code[this->blockEnds[i] - 1];
+        if (last.op == OP_JAL || last.op == OP_JALR) transfers[i] = CALL;
+        else if (last.op == OP_JR && last.rs == REG_RA) transfers[i] = RETURN;
+    }
+    stacks.push_back({0, regions.regionOf(entry), 0, {}});
+}
+
+inline void CallProfile::call(size_t slot, unsigned int target)
+{
+    unsigned int callee = regions.regionOf(target);
+    if (callee != LabelRegions::NONE) calls[callee]++;
+    if (depth == MAX_STACK_DEPTH)
+    {
+        overflow++;
+        return;
+    }
+    depth++;
+    CallSite& site = sites[slot];
+    if (site.caller == current && site.callee == callee)
+    {
+        current = site.node;
+        return;
+    }
+
+    unsigned int child = 0;
+    for (const auto& edge : stacks[current].children)
+    {
+        if (edge.first == callee) child = edge.second;
+    }
+    if (child == 0)
+    {
+        child = static_cast<unsigned int>(stacks.size());
+        stacks.push_back({current, callee, 0, {}});
+        stacks[current].children.emplace_back(callee, child);
+    }
+    site = {current, callee, child};
+    current = child;
+}
+
+inline void CallProfile::ret()
+{
+    if (overflow > 0)
+    {
+        overflow--;
+    }
+    else if (current != 0)
+    {
+        current = stacks[current].parent;
+        depth--;
+    }
+}
+
+void Machine::runCounting(CallProfile& profile)
+{
+    const DecodedInstruction* code = prog->code.data();
+    const size_t count = prog->code.size();
+    const unsigned int* blockEnds = profile.blockEnds.data();
+    const CallProfile::Transfer* transfers = profile.transfers.data();
+    unsigned long long* counts = profile.counts.data();
+    unsigned long long executed = 0;
+    unsigned long long charged = executedCount;     // instructions charged to a frame so far
+
+    while (!halted)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+
+        // Only the last instruction of a block can branch, call or halt
+        const unsigned int end = blockEnds[index];
+        const CallProfile::Transfer transfer = transfers[index];
+        counts[index]++;
+        for (unsigned int i = index; i < end; i++) execute(code[i]);
+        executed += end - index;
+
+        if (transfer != CallProfile::NONE)
+        {
+            // Fused copy loops add to executedCount as they run
+            profile.stacks[profile.current].instructions += executedCount + executed - charged;
+            charged = executedCount + executed;
+            if (transfer == CallProfile::CALL) profile.call(end - 1, PC);
+            else profile.ret();
+        }
+    }
+    profile.stacks[profile.current].instructions += executedCount + executed - charged;
+    executedCount += executed;
+}
+
+void MIPSInterpreter::runProfiled()
+{
+    const LabelRegions regions(*prog, TEXT_BASE);
+    const std::vector<BasicBlock> blocks = formBasicBlocks(prog->code, prog->labels, TEXT_BASE);
+    CallProfile profile(*prog, regions, blockEndsOf(blocks, prog->code.size()), PC);
+    runCounting(profile);
+    flushOutput();
+    std::vector<unsigned long long>& counts = profile.counts;
+    const std::vector<CallProfile::StackNode>& stacks = profile.stacks;
+
+    // A run counted at its first slot executed every slot after it in the block
+    for (const BasicBlock& block : blocks)
+    {
+        for (unsigned int i = block.first + 1; i < block.end; i++) counts[i] += counts[i - 1];
+    }
+
+    std::ofstream report(profilePath);
+    std::ofstream folded(profilePath + ".folded");
+    if (!report.is_open() || !folded.is_open())
+    {
+        std::cerr << "Error: Cannot write profile " << profilePath << std::endl;
+        return;
+    }
+    writeReport(report, *prog, TEXT_BASE, regions, counts, profile.calls);
+
+    // One line per call stack, outermost frame first, as flamegraph.pl reads
+    for (const CallProfile::StackNode& node : stacks)
+    {
+        if (node.instructions == 0) continue;
+        std::vector<const CallProfile::StackNode*> frames;
+        for (const CallProfile::StackNode* frame = &node; ; frame = &stacks[frame->parent])
+        {
+            frames.push_back(frame);
+            if (frame == &stacks[0]) break;
+        }
+        for (size_t i = frames.size(); i-- > 0; )
+        {
+            unsigned int region = frames[i]->region;
+            folded << (region == LabelRegions::NONE ? std::string("?") : regions.name(region)) << (i ? ";" : " ");
+        }
+        folded << node.instructions << "\n";
+    }
+    *messages << "Profile written to " << profilePath << " and " << profilePath << ".folded" << std::endl;
+}
+
+// --sample-profile runs the selected engine, which checks a flag between
+// basic blocks: after each block on the switch engine, after branches and
+// jumps on the threaded one, and at block exits in compiled code. A watcher
+// thread sets the flag at the sampling rate; the interpreter then records PC
+// and a few return addresses into a single-producer ring, which the watcher
+// drains into per-stack counts on its next tick. Labels are attached when the
+// report is written. PC is the block about to run, so a tick that lands in
+// the middle of a block is credited to the block after it, and a long
+// straight-line block is never sampled itself.
+
+namespace
+{
+    const unsigned int SAMPLE_DEPTH = 8;
+
+    struct Sample
+    {
+        unsigned int depth;
+        unsigned int frames[SAMPLE_DEPTH];  // PC, then return addresses outward
+    };
+
+    // Lock-free between one pushing and one popping thread
+    class SampleRing
+    {
+    public:
+        static const size_t CAPACITY = 4096;
+
+        bool push(const Sample& sample)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) == CAPACITY) return false;
+            slots[h % CAPACITY] = sample;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(Sample& sample)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) return false;
+            sample = slots[t % CAPACITY];
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        Sample slots[CAPACITY];
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+    };
+
+    // Words above $sp searched for saved return addresses
+    const unsigned int STACK_SCAN_WORDS = 64;
+}
+
+void MIPSInterpreter::runSampled()
+{
+    const size_t count = prog->code.size();
+    const LabelRegions regions(*prog, TEXT_BASE);
+
+    // A text address is a return address if the word before it is a call
+    auto isReturnAddress = [&](unsigned int addr)
+    {
+        unsigned int index = (addr - TEXT_BASE) >> 2;
+        return (addr & 3) == 0 && index >= 1 && index <= count &&
+               (prog->code[index - 1].op == OP_JAL || prog->code[index - 1].op == OP_JALR);
+    };
+
+    auto ring = std::make_unique<SampleRing>();
+    std::map<std::vector<unsigned int>, unsigned long long> stacks;   // frames, outermost first
+    unsigned long long taken = 0;
+    unsigned long long dropped = 0;
+
+    auto drain = [&]()
+    {
+        Sample sample;
+        while (ring->pop(sample))
+        {
+            std::vector<unsigned int> frames(sample.frames, sample.frames + sample.depth);
+            std::reverse(frames.begin(), frames.end());
+            stacks[frames]++;
+            taken++;
+        }
+    };
+
+    std::atomic<bool> due{false};
+    std::mutex stopLock;
+    std::condition_variable stopped;
+    bool stopping = false;
+    const auto period = std::chrono::nanoseconds(1000000000ULL / sampleRate);
+    std::thread watcher([&]()
+    {
+        auto next = std::chrono::steady_clock::now() + period;
+        std::unique_lock<std::mutex> lock(stopLock);
+        while (!stopped.wait_until(lock, next, [&] { return stopping; }))
+        {
+            due.store(true, std::memory_order_relaxed);
+            drain();
+            next += period;
+        }
+    });
+
+    takeSample = [&]()
+    {
+        due.store(false, std::memory_order_relaxed);
+
+        // The leaf and its caller come from PC and $ra; callers further out
+        // are found by scanning the stack for saved return addresses
+        Sample sample;
+        sample.depth = 0;
+        sample.frames[sample.depth++] = PC;
+        // $ra left over from a call the current function already returned
+        // from would name that function as its own caller, so it is skipped
+        unsigned int ra = regFile.get(REG_RA);
+        if (isReturnAddress(ra) && regions.regionOf(ra - 4) != regions.regionOf(PC)) sample.frames[sample.depth++] = ra;
+        unsigned int sp = regFile.get(REG_SP);
+        bool skippedRa = false;
+        for (unsigned int i = 0; i < STACK_SCAN_WORDS && sample.depth < SAMPLE_DEPTH; i++)
+        {
+            unsigned int word = mem.fetchWord(sp + i * 4);
+            if (!isReturnAddress(word)) continue;
+            if (word == ra && !skippedRa)
+            {
+                skippedRa = true; // $ra saved by the current function
+                continue;
+            }
+            sample.frames[sample.depth++] = word;
+        }
+        if (!ring->push(sample)) dropped++;
+    };
+    
+    sampleDue = &due;
+    if (engine == ENGINE_THREADED)
+    {
+        runThreaded();
+    }
+    else if (engine == ENGINE_JIT)
+    {
+        runTiered();
+    }
+    else
+    {
+        const std::vector<unsigned int> blockEnds =
+            blockEndsOf(formBasicBlocks(prog->code, prog->labels, TEXT_BASE), prog->code.size());
+        while (runUntilSet(due, blockEnds.data())) takeSample();
+    }
+    sampleDue = nullptr;
+    takeSample = nullptr;
+    flushOutput();
+
+    {
+        std::lock_guard<std::mutex> lock(stopLock);
+        stopping = true;
+    }
+    stopped.notify_one();
+    watcher.join();
+    drain();
+
+    const std::string path = profilePath.empty() ? "profile.txt" : profilePath;
+    std::ofstream report(path);
+    std::ofstream folded(path + ".folded");
+    if (!report.is_open() || !folded.is_open())
+    {
+        std::cerr << "Error: Cannot write profile " << path << std::endl;
+        return;
+    }
+
+    auto frameName = [&](size_t frame, unsigned int addr)
+    {
+        // Return addresses are named by their call instruction
+        unsigned int region = regions.regionOf(frame == 0 ? addr : addr - 4);
+        return region == LabelRegions::NONE ? std::string("?") : regions.name(region);
+    };
+
+    std::vector<unsigned long long> self(regions.size(), 0);
+    std::vector<unsigned long long> total(regions.size(), 0);
+    std::vector<unsigned long long> slots(count, 0);
+    for (const auto& stack : stacks)
+    {
+        const std::vector<unsigned int>& frames = stack.first;
+        unsigned int leaf = frames.back();
+        unsigned int leafRegion = regions.regionOf(leaf);
+        if (leafRegion != LabelRegions::NONE)
+        {
+            self[leafRegion] += stack.second;
+            slots[(leaf - TEXT_BASE) >> 2] += stack.second;
+        }
+
+        // Inclusive counts name each label once per stack
+        std::vector<unsigned int> seen;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            unsigned int region = regions.regionOf(i + 1 == frames.size() ? frames[i] : frames[i] - 4);
+            if (region == LabelRegions::NONE || std::find(seen.begin(), seen.end(), region) != seen.end()) continue;
+            seen.push_back(region);
+            total[region] += stack.second;
+        }
+
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            folded << frameName(frames.size() - 1 - i, frames[i]) << (i + 1 < frames.size() ? ";" : " ");
+        }
+        folded << stack.second << "\n";
+    }
+
+    report << "Sampled profile of " << (prog->source.empty() ? "program" : prog->source) << ": " << taken
+           << " samples at " << sampleRate << " Hz";
+    if (dropped) report << " (" << dropped << " dropped)";
+    report << "\n\n";
+
+    std::vector<unsigned int> order(regions.size());
+    for (unsigned int r = 0; r < order.size(); r++) order[r] = r;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return self[a] > self[b]; });
+    report << "By label\n" << std::setw(12) << "self" << std::setw(9) << "%" << std::setw(12) << "total"
+           << std::setw(9) << "%" << "  label\n";
+    for (unsigned int r : order)
+    {
+        if (self[r] == 0 && total[r] == 0) continue;
+        report << std::setw(12) << self[r] << std::setw(9) << percent(self[r], taken) << std::setw(12) << total[r]
+               << std::setw(9) << percent(total[r], taken) << "  " << regions.name(r) << "\n";
+    }
+
+    const size_t HOTTEST = 40;
+    std::vector<size_t> hot;
+    for (size_t slot = 0; slot < count; slot++)
+    {
+        if (slots[slot]) hot.push_back(slot);
+    }
+    size_t shown = std::min(HOTTEST, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(), [&](size_t a, size_t b)
+    {
+        return slots[a] > slots[b] || (slots[a] == slots[b] && a < b);
+    });
+    report << "\nHottest instructions\n" << std::setw(12) << "samples" << std::setw(9) << "%"
+           << "  address     label: source\n";
+    for (size_t i = 0; i < shown; i++)
+    {
+        size_t slot = hot[i];
+        report << std::setw(12) << slots[slot] << std::setw(9) << percent(slots[slot], taken) << "  0x"
+               << std::hex << std::setw(8) << std::setfill('0') << TEXT_BASE + slot * 4 << std::dec << std::setfill(' ')
+               << "  " << regions.name(regions.regionOfSlot(slot)) << ": " << prog->listing[slot] << "\n";
+    }
+    *messages << "Profile written to " << path << " and " << path << ".folded" << std::endl;
+}
@@ -0,0 +1,86 @@
+/*
+File: profiler.h
+Author: Brysen Landis
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include "program.h"
+
+// Splits the text segment into regions, one per label, each running up to
+// the next label. Profiles attribute addresses to the region holding them.
+class LabelRegions
+{
+public:
+    LabelRegions(const Program& program, unsigned int textBase);
+
+    static const unsigned int NONE = 0xFFFFFFFF;
+
+    // Region holding the instruction slot, or NONE outside the text
+    unsigned int regionOfSlot(size_t slot) const { return slot < slotRegion.size() ? slotRegion[slot] : NONE; }
+    unsigned int regionOf(unsigned int addr) const;
+
+    size_t size() const { return names.size(); }
+    const std::string& name(unsigned int region) const { return names[region]; }
+    unsigned int start(unsigned int region) const { return starts[region]; }
+
+private:
+    unsigned int textBase;
+    std::vector<unsigned int> starts;
+    std::vector<std::string> names;
+    std::vector<unsigned int> slotRegion;   // region of each instruction slot
+};
+
+// Everything --profile gathers while the program runs, kept in flat arrays
+// indexed by instruction slot or region so Machine::runCounting() can follow
+// calls without leaving its loop (profiler.cpp)
+struct CallProfile
+{
+    // One distinct call stack; its parent is the stack it was called from
+    struct StackNode
+    {
+        unsigned int parent;
+        unsigned int region;
+        unsigned long long instructions;    // executed while this was the innermost frame
+        std::vector<std::pair<unsigned int, unsigned int>> children;    // callee region, node
+    };
+
+    // What an instruction does to the call stack: jal and jalr call, jr $ra returns
+    enum Transfer : unsigned char { NONE, CALL, RETURN };
+
+    // Deeper calls are charged to the deepest frame kept
+    static const unsigned int MAX_STACK_DEPTH = 128;
+
+    CallProfile(const Program& program, const LabelRegions& regions, std::vector<unsigned int> blockEnds,
+                unsigned int entry);
+
+    const LabelRegions& regions;
+    std::vector<unsigned int> blockEnds;        // end of the block holding each slot
+    std::vector<Transfer> transfers;            // of the last instruction in the block holding each slot
+    std::vector<unsigned long long> counts;     // runs through a block starting at each slot
+    std::vector<unsigned long long> calls;      // per region
+
+    std::vector<StackNode> stacks;
+    unsigned int current;       // innermost frame
+    unsigned int depth;
+    unsigned int overflow;      // calls past MAX_STACK_DEPTH not yet returned from
+
+    // The caller and callee region last seen at a call slot and the node
+    // they led to, so a call repeated from the same stack finds its node
+    // without searching
+    struct CallSite
+    {
+        unsigned int caller;
+        unsigned int callee;
+        unsigned int node;
+    };
+    std::vector<CallSite> sites;    // per slot
+
+    void call(size_t slot, unsigned int target);
+    void ret();
+};
+
+#endif
@@ -0,0 +1,47 @@
+/*
+File: program.cpp
+Author: Brysen Landis
+*/
+
+#include "program.h"
+#include "machine.h"
+#include "mapped_file.h"
+
+// Hashes the text words and initialized data of a program being loaded
+static unsigned long long hashImage(Program& program)
+{
+    const size_t textSize = program.code.size() * 4;
+    const size_t dataSize = program.dataEnd > Machine::DATA_BASE ? program.dataEnd - Machine::DATA_BASE : 0;
+    std::vector<unsigned char> bytes(textSize + dataSize);
+    program.image.readBlock(Machine::TEXT_BASE, bytes.data(), textSize);
+    program.image.readBlock(Machine::DATA_BASE, bytes.data() + textSize, dataSize);
+    return hashBytes(bytes.data(), bytes.size());
+}
+
+std::shared_ptr<Program> Program::load(const std::string& filename, const LoadSettings& settings,
+                                       std::ostream& messages)
+{
+    std::shared_ptr<Program> program;
+    if (isBinaryImage(filename))
+    {
+        program = loadBinaryImage(filename, messages);
+    }
+    else if (!settings.cacheDir.empty())
+    {
+        program = loadThroughCache(filename, settings.cacheDir, settings.assemblerThreads, messages);
+    }
+    else
+    {
+        program = assembleSource(filename, settings.assemblerThreads, messages);
+    }
+    if (!program) return nullptr;
+    
+    program->source = filename;
+    program->imageHash = hashImage(*program);
+    if (settings.copyLoops)
+    {
+        size_t fused = fuseCopyLoops(program->code, program->copyLoops, Machine::TEXT_BASE);
+        if (fused > 0) messages << "Fused " << fused << " byte-copy loop" << (fused == 1 ? "" : "s") << std::endl;
+    }
+    return program;
+}
@@ -0,0 +1,62 @@
+/*
+File: program.h
+Author: Brysen Landis
+*/
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "instruction.h"
+#include "copy_loops.h"
+#include "memory.h"
+
+// How Program::load() treats a file
+struct LoadSettings
+{
+    std::string cacheDir;               // cache assembled sources here (program_cache.cpp); empty for none
+    unsigned int assemblerThreads = 0;  // 0 uses every hardware thread
+    bool copyLoops = false;             // replace byte-copy loops (copy_loops.h)
+};
+
+// Everything loading a file produces: the decoded program, its listing, the
+// label table and the initial memory image. A loaded Program is never
+// modified again, so any number of Machines on any threads can share one.
+struct Program
+{
+    std::vector<DecodedInstruction> code;   // indexed by (PC - TEXT_BASE) >> 2
+    std::vector<std::string> listing;       // source text of each word in code
+    LabelTable labels;
+    Memory image;                           // text words and initialized data
+    unsigned int entry = 0;
+    unsigned int dataEnd = 0;               // first address past the data segment
+    std::string source;                     // file it was loaded from
+    std::vector<CopyLoop> copyLoops;        // indexed by OP_COPY_LOOP's imm
+    size_t sourceLines = 0;                 // lines the assembler read, 0 if it did not run
+    unsigned long long imageHash = 0;       // fingerprint(), worked out once by load()
+
+    // Loads an assembly source, ELF executable or raw .bin image with the
+    // loaders below, printing errors to std::cerr and status such as
+    // "Loaded N instructions" to messages. Returns null if the file cannot
+    // be read.
+    static std::shared_ptr<Program> load(const std::string& filename, const LoadSettings& settings,
+                                         std::ostream& messages);
+
+    // Hash of the text words and initialized data, identifying the program
+    // independently of the file it came from
+    unsigned long long fingerprint() const { return imageHash; }
+};
+
+// The loaders Program::load() chooses between, each returning null once it
+// has reported why the file cannot be loaded
+std::shared_ptr<Program> assembleSource(const std::string& filename, unsigned int threads,
+                                        std::ostream& messages);                        // assembler.cpp
+bool isBinaryImage(const std::string& filename);                                        // binary_image.cpp
+std::shared_ptr<Program> loadBinaryImage(const std::string& filename, std::ostream& messages);
+std::shared_ptr<Program> loadThroughCache(const std::string& filename, const std::string& cacheDir,
+                                          unsigned int threads, std::ostream& messages); // program_cache.cpp
+
+#endif
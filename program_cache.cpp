@@ -0,0 +1,246 @@
+/*
+File: program_cache.cpp
+Author: Brysen Landis
+*/
+
+#include "assembler.h"
+#include "machine.h"
+#include "mapped_file.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+// Assembled programs are cached as <dir>/<source hash>.mipc. The file holds
+// everything Assembler::parseFile() produces: the decoded program, the
+// machine words, the text listing, the label table and the initialized data
+// image. A cache hit maps the file and copies those straight in without
+// touching the source text again.
+
+static const char CACHE_MAGIC[8] = { 'M', 'I', 'P', 'S', 'C', 'A', 'C', 'H' };
+static const unsigned int CACHE_VERSION = 3;
+
+struct CacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int assemblerRevision; // Assembler::REVISION that produced the entry
+    unsigned int instructionSize;   // sizeof(DecodedInstruction), guards layout changes
+    unsigned long long sourceHash;
+    unsigned long long sourceSize;
+    unsigned int sourceInstructions;
+    unsigned int wordCount;
+    unsigned int labelCount;
+    unsigned int dataSize;          // bytes of data image stored
+    unsigned int dataEnd;           // Program::dataEnd
+    unsigned int entry;
+};
+
+static std::string cachePath(const std::string& dir, unsigned long long hash)
+{
+    std::ostringstream name;
+    name << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".mipc";
+    return name.str();
+}
+
+// Bounds-checked reader over the mapped cache file
+class CacheReader
+{
+public:
+    CacheReader(const unsigned char* data, size_t size) : data(data), size(size), pos(0), ok(true) {}
+
+    const unsigned char* take(size_t length)
+    {
+        if (!ok || length > size - pos)
+        {
+            ok = false;
+            return nullptr;
+        }
+        const unsigned char* p = data + pos;
+        pos += length;
+        return p;
+    }
+
+    unsigned int word()
+    {
+        const unsigned char* p = take(sizeof(unsigned int));
+        unsigned int value = 0;
+        if (p) std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    std::string string()
+    {
+        unsigned int length = word();
+        const unsigned char* p = take(length);
+        return p ? std::string(reinterpret_cast<const char*>(p), length) : std::string();
+    }
+
+    bool good() const { return ok; }
+
+private:
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    bool ok;
+};
+
+static void writeWord(std::ostream& out, unsigned int value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void writeString(std::ostream& out, const std::string& str)
+{
+    writeWord(out, static_cast<unsigned int>(str.size()));
+    out.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+// Fills program from the entry at path if it is for a source of the given
+// hash and size, setting instructions to the count the source had
+static bool loadCached(const std::string& path, unsigned long long hash, unsigned long long size,
+                       Program& program, unsigned int& instructions)
+{
+    MappedFile file(path);
+    if (!file.isOpen() || file.size() < sizeof(CacheHeader)) return false;
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.assemblerRevision != Assembler::REVISION ||
+        header.instructionSize != sizeof(DecodedInstruction) ||
+        header.sourceHash != hash || header.sourceSize != size)
+    {
+        return false;
+    }
+
+    CacheReader in(file.data(), file.size());
+    in.take(sizeof(CacheHeader));
+    const unsigned char* decoded = in.take(static_cast<size_t>(header.wordCount) * sizeof(DecodedInstruction));
+    const unsigned char* words = in.take(static_cast<size_t>(header.wordCount) * 4);
+    const unsigned char* data = in.take(header.dataSize);
+    if (!in.good()) return false;
+
+    std::vector<std::string> listing(header.wordCount);
+    for (std::string& line : listing) line = in.string();
+    LabelTable table;
+    for (unsigned int i = 0; i < header.labelCount && in.good(); i++)
+    {
+        unsigned int addr = in.word();
+        table[in.string()] = addr;
+    }
+    if (!in.good()) return false;
+
+    program.code.resize(header.wordCount);
+    if (header.wordCount > 0) std::memcpy(program.code.data(), decoded, header.wordCount * sizeof(DecodedInstruction));
+    program.image.writeBlock(Machine::TEXT_BASE, words, static_cast<size_t>(header.wordCount) * 4);
+    program.image.writeBlock(Machine::DATA_BASE, data, header.dataSize);
+    program.listing.swap(listing);
+    program.labels.swap(table);
+    program.dataEnd = header.dataEnd;
+    program.entry = header.entry;
+    instructions = header.sourceInstructions;
+    return true;
+}
+
+static void saveCached(const std::string& path, unsigned long long hash, unsigned long long size,
+                       Program& program, unsigned int instructions)
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.assemblerRevision = Assembler::REVISION;
+    header.instructionSize = sizeof(DecodedInstruction);
+    header.sourceHash = hash;
+    header.sourceSize = size;
+    header.sourceInstructions = instructions;
+    header.wordCount = static_cast<unsigned int>(program.code.size());
+    header.labelCount = static_cast<unsigned int>(program.labels.size());
+    header.dataEnd = program.dataEnd;
+    header.entry = program.entry;
+
+    // Trailing zeros (.space) are implied by dataEnd
+    header.dataSize = program.dataEnd - Machine::DATA_BASE;
+    while (header.dataSize > 0 && program.image.fetch(Machine::DATA_BASE + header.dataSize - 1) == 0) header.dataSize--;
+
+    std::vector<unsigned char> words(program.code.size() * 4);
+    std::vector<unsigned char> data(header.dataSize);
+    program.image.readBlock(Machine::TEXT_BASE, words.data(), words.size());
+    program.image.readBlock(Machine::DATA_BASE, data.data(), data.size());
+
+    // Write beside the final name and rename, so concurrent runs never see a partial file
+    std::ostringstream tempName;
+    tempName << path << ".tmp" << std::chrono::steady_clock::now().time_since_epoch().count()
+             << "." << static_cast<const void*>(&program);
+    {
+        std::ofstream out(tempName.str(), std::ios::binary);
+        if (!out.is_open()) return;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(program.code.data()),
+                  static_cast<std::streamsize>(program.code.size() * sizeof(DecodedInstruction)));
+        out.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(words.size()));
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        for (const std::string& line : program.listing) writeString(out, line);
+        for (const auto& label : program.labels)
+        {
+            writeWord(out, label.second);
+            writeString(out, label.first);
+        }
+        if (!out)
+        {
+            out.close();
+            std::remove(tempName.str().c_str());
+            return;
+        }
+    }
+    if (std::rename(tempName.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(tempName.str().c_str());
+    }
+}
+
+// Loads filename through the cache directory, assembling and storing it on a miss
+std::shared_ptr<Program> loadThroughCache(const std::string& filename, const std::string& cacheDir,
+                                          unsigned int threads, std::ostream& messages)
+{
+    unsigned long long hash, size;
+    {
+        MappedFile source(filename);
+        if (!source.isOpen())
+        {
+            std::cerr << "Error: Cannot open file " << filename << std::endl;
+            return nullptr;
+        }
+        hash = hashBytes(source.data(), source.size());
+        size = source.size();
+    }
+
+    std::string path = cachePath(cacheDir, hash);
+    auto cached = std::make_shared<Program>();
+    unsigned int instructions;
+    if (loadCached(path, hash, size, *cached, instructions))
+    {
+        messages << "Loaded " << instructions << " instructions from " << filename << std::endl;
+        messages << "Found " << cached->labels.size() << " labels" << std::endl;
+        return cached;
+    }
+
+    Assembler assembler(threads, messages);
+    if (!assembler.parseFile(filename)) return nullptr;
+
+    // The key only covers the source, so programs that include files are
+    // not cached
+    if (assembler.includesFiles()) return assembler.program();
+#if defined(__unix__) || defined(__APPLE__)
+    ::mkdir(cacheDir.c_str(), 0755);
+#endif
+    saveCached(path, hash, size, *assembler.program(), assembler.instructionCount());
+    return assembler.program();
+}
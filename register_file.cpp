@@ -2,30 +2,28 @@
 #include <iostream>
 #include <iomanip>
 
+// Shared by every RegisterFile, so each one is just its 32 registers
+const std::map<std::string, int>& RegisterFile::names()
+{
+    static const std::map<std::string, int> regMap = {
+        {"zero", 0}, {"at", 1}, {"v0", 2}, {"v1", 3},
+        {"a0", 4}, {"a1", 5}, {"a2", 6}, {"a3", 7},
+        {"t0", 8}, {"t1", 9}, {"t2", 10}, {"t3", 11},
+        {"t4", 12}, {"t5", 13}, {"t6", 14}, {"t7", 15},
+        {"s0", 16}, {"s1", 17}, {"s2", 18}, {"s3", 19},
+        {"s4", 20}, {"s5", 21}, {"s6", 22}, {"s7", 23},
+        {"t8", 24}, {"t9", 25}, {"k0", 26}, {"k1", 27},
+        {"gp", 28}, {"sp", 29}, {"fp", 30}, {"ra", 31}
+    };
+    return regMap;
+}
+
 RegisterFile::RegisterFile() 
 {
     for (int i = 0; i < 32; i++) 
     {
         reg[i] = 0;
     }
-    
-    // Initialize regMap with register names
-    regMap["zero"] = 0; regMap["at"] = 1;
-    regMap["v0"] = 2; regMap["v1"] = 3;
-    regMap["a0"] = 4; regMap["a1"] = 5;
-    regMap["a2"] = 6; regMap["a3"] = 7;
-    regMap["t0"] = 8; regMap["t1"] = 9;
-    regMap["t2"] = 10; regMap["t3"] = 11;
-    regMap["t4"] = 12; regMap["t5"] = 13;
-    regMap["t6"] = 14; regMap["t7"] = 15;
-    regMap["s0"] = 16; regMap["s1"] = 17;
-    regMap["s2"] = 18; regMap["s3"] = 19;
-    regMap["s4"] = 20; regMap["s5"] = 21;
-    regMap["s6"] = 22; regMap["s7"] = 23;
-    regMap["t8"] = 24; regMap["t9"] = 25;
-    regMap["k0"] = 26; regMap["k1"] = 27;
-    regMap["gp"] = 28; regMap["sp"] = 29;
-    regMap["fp"] = 30; regMap["ra"] = 31;
 }
 
 unsigned int RegisterFile::getReg(const std::string& regName) 
@@ -36,9 +34,10 @@ unsigned int RegisterFile::getReg(const std::string& regName)
         cleanName = cleanName.substr(1);
     }
     
-    if (regMap.find(cleanName) != regMap.end()) 
+    auto it = names().find(cleanName);
+    if (it != names().end()) 
     {
-        return reg[regMap[cleanName]];
+        return reg[it->second];
     }
     
     // Try numeric register
@@ -63,8 +62,8 @@ void RegisterFile::setReg(const std::string& regName, unsigned int value)
         cleanName = cleanName.substr(1);
     }
     
-    auto it = regMap.find(cleanName);
-    if (it != regMap.end()) 
+    auto it = names().find(cleanName);
+    if (it != names().end()) 
     {
         if (it->second != 0) // Don't allow writing to $zero
         {
@@ -123,9 +122,10 @@ int RegisterFile::getRegNumber(const std::string& regName)
     }
     
     // Check if it's a named register
-    if (regMap.find(cleanName) != regMap.end())
+    auto it = names().find(cleanName);
+    if (it != names().end())
     {
-        return regMap[cleanName];
+        return it->second;
     }
     
     // Check if it's a numeric register
@@ -5,6 +5,14 @@
 #include <string>
 #include <map>
 
+// Register numbers used directly by the interpreter core
+enum RegisterNumber
+{
+    REG_ZERO = 0, REG_AT = 1, REG_V0 = 2, REG_V1 = 3,
+    REG_A0 = 4, REG_A1 = 5, REG_A2 = 6, REG_A3 = 7,
+    REG_GP = 28, REG_SP = 29, REG_FP = 30, REG_RA = 31
+};
+
 class RegisterFile
 {
 public:
@@ -16,13 +24,19 @@ public:
     unsigned int getRegByNum(int regNum);
     void setRegByNum(int regNum, unsigned int value);
     
-    int getRegNumber(const std::string& regName);
+    static int getRegNumber(const std::string& regName);
+    
+    // Unchecked access for register numbers validated at decode time
+    unsigned int get(int regNum) const { return reg[regNum]; }
+    void set(int regNum, unsigned int value) { if (regNum != 0) reg[regNum] = value; }
+    unsigned int* data() { return reg; }
     
     void displayRegisters();
     
 private:
     unsigned int reg[32];
-    std::map<std::string, int> regMap;
+    
+    static const std::map<std::string, int>& names();
 };
 
 #endif
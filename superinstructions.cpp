@@ -0,0 +1,83 @@
+/*
+File: superinstructions.cpp
+Author: Brysen Landis
+*/
+
+#include "superinstructions.h"
+#include "register_file.h"
+
+const char* superinstructionName(Superinstruction s)
+{
+    switch (s)
+    {
+        case FUSE_ADDI_BNE:   return "addi+bne";
+        case FUSE_ADDI_BEQ:   return "addi+beq";
+        case FUSE_ADDI_BLT:   return "addi+blt";
+        case FUSE_ADDI_ADDI:  return "addi+addi";
+        case FUSE_LW_ADDI:    return "lw+addi";
+        case FUSE_SLT_BEQ:    return "slt+beq";
+        case FUSE_SLT_BNE:    return "slt+bne";
+        case FUSE_SLTI_BEQ:   return "slti+beq";
+        case FUSE_SLTI_BNE:   return "slti+bne";
+        case FUSE_LI_SYSCALL: return "li $v0+syscall";
+        default:              return "none";
+    }
+}
+
+static bool isAddi(Opcode op)
+{
+    return op == OP_ADDI || op == OP_ADDIU;
+}
+
+// li assembles to addiu or ori from $zero
+static bool isLoadImmediate(const DecodedInstruction& d)
+{
+    return d.op == OP_LI || ((isAddi(d.op) || d.op == OP_ORI) && d.rs == REG_ZERO);
+}
+
+static Superinstruction matchPair(const DecodedInstruction& a, const DecodedInstruction& b)
+{
+    if (isLoadImmediate(a) && a.rt == REG_V0 && b.op == OP_SYSCALL)
+    {
+        return FUSE_LI_SYSCALL;
+    }
+    else if (isAddi(a.op))
+    {
+        if (b.op == OP_BNE) return FUSE_ADDI_BNE;
+        if (b.op == OP_BEQ) return FUSE_ADDI_BEQ;
+        if (b.op == OP_BLT) return FUSE_ADDI_BLT;
+        if (isAddi(b.op)) return FUSE_ADDI_ADDI;
+    }
+    else if (a.op == OP_LW && isAddi(b.op))
+    {
+        return FUSE_LW_ADDI;
+    }
+    else if (a.op == OP_SLT)
+    {
+        if (b.op == OP_BEQ) return FUSE_SLT_BEQ;
+        if (b.op == OP_BNE) return FUSE_SLT_BNE;
+    }
+    else if (a.op == OP_SLTI)
+    {
+        if (b.op == OP_BEQ) return FUSE_SLTI_BEQ;
+        if (b.op == OP_BNE) return FUSE_SLTI_BNE;
+    }
+    return FUSE_NONE;
+}
+
+std::vector<Superinstruction> fuseSuperinstructions(const std::vector<DecodedInstruction>& program,
+                                                    const std::vector<BasicBlock>& blocks)
+{
+    std::vector<Superinstruction> fused(program.size(), FUSE_NONE);
+    
+    for (const BasicBlock& block : blocks)
+    {
+        unsigned int i = block.first;
+        while (i + 1 < block.end)
+        {
+            fused[i] = matchPair(program[i], program[i + 1]);
+            i += (fused[i] != FUSE_NONE) ? 2 : 1;
+        }
+    }
+    return fused;
+}
@@ -0,0 +1,39 @@
+/*
+File: superinstructions.h
+Author: Brysen Landis
+*/
+
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+#include <vector>
+#include "instruction.h"
+#include "basic_blocks.h"
+
+// Common instruction pairs executed by a single handler. A fused pair
+// occupies the slot of its first instruction; the second slot is left
+// untouched so it can still be reached directly.
+enum Superinstruction : unsigned char
+{
+    FUSE_NONE,
+    FUSE_ADDI_BNE,      // addi + bne    (counted loops)
+    FUSE_ADDI_BEQ,      // addi + beq
+    FUSE_ADDI_BLT,      // addi + blt
+    FUSE_ADDI_ADDI,     // addi + addi   (pointer and counter bumps)
+    FUSE_LW_ADDI,       // lw + addi
+    FUSE_SLT_BEQ,       // slt + beq
+    FUSE_SLT_BNE,       // slt + bne
+    FUSE_SLTI_BEQ,      // slti + beq
+    FUSE_SLTI_BNE,      // slti + bne
+    FUSE_LI_SYSCALL,    // li $v0 + syscall
+    FUSE_COUNT
+};
+
+const char* superinstructionName(Superinstruction s);
+
+// Picks a superinstruction for each slot, never pairing across a block
+// boundary. Slots that start no pair are FUSE_NONE.
+std::vector<Superinstruction> fuseSuperinstructions(const std::vector<DecodedInstruction>& program,
+                                                    const std::vector<BasicBlock>& blocks);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+File: thread_pool.cpp
+Author: Brysen Landis
+*/
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : queued(0), pending(0), nextQueue(0), stopping(false)
+{
+    if (threads == 0) threads = 1;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        queues.emplace_back(new TaskQueue());
+    }
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        // Counted in the same critical section, so a worker can never take
+        // a task before it is counted
+        std::lock_guard<std::mutex> guard(stateLock);
+        TaskQueue& queue = *queues[nextQueue++ % queues.size()];
+        std::lock_guard<std::mutex> queueGuard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+        queued++;
+        pending++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> guard(stateLock);
+    idle.wait(guard, [this] { return pending == 0; });
+}
+
+bool ThreadPool::takeTask(unsigned int id, std::function<void()>& task)
+{
+    for (size_t i = 0; i < queues.size(); i++)
+    {
+        TaskQueue& queue = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) continue;
+
+        // Own work from the back, stolen work from the front
+        if (i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int id)
+{
+    while (true)
+    {
+        std::function<void()> task;
+        if (takeTask(id, task))
+        {
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                queued--;
+            }
+            task();
+
+            std::lock_guard<std::mutex> guard(stateLock);
+            if (--pending == 0) idle.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(stateLock);
+        wake.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
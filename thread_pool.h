@@ -0,0 +1,59 @@
+/*
+File: thread_pool.h
+Author: Brysen Landis
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. Workers run
+// their own tasks newest first and, when they run dry, steal the oldest task
+// from another worker, so long jobs on one thread do not hold up the rest.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threads);
+    ~ThreadPool();
+
+    // Tasks are dealt round-robin across the workers' deques
+    void submit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished
+    void wait();
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    struct TaskQueue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex stateLock;
+    std::condition_variable wake;   // tasks queued or stopping
+    std::condition_variable idle;   // pending reached zero
+    size_t queued;                  // submitted, not yet taken
+    size_t pending;                 // submitted, not yet finished
+    size_t nextQueue;
+    bool stopping;
+
+    void workerLoop(unsigned int id);
+    bool takeTask(unsigned int id, std::function<void()>& task);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+#endif
@@ -0,0 +1,374 @@
+/*
+File: threaded_engine.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+
+// Direct-threaded execution over the decoded program. Each slot carries the
+// address of its handler and, for branches, a pointer to the target slot, so
+// straight-line code and taken branches dispatch without recomputing an index
+// from PC. Rare or awkward instructions fall back to execute(), which keeps a
+// single definition of their semantics.
+
+#if defined(__GNUC__)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+struct ThreadedInstruction
+{
+#if USE_COMPUTED_GOTO
+    const void* handler;
+#endif
+    unsigned char handlerId;
+    const ThreadedInstruction* target; // branch/jump destination, if in range
+    DecodedInstruction d;
+};
+
+void MIPSInterpreter::runThreaded()
+{
+    // Handlers with a dedicated body; everything else goes through FALLBACK
+    enum Handler : unsigned char
+    {
+        H_ADD, H_SUB, H_AND, H_OR, H_XOR, H_NOR, H_SLT, H_SLTU,
+        H_SLL, H_SRL, H_SRA, H_MFHI, H_MFLO, H_JR,
+        H_ADDI, H_ANDI, H_ORI, H_XORI, H_SLTI, H_SLTIU, H_LI,
+        H_LW, H_LH, H_LHU, H_LB, H_LBU, H_SW, H_SH, H_SB,
+        H_BEQ, H_BNE, H_BLT, H_BLE, H_BGT, H_BGE,
+        H_BLTZ, H_BLEZ, H_BGTZ, H_BGEZ,
+        H_J, H_JAL, H_MOVE, H_NOT, H_NOP,
+        H_FALLBACK, H_EXIT,
+        
+        // Superinstructions, in Superinstruction order
+        H_ADDI_BNE, H_ADDI_BEQ, H_ADDI_BLT, H_ADDI_ADDI, H_LW_ADDI,
+        H_SLT_BEQ, H_SLT_BNE, H_SLTI_BEQ, H_SLTI_BNE, H_LI_SYSCALL
+    };
+
+#if USE_COMPUTED_GOTO
+    static const void* const handlers[] = {
+        &&L_ADD, &&L_SUB, &&L_AND, &&L_OR, &&L_XOR, &&L_NOR, &&L_SLT, &&L_SLTU,
+        &&L_SLL, &&L_SRL, &&L_SRA, &&L_MFHI, &&L_MFLO, &&L_JR,
+        &&L_ADDI, &&L_ANDI, &&L_ORI, &&L_XORI, &&L_SLTI, &&L_SLTIU, &&L_LI,
+        &&L_LW, &&L_LH, &&L_LHU, &&L_LB, &&L_LBU, &&L_SW, &&L_SH, &&L_SB,
+        &&L_BEQ, &&L_BNE, &&L_BLT, &&L_BLE, &&L_BGT, &&L_BGE,
+        &&L_BLTZ, &&L_BLEZ, &&L_BGTZ, &&L_BGEZ,
+        &&L_J, &&L_JAL, &&L_MOVE, &&L_NOT, &&L_NOP,
+        &&L_FALLBACK, &&L_EXIT,
+        &&L_ADDI_BNE, &&L_ADDI_BEQ, &&L_ADDI_BLT, &&L_ADDI_ADDI, &&L_LW_ADDI,
+        &&L_SLT_BEQ, &&L_SLT_BNE, &&L_SLTI_BEQ, &&L_SLTI_BNE, &&L_LI_SYSCALL
+    };
+#endif
+
+    // Translate the decoded program, plus one exit slot for falling off the end
+    const size_t count = prog->code.size();
+    std::vector<ThreadedInstruction> code(count + 1);
+    ThreadedInstruction* base = code.data();
+
+    auto slotFor = [&](unsigned int addr) -> const ThreadedInstruction*
+    {
+        unsigned int index = (addr - TEXT_BASE) >> 2;
+        return ((addr & 3) == 0 && index < count) ? base + index : nullptr;
+    };
+
+    std::vector<Superinstruction> fused;
+    std::fill(fusionSites, fusionSites + FUSE_COUNT, 0);
+    if (fusionEnabled)
+    {
+        std::vector<BasicBlock> blocks = formBasicBlocks(prog->code, prog->labels, TEXT_BASE);
+        blockCount = blocks.size();
+        fused = fuseSuperinstructions(prog->code, blocks);
+    }
+    
+    for (size_t i = 0; i <= count; i++)
+    {
+        Handler h = H_FALLBACK;
+        ThreadedInstruction& t = code[i];
+        t.target = nullptr;
+
+        if (i == count)
+        {
+            h = H_EXIT;
+        }
+        else
+        {
+            t.d = prog->code[i];
+            switch (t.d.op)
+            {
+                case OP_ADD: case OP_ADDU: h = H_ADD; break;
+                case OP_SUB: case OP_SUBU: h = H_SUB; break;
+                case OP_AND:   h = H_AND; break;
+                case OP_OR:    h = H_OR; break;
+                case OP_XOR:   h = H_XOR; break;
+                case OP_NOR:   h = H_NOR; break;
+                case OP_SLT:   h = H_SLT; break;
+                case OP_SLTU:  h = H_SLTU; break;
+                case OP_SLL:   h = H_SLL; break;
+                case OP_SRL:   h = H_SRL; break;
+                case OP_SRA:   h = H_SRA; break;
+                case OP_MFHI:  h = H_MFHI; break;
+                case OP_MFLO:  h = H_MFLO; break;
+                case OP_JR:    h = H_JR; break;
+                case OP_ADDI: case OP_ADDIU: h = H_ADDI; break;
+                case OP_ANDI:  h = H_ANDI; break;
+                case OP_ORI:   h = H_ORI; break;
+                case OP_XORI:  h = H_XORI; break;
+                case OP_SLTI:  h = H_SLTI; break;
+                case OP_SLTIU: h = H_SLTIU; break;
+                case OP_LUI: case OP_LI: case OP_LA: h = H_LI; break;
+                case OP_LW:    h = H_LW; break;
+                case OP_LH:    h = H_LH; break;
+                case OP_LHU:   h = H_LHU; break;
+                case OP_LB:    h = H_LB; break;
+                case OP_LBU:   h = H_LBU; break;
+                case OP_SW:    h = H_SW; break;
+                case OP_SH:    h = H_SH; break;
+                case OP_SB:    h = H_SB; break;
+                case OP_BEQ:   h = H_BEQ; break;
+                case OP_BNE:   h = H_BNE; break;
+                case OP_BLT:   h = H_BLT; break;
+                case OP_BLE:   h = H_BLE; break;
+                case OP_BGT:   h = H_BGT; break;
+                case OP_BGE:   h = H_BGE; break;
+                case OP_BLTZ:  h = H_BLTZ; break;
+                case OP_BLEZ:  h = H_BLEZ; break;
+                case OP_BGTZ:  h = H_BGTZ; break;
+                case OP_BGEZ:  h = H_BGEZ; break;
+                case OP_J:     h = H_J; break;
+                case OP_JAL:   h = H_JAL; break;
+                case OP_MOVE:  h = H_MOVE; break;
+                case OP_NOT:   h = H_NOT; break;
+                case OP_NOP:   h = H_NOP; break;
+                case OP_CLEAR:
+                    h = H_LI;
+                    t.d.rt = t.d.rd;
+                    t.d.imm = 0;
+                    break;
+                default:       h = H_FALLBACK; break;
+            }
+
+            // Branches whose target lies outside the program use the slow path
+            if (h >= H_BEQ && h <= H_JAL)
+            {
+                t.target = slotFor(t.d.target);
+                if (!t.target) h = H_FALLBACK;
+            }
+            
+            // The fused slot takes the second instruction's branch target
+            if (!fused.empty() && fused[i] != FUSE_NONE)
+            {
+                const DecodedInstruction& next = prog->code[i + 1];
+                bool branches = (next.op == OP_BEQ || next.op == OP_BNE || next.op == OP_BLT);
+                const ThreadedInstruction* target = branches ? slotFor(next.target) : nullptr;
+                if (!branches || target)
+                {
+                    h = static_cast<Handler>(H_ADDI_BNE + (fused[i] - FUSE_ADDI_BNE));
+                    t.target = target;
+                    fusionSites[fused[i]]++;
+                }
+            }
+        }
+
+        t.handlerId = h;
+#if USE_COMPUTED_GOTO
+        t.handler = handlers[h];
+#endif
+    }
+
+    const ThreadedInstruction* ip = slotFor(PC);
+    if (!ip || halted) return;
+
+    // Every dispatch follows one finished instruction, and fused slots
+    // count their second one themselves
+    unsigned long long executed = 0;
+    
+    // A sampled run stops for samples after branches and jumps
+    const std::atomic<bool>* due = sampleDue;
+
+#define REG(n)        regFile.get(n)
+#define SET(n, v)     regFile.set(n, v)
+#define SREG(n)       static_cast<int>(regFile.get(n))
+#define ADDR_OF(slot) (TEXT_BASE + static_cast<unsigned int>((slot) - base) * 4)
+#define SAMPLE()      if (due && due->load(std::memory_order_relaxed)) { PC = ADDR_OF(ip); takeSample(); }
+#define BRANCH(cond)  ip = (cond) ? ip->target : ip + 1; SAMPLE(); DISPATCH()
+#define BRANCH2(cond) ip = (cond) ? ip->target : ip + 2; SAMPLE(); DISPATCH()
+#define HIT(s)        fusionHits[s]++
+
+#if USE_COMPUTED_GOTO
+#define HANDLER(name) L_##name:
+#define DISPATCH()    executed++; goto *ip->handler
+    goto *ip->handler;
+#else
+#define HANDLER(name) case H_##name:
+#define DISPATCH()    executed++; continue
+    for (;;)
+    {
+        switch (static_cast<Handler>(ip->handlerId))
+        {
+#endif
+
+    HANDLER(ADD)   SET(ip->d.rd, REG(ip->d.rs) + REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(SUB)   SET(ip->d.rd, REG(ip->d.rs) - REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(AND)   SET(ip->d.rd, REG(ip->d.rs) & REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(OR)    SET(ip->d.rd, REG(ip->d.rs) | REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(XOR)   SET(ip->d.rd, REG(ip->d.rs) ^ REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(NOR)   SET(ip->d.rd, ~(REG(ip->d.rs) | REG(ip->d.rt))); ++ip; DISPATCH();
+    HANDLER(SLT)   SET(ip->d.rd, SREG(ip->d.rs) < SREG(ip->d.rt) ? 1 : 0); ++ip; DISPATCH();
+    HANDLER(SLTU)  SET(ip->d.rd, REG(ip->d.rs) < REG(ip->d.rt) ? 1 : 0); ++ip; DISPATCH();
+    HANDLER(SLL)   SET(ip->d.rd, REG(ip->d.rt) << ip->d.imm); ++ip; DISPATCH();
+    HANDLER(SRL)   SET(ip->d.rd, REG(ip->d.rt) >> ip->d.imm); ++ip; DISPATCH();
+    HANDLER(SRA)   SET(ip->d.rd, static_cast<unsigned int>(SREG(ip->d.rt) >> ip->d.imm)); ++ip; DISPATCH();
+    HANDLER(MFHI)  SET(ip->d.rd, HI); ++ip; DISPATCH();
+    HANDLER(MFLO)  SET(ip->d.rd, LO); ++ip; DISPATCH();
+    HANDLER(JR)
+    {
+        unsigned int target = REG(ip->d.rs);
+        ip = slotFor(target);
+        if (!ip)
+        {
+            PC = target;
+            executed++;
+            goto done;
+        }
+        SAMPLE();
+        DISPATCH();
+    }
+    HANDLER(ADDI)  SET(ip->d.rt, REG(ip->d.rs) + ip->d.imm); ++ip; DISPATCH();
+    HANDLER(ANDI)  SET(ip->d.rt, REG(ip->d.rs) & ip->d.imm); ++ip; DISPATCH();
+    HANDLER(ORI)   SET(ip->d.rt, REG(ip->d.rs) | ip->d.imm); ++ip; DISPATCH();
+    HANDLER(XORI)  SET(ip->d.rt, REG(ip->d.rs) ^ ip->d.imm); ++ip; DISPATCH();
+    HANDLER(SLTI)  SET(ip->d.rt, SREG(ip->d.rs) < ip->d.imm ? 1 : 0); ++ip; DISPATCH();
+    HANDLER(SLTIU) SET(ip->d.rt, REG(ip->d.rs) < static_cast<unsigned int>(ip->d.imm) ? 1 : 0); ++ip; DISPATCH();
+    HANDLER(LI)    SET(ip->d.rt, ip->d.imm); ++ip; DISPATCH();
+    HANDLER(LW)    SET(ip->d.rt, mem.fetchWord(REG(ip->d.rs) + ip->d.imm)); ++ip; DISPATCH();
+    HANDLER(LH)    SET(ip->d.rt, static_cast<unsigned int>(static_cast<int>(static_cast<short>(mem.fetchHalfword(REG(ip->d.rs) + ip->d.imm))))); ++ip; DISPATCH();
+    HANDLER(LHU)   SET(ip->d.rt, mem.fetchHalfword(REG(ip->d.rs) + ip->d.imm)); ++ip; DISPATCH();
+    HANDLER(LB)    SET(ip->d.rt, static_cast<unsigned int>(static_cast<int>(static_cast<signed char>(mem.fetch(REG(ip->d.rs) + ip->d.imm))))); ++ip; DISPATCH();
+    HANDLER(LBU)   SET(ip->d.rt, mem.fetch(REG(ip->d.rs) + ip->d.imm)); ++ip; DISPATCH();
+    HANDLER(SW)    mem.storeWord(REG(ip->d.rs) + ip->d.imm, REG(ip->d.rt)); ++ip; DISPATCH();
+    HANDLER(SH)    mem.storeHalfword(REG(ip->d.rs) + ip->d.imm, static_cast<unsigned short>(REG(ip->d.rt))); ++ip; DISPATCH();
+    HANDLER(SB)    mem.store(REG(ip->d.rs) + ip->d.imm, static_cast<unsigned char>(REG(ip->d.rt))); ++ip; DISPATCH();
+    HANDLER(BEQ)   BRANCH(REG(ip->d.rs) == REG(ip->d.rt));
+    HANDLER(BNE)   BRANCH(REG(ip->d.rs) != REG(ip->d.rt));
+    HANDLER(BLT)   BRANCH(SREG(ip->d.rs) < SREG(ip->d.rt));
+    HANDLER(BLE)   BRANCH(SREG(ip->d.rs) <= SREG(ip->d.rt));
+    HANDLER(BGT)   BRANCH(SREG(ip->d.rs) > SREG(ip->d.rt));
+    HANDLER(BGE)   BRANCH(SREG(ip->d.rs) >= SREG(ip->d.rt));
+    HANDLER(BLTZ)  BRANCH(SREG(ip->d.rs) < 0);
+    HANDLER(BLEZ)  BRANCH(SREG(ip->d.rs) <= 0);
+    HANDLER(BGTZ)  BRANCH(SREG(ip->d.rs) > 0);
+    HANDLER(BGEZ)  BRANCH(SREG(ip->d.rs) >= 0);
+    HANDLER(J)     ip = ip->target; SAMPLE(); DISPATCH();
+    HANDLER(JAL)   SET(REG_RA, ADDR_OF(ip) + 4); ip = ip->target; SAMPLE(); DISPATCH();
+    HANDLER(MOVE)  SET(ip->d.rd, REG(ip->d.rs)); ++ip; DISPATCH();
+    HANDLER(NOT)   SET(ip->d.rd, ~REG(ip->d.rs)); ++ip; DISPATCH();
+    HANDLER(NOP)   ++ip; DISPATCH();
+    HANDLER(ADDI_BNE)
+        HIT(FUSE_ADDI_BNE);
+        executed++;
+        SET(ip->d.rt, REG(ip->d.rs) + ip->d.imm);
+        BRANCH2(REG(ip[1].d.rs) != REG(ip[1].d.rt));
+    HANDLER(ADDI_BEQ)
+        HIT(FUSE_ADDI_BEQ);
+        executed++;
+        SET(ip->d.rt, REG(ip->d.rs) + ip->d.imm);
+        BRANCH2(REG(ip[1].d.rs) == REG(ip[1].d.rt));
+    HANDLER(ADDI_BLT)
+        HIT(FUSE_ADDI_BLT);
+        executed++;
+        SET(ip->d.rt, REG(ip->d.rs) + ip->d.imm);
+        BRANCH2(SREG(ip[1].d.rs) < SREG(ip[1].d.rt));
+    HANDLER(ADDI_ADDI)
+        HIT(FUSE_ADDI_ADDI);
+        executed++;
+        SET(ip->d.rt, REG(ip->d.rs) + ip->d.imm);
+        SET(ip[1].d.rt, REG(ip[1].d.rs) + ip[1].d.imm);
+        ip += 2;
+        DISPATCH();
+    HANDLER(LW_ADDI)
+        HIT(FUSE_LW_ADDI);
+        executed++;
+        SET(ip->d.rt, mem.fetchWord(REG(ip->d.rs) + ip->d.imm));
+        SET(ip[1].d.rt, REG(ip[1].d.rs) + ip[1].d.imm);
+        ip += 2;
+        DISPATCH();
+    HANDLER(SLT_BEQ)
+        HIT(FUSE_SLT_BEQ);
+        executed++;
+        SET(ip->d.rd, SREG(ip->d.rs) < SREG(ip->d.rt) ? 1 : 0);
+        BRANCH2(REG(ip[1].d.rs) == REG(ip[1].d.rt));
+    HANDLER(SLT_BNE)
+        HIT(FUSE_SLT_BNE);
+        executed++;
+        SET(ip->d.rd, SREG(ip->d.rs) < SREG(ip->d.rt) ? 1 : 0);
+        BRANCH2(REG(ip[1].d.rs) != REG(ip[1].d.rt));
+    HANDLER(SLTI_BEQ)
+        HIT(FUSE_SLTI_BEQ);
+        executed++;
+        SET(ip->d.rt, SREG(ip->d.rs) < ip->d.imm ? 1 : 0);
+        BRANCH2(REG(ip[1].d.rs) == REG(ip[1].d.rt));
+    HANDLER(SLTI_BNE)
+        HIT(FUSE_SLTI_BNE);
+        executed++;
+        SET(ip->d.rt, SREG(ip->d.rs) < ip->d.imm ? 1 : 0);
+        BRANCH2(REG(ip[1].d.rs) != REG(ip[1].d.rt));
+    HANDLER(LI_SYSCALL)
+        HIT(FUSE_LI_SYSCALL);
+        executed++;
+        SET(REG_V0, ip->d.imm);
+        ++ip;
+        goto fallback;
+    HANDLER(FALLBACK)
+    fallback:
+    {
+        PC = ADDR_OF(ip);
+        execute(ip->d);
+        ip = halted ? nullptr : slotFor(PC);
+        if (!ip)
+        {
+            executed++;
+            goto done;
+        }
+        SAMPLE();
+        DISPATCH();
+    }
+    HANDLER(EXIT)
+    {
+        PC = ADDR_OF(ip);
+        goto done;
+    }
+
+#if !USE_COMPUTED_GOTO
+        }
+    }
+#endif
+
+done:
+    executedCount += executed;
+
+#undef HANDLER
+#undef DISPATCH
+#undef HIT
+#undef BRANCH2
+#undef BRANCH
+#undef SAMPLE
+#undef ADDR_OF
+#undef SREG
+#undef SET
+#undef REG
+}
+
+void MIPSInterpreter::displayFusionStats()
+{
+    std::cout << "\n=== Superinstructions (" << std::dec << blockCount << " basic blocks) ===\n" << std::setfill(' ');
+    std::cout << std::left << std::setw(18) << "fusion" << std::right
+              << std::setw(8) << "sites" << std::setw(16) << "executed" << "\n";
+    for (int s = FUSE_NONE + 1; s < FUSE_COUNT; s++)
+    {
+        if (fusionSites[s] == 0 && fusionHits[s] == 0) continue;
+        std::cout << std::left << std::setw(18) << superinstructionName(static_cast<Superinstruction>(s))
+                  << std::right << std::setw(8) << fusionSites[s]
+                  << std::setw(16) << fusionHits[s] << "\n";
+    }
+}
@@ -0,0 +1,121 @@
+/*
+File: tiered_engine.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+
+// Tiered execution: the switch interpreter counts how often each slot is
+// entered, and once a slot gets hot the straight-line code from there to the
+// end of its basic block is compiled to native code. Anything the JIT does
+// not handle (syscalls, division) ends the compiled block and is interpreted.
+
+void MIPSInterpreter::runTiered()
+{
+    const size_t count = prog->code.size();
+    
+    if (jitEnabled && !jit)
+    {
+        jit.reset(new JitCompiler());
+        if (!jit->available())
+        {
+            std::cerr << "Warning: JIT unavailable on this platform, interpreting" << std::endl;
+        }
+    }
+    bool compiling = jitEnabled && jit->available();
+    
+    // Blocks compiled for a sampled run must stop for samples, and others
+    // must not pay for the check, so switching discards what was compiled
+    if (compiling && jit->isInterruptible() != (sampleDue != nullptr))
+    {
+        jit->clear();
+        jit->setInterruptible(sampleDue != nullptr);
+        jitBlocks.clear();
+    }
+    
+    if (jitBlocks.size() != count)
+    {
+        jitBlocks.assign(count, nullptr);
+        jitHotness.assign(count, 0);
+        jitBlockEnd.assign(count, 0);
+        for (const BasicBlock& block : formBasicBlocks(prog->code, prog->labels, TEXT_BASE))
+        {
+            for (unsigned int i = block.first; i < block.end; i++)
+            {
+                jitBlockEnd[i] = block.end;
+            }
+        }
+    }
+    
+    JitContext ctx;
+    ctx.regs = regFile.data();
+    ctx.mem = &mem;
+    ctx.blocks = jitBlocks.data();
+    ctx.blockCount = static_cast<unsigned int>(count);
+    ctx.textBase = TEXT_BASE;
+    ctx.executed = 0;
+    ctx.interrupt = sampleDue;
+    unsigned long long interpreted = 0;
+    
+    while (!halted)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        if (sampleDue && sampleDue->load(std::memory_order_relaxed)) takeSample();
+        
+        JitBlock block = jitBlocks[index];
+        if (!block && compiling && jitHotness[index] < JIT_THRESHOLD &&
+            ++jitHotness[index] == JIT_THRESHOLD)
+        {
+            block = jitBlocks[index] = jit->compile(prog->code.data(), index, jitBlockEnd[index], PC);
+        }
+        
+        if (block)
+        {
+            ctx.hi = HI;
+            ctx.lo = LO;
+            PC = block(&ctx);
+            HI = ctx.hi;
+            LO = ctx.lo;
+        }
+        else
+        {
+            execute(prog->code[index]);
+            interpreted++;
+        }
+    }
+    executedCount += interpreted + ctx.executed;
+}
+
+size_t MIPSInterpreter::jitCompiledBlocks() const
+{
+    return jit ? jit->compiledBlocks() : 0;
+}
+
+bool MIPSInterpreter::compareState(const MIPSInterpreter& reference)
+{
+    bool same = true;
+    
+    for (int i = 0; i < 32; i++)
+    {
+        if (regFile.get(i) != reference.regFile.get(i))
+        {
+            std::cout << "Mismatch $" << std::dec << i << ": " << regFile.get(i)
+                      << " (expected " << reference.regFile.get(i) << ")\n";
+            same = false;
+        }
+    }
+    if (PC != reference.PC)
+    {
+        std::cout << "Mismatch PC: 0x" << std::hex << PC << " (expected 0x" << reference.PC << ")\n" << std::dec;
+        same = false;
+    }
+    if (HI != reference.HI || LO != reference.LO)
+    {
+        std::cout << "Mismatch HI/LO: " << HI << "/" << LO
+                  << " (expected " << reference.HI << "/" << reference.LO << ")\n";
+        same = false;
+    }
+    
+    return same;
+}
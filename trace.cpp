@@ -0,0 +1,477 @@
+/*
+File: trace.cpp
+Author: Brysen Landis
+*/
+
+#include "interpreter.h"
+#include "trace.h"
+#include "encoding.h"
+#include "mapped_file.h"
+#include "copy_loops.h"
+#include <cstdio>
+#include <cstring>
+
+// --trace runs the switch engine with one fixed-size record per instruction
+// appended to a plain buffer, so the interpreter thread does no encoding and
+// no I/O. Full buffers go to TraceWriter's thread, which delta-encodes them:
+// PC only when it does not follow the previous one, each register against
+// its own previous value, addresses against the previous address, all as
+// zigzag varints. Loop-heavy code comes to three to six bytes a record.
+
+static const char TRACE_MAGIC[8] = { 'M', 'I', 'P', 'S', 'T', 'R', 'C', 'E' };
+static const unsigned int TRACE_VERSION = 2;
+
+namespace
+{
+    // The header byte of an encoded record holds the TraceRecord flags and
+    const unsigned char SEQUENTIAL = 8;     // pc is the previous pc + 4
+    const unsigned int SIZE_SHIFT = 4;      // log2 of the access size
+    const unsigned char MEMORY = TraceRecord::LOADS | TraceRecord::STORES | TraceRecord::WRITES_BLOCK;
+    const unsigned int TRACE_REGISTERS = 34;
+
+    // Longest encoded record: header, opcode, register and four varints
+    const size_t MAX_ENCODED_RECORD = 3 + 4 * 5;
+
+    void putVarint(unsigned char*& out, unsigned int value)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = static_cast<unsigned char>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<unsigned char>(value);
+    }
+
+    // Small differences of either sign encode small
+    void putDelta(unsigned char*& out, unsigned int delta)
+    {
+        putVarint(out, (delta << 1) ^ static_cast<unsigned int>(static_cast<int>(delta) >> 31));
+    }
+
+    bool getVarint(const unsigned char*& in, const unsigned char* end, unsigned int& value)
+    {
+        value = 0;
+        for (unsigned int shift = 0; shift < 35; shift += 7)
+        {
+            if (in == end) return false;
+            unsigned char byte = *in++;
+            value |= static_cast<unsigned int>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+
+    bool getDelta(const unsigned char*& in, const unsigned char* end, unsigned int& delta)
+    {
+        unsigned int zigzag;
+        if (!getVarint(in, end, zigzag)) return false;
+        delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        return true;
+    }
+
+    const char* traceRegisterName(unsigned int reg)
+    {
+        return reg == 32 ? "$hi" : reg == 33 ? "$lo" : registerName(reg);
+    }
+}
+
+InstructionEffects effectsOf(const DecodedInstruction& d)
+{
+    const unsigned char HI_REG = 32, LO_REG = 33;
+    switch (d.op)
+    {
+        case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOR:
+        case OP_SLT: case OP_SLTU:
+        case OP_SLL: case OP_SRL: case OP_SRA: case OP_SLLV: case OP_SRLV: case OP_SRAV:
+        case OP_MFHI: case OP_MFLO: case OP_JALR:
+        case OP_MOVE: case OP_CLEAR: case OP_NOT:
+            return { d.rd, TraceRecord::WRITES_REGISTER, 0 };
+        case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU: case OP_MTLO:
+            return { LO_REG, TraceRecord::WRITES_REGISTER, 0 };
+        case OP_MTHI:
+            return { HI_REG, TraceRecord::WRITES_REGISTER, 0 };
+        case OP_ADDI: case OP_ADDIU: case OP_ANDI: case OP_ORI: case OP_XORI:
+        case OP_SLTI: case OP_SLTIU: case OP_LUI: case OP_LI: case OP_LA:
+            return { d.rt, TraceRecord::WRITES_REGISTER, 0 };
+        case OP_LW:
+            return { d.rt, TraceRecord::WRITES_REGISTER | TraceRecord::LOADS, 4 };
+        case OP_LH: case OP_LHU:
+            return { d.rt, TraceRecord::WRITES_REGISTER | TraceRecord::LOADS, 2 };
+        case OP_LB: case OP_LBU:
+            return { d.rt, TraceRecord::WRITES_REGISTER | TraceRecord::LOADS, 1 };
+        case OP_SW:
+            return { 0, TraceRecord::STORES, 4 };
+        case OP_SH:
+            return { 0, TraceRecord::STORES, 2 };
+        case OP_SB:
+            return { 0, TraceRecord::STORES, 1 };
+        case OP_JAL:
+            return { REG_RA, TraceRecord::WRITES_REGISTER, 0 };
+        case OP_SYSCALL:
+            return { REG_V0, TraceRecord::WRITES_REGISTER | TraceRecord::WRITES_BLOCK, 0 };
+        case OP_COPY_LOOP:
+            return { 0, TraceRecord::WRITES_BLOCK, 0 };
+        default:
+            return { 0, 0, 0 };
+    }
+}
+
+TraceWriter::TraceWriter(const std::string& path)
+    : file(path, std::ios::binary), finishing(false), written(0), bytes(0)
+{
+    if (!file.is_open()) return;
+    file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    file.write(reinterpret_cast<const char*>(&TRACE_VERSION), sizeof(TRACE_VERSION));
+    bytes = sizeof(TRACE_MAGIC) + sizeof(TRACE_VERSION);
+    writer = std::thread(&TraceWriter::writerLoop, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    finish();
+}
+
+std::vector<TraceRecord> TraceWriter::trade(std::vector<TraceRecord>&& full)
+{
+    std::vector<TraceRecord> empty;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        drained.wait(guard, [this] { return queue.size() < QUEUE_LIMIT; });
+        if (!full.empty()) queue.push_back(std::move(full));
+        if (!spare.empty())
+        {
+            empty = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    queued.notify_one();
+    empty.clear();
+    empty.reserve(BUFFER_RECORDS);
+    return empty;
+}
+
+bool TraceWriter::finish()
+{
+    if (!writer.joinable()) return file.good();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finishing = true;
+    }
+    queued.notify_one();
+    writer.join();
+    file.close();
+    return !file.fail();
+}
+
+void TraceWriter::writerLoop()
+{
+    std::vector<unsigned char> encoded;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        queued.wait(guard, [this] { return finishing || !queue.empty(); });
+        if (queue.empty()) return;
+        std::vector<TraceRecord> records = std::move(queue.front());
+        queue.pop_front();
+        guard.unlock();
+        drained.notify_one();
+
+        writeChunk(records, encoded);
+
+        guard.lock();
+        spare.push_back(std::move(records));
+    }
+}
+
+void TraceWriter::writeChunk(const std::vector<TraceRecord>& records, std::vector<unsigned char>& encoded)
+{
+    encoded.resize(records.size() * MAX_ENCODED_RECORD);
+    unsigned char* out = encoded.data();
+    unsigned int lastPC = 0;
+    unsigned int lastAddress = 0;
+    unsigned int regs[TRACE_REGISTERS] = {};
+    for (const TraceRecord& r : records)
+    {
+        const bool sequential = r.pc == lastPC + 4;
+        const unsigned int sizeBits = r.size == 4 ? 2 : r.size == 2 ? 1 : 0;
+        *out++ = static_cast<unsigned char>(r.flags | (sequential ? SEQUENTIAL : 0) | (sizeBits << SIZE_SHIFT));
+        *out++ = r.op;
+        if (!sequential) putDelta(out, r.pc - (lastPC + 4));
+        lastPC = r.pc;
+        if (r.flags & TraceRecord::WRITES_REGISTER)
+        {
+            *out++ = r.reg;
+            putDelta(out, r.value - regs[r.reg]);
+            regs[r.reg] = r.value;
+        }
+        if (r.flags & MEMORY)
+        {
+            putDelta(out, r.address - lastAddress);
+            lastAddress = r.address;
+        }
+        // A load's data is the register value already written
+        if (r.flags & (TraceRecord::STORES | TraceRecord::WRITES_BLOCK)) putVarint(out, r.data);
+    }
+
+    const size_t length = static_cast<size_t>(out - encoded.data());
+    const unsigned int header[2] = { static_cast<unsigned int>(records.size()), static_cast<unsigned int>(length) };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(encoded.data()), static_cast<std::streamsize>(length));
+    written += records.size();
+    bytes += sizeof(header) + length;
+}
+
+void MIPSInterpreter::runTraced()
+{
+    TraceWriter writer(tracePath);
+    if (!writer.isOpen())
+    {
+        std::cerr << "Error: Cannot write trace " << tracePath << std::endl;
+        return;
+    }
+
+    const DecodedInstruction* code = prog->code.data();
+    const size_t count = prog->code.size();
+    std::vector<InstructionEffects> slots(count);
+    for (size_t i = 0; i < count; i++) slots[i] = effectsOf(code[i]);
+
+    std::vector<TraceRecord> buffer = writer.trade({});
+    unsigned long long executed = 0;
+    while (!halted)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        const DecodedInstruction& d = code[index];
+        const InstructionEffects slot = slots[index];
+
+        TraceRecord r;
+        r.pc = PC;
+        r.op = d.op;
+        r.reg = slot.reg;
+        r.flags = slot.flags;
+        r.size = slot.size;
+        r.value = 0;
+        r.address = 0;
+        r.data = 0;
+        if (slot.flags & (TraceRecord::LOADS | TraceRecord::STORES)) r.address = regFile.get(d.rs) + d.imm;
+        if (slot.flags & TraceRecord::STORES)
+        {
+            r.data = regFile.get(d.rt);
+            if (slot.size < 4) r.data &= (1u << (slot.size * 8)) - 1;
+        }
+
+        // Arguments of a syscall, or a copy loop's destination and first
+        // load address, to find the span written once it has run
+        unsigned int service = 0, a0 = 0, a1 = 0, a2 = 0;
+        if (slot.flags & TraceRecord::WRITES_BLOCK)
+        {
+            if (d.op == OP_COPY_LOOP)
+            {
+                const CopyLoop& loop = prog->copyLoops[d.imm];
+                a0 = regFile.get(loop.dst);
+                a1 = regFile.get(loop.load.rs) + loop.load.imm;
+            }
+            else
+            {
+                service = regFile.get(REG_V0);
+                a0 = regFile.get(REG_A0);
+                a1 = regFile.get(REG_A1);
+                a2 = regFile.get(REG_A2);
+            }
+        }
+
+        execute(d);
+        executed++;
+
+        if (slot.flags & TraceRecord::WRITES_REGISTER)
+        {
+            r.value = slot.reg == 32 ? HI : slot.reg == 33 ? LO : regFile.get(slot.reg);
+            if (slot.flags & TraceRecord::LOADS) r.data = r.value;
+        }
+        if (slot.flags & TraceRecord::WRITES_BLOCK)
+        {
+            unsigned int start = 0, length = 0;
+            if (d.op == OP_COPY_LOOP)
+            {
+                const CopyLoop& loop = prog->copyLoops[d.imm];
+                if (PC == loop.exit)
+                {
+                    start = a0;
+                    length = regFile.get(loop.dst) - a0;
+                }
+                else
+                {
+                    // The loop could not be fused this time and ran its first load
+                    const InstructionEffects load = effectsOf(loop.load);
+                    r.op = loop.load.op;
+                    r.reg = load.reg;
+                    r.flags = load.flags;
+                    r.size = load.size;
+                    r.address = a1;
+                    r.value = r.data = regFile.get(load.reg);
+                }
+            }
+            else if (service == 8 && static_cast<int>(a1) > 0)
+            {
+                start = a0;
+                length = std::min(static_cast<unsigned int>(mem.stringLength(a0)) + 1, a1);
+            }
+            else if (service == 14 && static_cast<int>(regFile.get(REG_V0)) > 0)
+            {
+                start = a1;
+                length = regFile.get(REG_V0);
+            }
+            else if (service == 100 || service == 101)
+            {
+                start = a0;
+                length = a2;
+            }
+            r.flags &= ~TraceRecord::WRITES_BLOCK;
+            if (length > 0)
+            {
+                r.flags |= TraceRecord::WRITES_BLOCK;
+                r.address = start;
+                r.data = length;
+            }
+        }
+        buffer.push_back(r);
+        if (buffer.size() == TraceWriter::BUFFER_RECORDS) buffer = writer.trade(std::move(buffer));
+    }
+    executedCount += executed;
+    flushOutput();
+
+    writer.trade(std::move(buffer));
+    if (!writer.finish())
+    {
+        std::cerr << "Error: Cannot write trace " << tracePath << std::endl;
+        return;
+    }
+    *messages << "Trace written to " << tracePath << ": " << writer.recordsWritten() << " records, "
+              << writer.bytesWritten() << " bytes" << std::endl;
+}
+
+namespace
+{
+    // Appends the records of one chunk to text, skipping those outside
+    // [from, to] if filtered; false if the chunk does not decode
+    bool printChunk(const unsigned char* in, const unsigned char* end, unsigned int records,
+                    bool filtered, unsigned int from, unsigned int to, std::string& text)
+    {
+        unsigned int lastPC = 0;
+        unsigned int lastAddress = 0;
+        unsigned int regs[TRACE_REGISTERS] = {};
+        char line[128];
+        for (unsigned int n = 0; n < records; n++)
+        {
+            if (end - in < 2) return false;
+            const unsigned char head = *in++;
+            const unsigned char op = *in++;
+            if (op >= OP_COUNT) return false;
+
+            unsigned int pc = lastPC + 4;
+            unsigned int delta;
+            if (!(head & SEQUENTIAL))
+            {
+                if (!getDelta(in, end, delta)) return false;
+                pc += delta;
+            }
+            lastPC = pc;
+
+            unsigned int reg = 0, value = 0, address = 0, data = 0;
+            if (head & TraceRecord::WRITES_REGISTER)
+            {
+                if (in == end || (reg = *in++) >= TRACE_REGISTERS || !getDelta(in, end, delta)) return false;
+                value = regs[reg] += delta;
+            }
+            const bool memory = head & MEMORY;
+            if (memory)
+            {
+                if (!getDelta(in, end, delta)) return false;
+                address = lastAddress += delta;
+            }
+            if ((head & (TraceRecord::STORES | TraceRecord::WRITES_BLOCK)) && !getVarint(in, end, data)) return false;
+
+            // A block is in range if any byte of it is
+            unsigned int last = address;
+            if (head & TraceRecord::WRITES_BLOCK) last = address + (data - 1) < address ? ~0u : address + (data - 1);
+            if (filtered && !(pc >= from && pc <= to) && !(memory && address <= to && last >= from)) continue;
+
+            int length = std::snprintf(line, sizeof(line), "0x%08x  %-8s", pc, mnemonic(static_cast<Opcode>(op)));
+            text.append(line, static_cast<size_t>(length));
+            if (head & TraceRecord::WRITES_REGISTER)
+            {
+                length = std::snprintf(line, sizeof(line), " %s = 0x%08x", traceRegisterName(reg), value);
+                text.append(line, static_cast<size_t>(length));
+            }
+            if (head & TraceRecord::LOADS)
+            {
+                length = std::snprintf(line, sizeof(line), "  <- [0x%08x]", address);
+                text.append(line, static_cast<size_t>(length));
+            }
+            if (head & TraceRecord::STORES)
+            {
+                length = std::snprintf(line, sizeof(line), " [0x%08x] <- 0x%0*x", address,
+                                       2 << ((head >> SIZE_SHIFT) & 3), data);
+                text.append(line, static_cast<size_t>(length));
+            }
+            if (head & TraceRecord::WRITES_BLOCK)
+            {
+                length = std::snprintf(line, sizeof(line), "  [0x%08x] <- %u bytes", address, data);
+                text.append(line, static_cast<size_t>(length));
+            }
+            while (text.back() == ' ') text.pop_back();
+            text += '\n';
+        }
+        return in == end;
+    }
+}
+
+int printTrace(const std::string& path, unsigned int from, unsigned int to)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        std::cerr << "Error: Cannot open trace " << path << std::endl;
+        return 1;
+    }
+    const unsigned char* in = file.data();
+    const unsigned char* end = in + file.size();
+    unsigned int version = 0;
+    bool valid = file.size() >= sizeof(TRACE_MAGIC) + sizeof(version);
+    if (valid)
+    {
+        std::memcpy(&version, in + sizeof(TRACE_MAGIC), sizeof(version));
+        valid = std::memcmp(in, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && version == TRACE_VERSION;
+    }
+    if (!valid)
+    {
+        std::cerr << "Error: " << path << " is not a trace this interpreter can read" << std::endl;
+        return 1;
+    }
+    in += sizeof(TRACE_MAGIC) + sizeof(version);
+
+    std::string text;
+    while (in != end)
+    {
+        unsigned int header[2];    // records, bytes
+        if (static_cast<size_t>(end - in) < sizeof(header) ||
+            (std::memcpy(header, in, sizeof(header)), static_cast<size_t>(end - in) - sizeof(header) < header[1]))
+        {
+            std::fwrite(text.data(), 1, text.size(), stdout);
+            std::cerr << "Error: " << path << " ends partway through a chunk" << std::endl;
+            return 1;
+        }
+        in += sizeof(header);
+        valid = printChunk(in, in + header[1], header[0], from <= to, from, to, text);
+        in += header[1];
+        std::fwrite(text.data(), 1, text.size(), stdout);
+        text.clear();
+        if (!valid)
+        {
+            std::cerr << "Error: " << path << " holds a corrupt chunk" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+File: trace.h
+Author: Brysen Landis
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "instruction.h"
+
+// One executed instruction. Register 32 is HI and 33 is LO; multiplies and
+// divides record LO. A syscall that fills memory (8, 14, 100 and 101) or a
+// fused copy loop records the span it wrote as WRITES_BLOCK, without the
+// bytes themselves; the allocator syscalls' header words and realloc's copy
+// are not recorded.
+struct TraceRecord
+{
+    enum Flags : unsigned char
+    {
+        WRITES_REGISTER = 1,
+        LOADS = 2,
+        STORES = 4,
+        WRITES_BLOCK = 64
+    };
+
+    unsigned int pc;
+    Opcode op;
+    unsigned char reg;          // with WRITES_REGISTER
+    unsigned char flags;
+    unsigned char size;         // bytes loaded or stored
+    unsigned int value;         // new value of reg
+    unsigned int address;       // with LOADS, STORES or WRITES_BLOCK
+    unsigned int data;          // value stored, reg's value after a load, or bytes in the block
+};
+
+// What an instruction changes besides PC: with WRITES_REGISTER, the register
+// it writes (32 is HI, 33 LO; multiplies and divides record LO and syscalls
+// $v0), with LOADS or STORES the access size in bytes, and with WRITES_BLOCK
+// that it may write a span of memory only known once it has run
+struct InstructionEffects
+{
+    unsigned char reg;
+    unsigned char flags;        // TraceRecord::Flags
+    unsigned char size;
+};
+
+InstructionEffects effectsOf(const DecodedInstruction& d);
+
+// Writes trace files on a thread of its own. Producers fill a buffer of
+// records and trade it in when full; the writer thread delta-encodes each
+// buffer into a chunk and appends it to the file. Producers only wait if the
+// writer falls more than QUEUE_LIMIT buffers behind.
+//
+// A trace file is an 8-byte magic and a version word, then chunks of a
+// record count, a byte count and that many bytes of records. Every chunk
+// starts from zeroed delta state, so chunks decode independently.
+class TraceWriter
+{
+public:
+    static const size_t BUFFER_RECORDS = 1 << 16;
+    static const size_t QUEUE_LIMIT = 64;
+
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Queues full (which may be partly filled) and returns an empty buffer
+    // with room for BUFFER_RECORDS
+    std::vector<TraceRecord> trade(std::vector<TraceRecord>&& full);
+
+    // Writes everything queued and closes the file; false on a write error
+    bool finish();
+
+    unsigned long long recordsWritten() const { return written; }
+    unsigned long long bytesWritten() const { return bytes; }
+
+private:
+    std::ofstream file;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable queued;     // a buffer was queued, or finishing
+    std::condition_variable drained;    // a buffer was taken off the queue
+    std::deque<std::vector<TraceRecord>> queue;
+    std::vector<std::vector<TraceRecord>> spare;
+    bool finishing;
+    unsigned long long written;
+    unsigned long long bytes;
+
+    void writerLoop();
+    void writeChunk(const std::vector<TraceRecord>& records, std::vector<unsigned char>& encoded);
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+};
+
+// Prints a trace file as text, one line per record. With from <= to, only
+// records whose PC or memory address lies in [from, to]. Returns the process
+// exit code.
+int printTrace(const std::string& path, unsigned int from, unsigned int to);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+File: undo_log.cpp
+Author: Brysen Landis
+*/
+
+#include "undo_log.h"
+#include "trace.h"
+
+namespace
+{
+    // Syscalls that read input or use host files; running forward must
+    // never repeat them, so a snapshot follows each
+    bool usesHost(unsigned int v0)
+    {
+        return v0 == 5 || v0 == 8 || v0 == 12 || (v0 >= 13 && v0 <= 16);
+    }
+
+    // Syscalls that change machine state without the host: sbrk, exit and
+    // the block memory and heap extensions. Every other syscall only prints,
+    // or does nothing, and is skipped when running forward.
+    bool changesState(unsigned int v0)
+    {
+        return v0 == 9 || v0 == 10 || (v0 >= 100 && v0 <= 106);
+    }
+}
+
+UndoLog::UndoLog()
+    : entries(CAPACITY), position(0), ringStart(0), executedAt(0), program(nullptr)
+{
+}
+
+void UndoLog::clear()
+{
+    snapshots.clear();
+    position = 0;
+    ringStart = 0;
+    executedAt = 0;
+    program = nullptr;
+}
+
+bool Machine::runRecorded(UndoLog& log, unsigned long long limit)
+{
+    const DecodedInstruction* code = debugCode();
+    const size_t count = prog->code.size();
+    if (log.program != prog.get())
+    {
+        // Once per program; loading another clears the log
+        log.program = prog.get();
+        log.slots.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const DecodedInstruction& d = instructionAt(i);
+            const InstructionEffects effects = effectsOf(d);
+            UndoLog::SlotUndo& slot = log.slots[i];
+            slot.kind = UndoLog::NOTHING;
+            slot.reg = effects.reg;
+            if (d.op == OP_SYSCALL || d.op == OP_COPY_LOOP)
+            {
+                slot.kind = UndoLog::REPLAY;
+            }
+            else if (effects.flags & TraceRecord::STORES)
+            {
+                slot.kind = UndoLog::MEMORY;
+                slot.reg = effects.size;
+            }
+            else if (effects.flags & TraceRecord::WRITES_REGISTER)
+            {
+                slot.kind = effects.reg < 32 ? UndoLog::REGISTER : UndoLog::HI_LO;
+                if (d.op == OP_MULT || d.op == OP_MULTU || d.op == OP_DIV || d.op == OP_DIVU)
+                {
+                    slot.reg = UndoLog::BOTH;
+                }
+            }
+        }
+    }
+    if (log.snapshots.empty() || log.executedAt != executedCount)
+    {
+        log.clear();
+        log.program = prog.get();
+        log.snapshots.push_back({0, snapshot()});
+    }
+
+    // Counters kept locally, since execute() could change anything in memory
+    UndoLog::Entry* ring = log.entries.data();
+    const UndoLog::SlotUndo* slots = log.slots.data();
+    unsigned long long position = log.position;
+    unsigned long long nextSnapshot = log.snapshots.back().step + UndoLog::SNAPSHOT_INTERVAL;
+    const unsigned long long start = position;
+    const unsigned long long end = position + limit < position ? ~0ULL : position + limit;
+    while (!halted && position < end)
+    {
+        unsigned int index = (PC - TEXT_BASE) >> 2;
+        if ((PC & 3) != 0 || index >= count) break;
+        
+        // Stops at a breakpoint, unless the run starts on it
+        if (code[index].op == OP_BREAKPOINT && position != start) break;
+        const DecodedInstruction& d = instructionAt(index);
+        const UndoLog::SlotUndo slot = slots[index];
+
+        UndoLog::Entry& entry = ring[position % UndoLog::CAPACITY];
+        entry.pc = PC;
+        entry.kind = slot.kind;
+        entry.reg = slot.reg;
+        bool host = false;
+        switch (slot.kind)
+        {
+            case UndoLog::REGISTER:
+                entry.old = regFile.get(slot.reg);
+                break;
+            case UndoLog::HI_LO:
+                entry.address = HI;
+                entry.old = LO;
+                break;
+            case UndoLog::MEMORY:
+                entry.address = regFile.get(d.rs) + d.imm;
+                entry.old = slot.reg == 4 ? mem.fetchWord(entry.address) :
+                            slot.reg == 2 ? mem.fetchHalfword(entry.address) : mem.fetch(entry.address);
+                break;
+            case UndoLog::REPLAY:
+                if (d.op == OP_SYSCALL)
+                {
+                    unsigned int v0 = regFile.get(REG_V0);
+                    host = usesHost(v0);
+                    if (!host && !changesState(v0)) entry.kind = UndoLog::NOTHING;
+                }
+                break;
+            default:
+                break;
+        }
+
+        execute(d);
+        executedCount++;
+        position++;
+
+        if (host || position == nextSnapshot)
+        {
+            log.snapshots.push_back({position, snapshot()});
+            nextSnapshot = position + UndoLog::SNAPSHOT_INTERVAL;
+            if (log.snapshots.size() > UndoLog::MAX_SNAPSHOTS)
+            {
+                log.snapshots.pop_front();
+                log.ringStart = std::max(log.ringStart, log.snapshots.front().step);
+            }
+        }
+    }
+    log.position = position;
+    if (position - log.ringStart > UndoLog::CAPACITY) log.ringStart = position - UndoLog::CAPACITY;
+    log.executedAt = executedCount;
+    flushOutput();
+    unsigned int index = (PC - TEXT_BASE) >> 2;
+    return !halted && (PC & 3) == 0 && index < count;
+}
+
+void Machine::seek(UndoLog& log, unsigned long long step)
+{
+    while (log.snapshots.back().step > step) log.snapshots.pop_back();
+    const UndoLog::SavedState& saved = log.snapshots.back();
+    restore(saved.state);
+
+    // Nothing between a snapshot and the next one uses the host, and
+    // console output was printed the first time through
+    for (unsigned long long s = saved.step; s < step; s++)
+    {
+        const DecodedInstruction& d = instructionAt((PC - TEXT_BASE) >> 2);
+        if (d.op == OP_SYSCALL && !changesState(regFile.get(REG_V0)))
+        {
+            PC += 4;
+        }
+        else
+        {
+            execute(d);
+        }
+        executedCount++;
+    }
+    log.position = step;
+    log.ringStart = std::min(log.ringStart, step);
+    log.executedAt = executedCount;
+}
+
+void Machine::rewindTo(UndoLog& log, unsigned long long step)
+{
+    const UndoLog::Entry* ring = log.entries.data();
+    bool replaying = step < log.ringStart;
+    for (unsigned long long s = step; !replaying && s < log.position; s++)
+    {
+        replaying = ring[s % UndoLog::CAPACITY].kind == UndoLog::REPLAY;
+    }
+
+    if (replaying)
+    {
+        seek(log, step);
+        return;
+    }
+
+    while (log.position > step)
+    {
+        const UndoLog::Entry& entry = ring[--log.position % UndoLog::CAPACITY];
+        switch (entry.kind)
+        {
+            case UndoLog::REGISTER:
+                regFile.set(entry.reg, entry.old);
+                break;
+            case UndoLog::HI_LO:
+                HI = entry.address;
+                LO = entry.old;
+                break;
+            case UndoLog::MEMORY:
+                if (entry.reg == 4) mem.storeWord(entry.address, entry.old);
+                else if (entry.reg == 2) mem.storeHalfword(entry.address, static_cast<unsigned short>(entry.old));
+                else mem.store(entry.address, static_cast<unsigned char>(entry.old));
+                break;
+            default:
+                break;
+        }
+        PC = entry.pc;
+        executedCount--;
+    }
+    while (log.snapshots.back().step > step) log.snapshots.pop_back();
+    log.executedAt = executedCount;
+}
+
+unsigned long long Machine::stepBack(UndoLog& log, unsigned long long count)
+{
+    if (log.snapshots.empty() || log.executedAt != executedCount) return 0;
+    count = std::min(count, log.depth());
+    rewindTo(log, log.position - count);
+    return count;
+}
+
+bool Machine::reverseToRegisterWrite(UndoLog& log, unsigned int reg)
+{
+    return reverseToWrite(log, false, reg, 0, 0);
+}
+
+bool Machine::reverseToMemoryWrite(UndoLog& log, unsigned int addr, unsigned int length)
+{
+    return reverseToWrite(log, true, 0, addr, length);
+}
+
+bool Machine::reverseToWrite(UndoLog& log, bool memory, unsigned int reg, unsigned int addr, unsigned int length)
+{
+    if (log.snapshots.empty() || log.executedAt != executedCount) return false;
+
+    // Whether a logged kind of write reaches the target; MEMORY writes are
+    // size bytes at address
+    const unsigned long long last = static_cast<unsigned long long>(addr) + length;
+    auto writes = [&](UndoLog::Kind kind, unsigned char size, unsigned int address)
+    {
+        if (memory) return kind == UndoLog::MEMORY && address < last && addr < address + static_cast<unsigned long long>(size);
+        return (kind == UndoLog::REGISTER && size == reg) ||
+               (kind == UndoLog::HI_LO && (size == reg || (size == UndoLog::BOTH && reg >= 32)));
+    };
+
+    // The target's contents, to spot writes by syscalls and copy loops
+    auto contents = [&]()
+    {
+        std::vector<unsigned char> bytes(memory ? length : sizeof(unsigned int));
+        if (memory)
+        {
+            mem.readBlock(addr, bytes.data(), bytes.size());
+        }
+        else
+        {
+            unsigned int value = reg == 32 ? HI : reg == 33 ? LO : regFile.get(static_cast<int>(reg));
+            std::memcpy(bytes.data(), &value, sizeof(value));
+        }
+        return bytes;
+    };
+
+    // Back through the log until an instruction it cannot undo directly
+    const unsigned long long oldest = log.snapshots.front().step;
+    while (log.position > std::max(log.ringStart, oldest))
+    {
+        const UndoLog::Entry& entry = log.entries[(log.position - 1) % UndoLog::CAPACITY];
+        if (entry.kind == UndoLog::REPLAY) break;
+        bool wrote = writes(entry.kind, entry.reg, entry.address);
+        rewindTo(log, log.position - 1);
+        if (wrote) return true;
+    }
+
+    // Then forward from each snapshot in turn, newest first, remembering the
+    // last write seen before the end of its stretch
+    unsigned long long end = log.position;
+    for (size_t i = log.snapshots.size(); i-- > 0 && end > oldest; )
+    {
+        const UndoLog::SavedState& saved = log.snapshots[i];
+        if (saved.step >= end) continue;
+        restore(saved.state);
+        unsigned long long found = end;
+        for (unsigned long long step = saved.step; step < end; step++)
+        {
+            const unsigned int index = (PC - TEXT_BASE) >> 2;
+            const DecodedInstruction& d = instructionAt(index);
+            const UndoLog::SlotUndo slot = log.slots[index];
+            if (slot.kind == UndoLog::REPLAY)
+            {
+                if (d.op == OP_SYSCALL && !changesState(regFile.get(REG_V0)))
+                {
+                    PC += 4;
+                }
+                else
+                {
+                    std::vector<unsigned char> before = contents();
+                    execute(d);
+                    if (contents() != before) found = step;
+                }
+            }
+            else
+            {
+                if (writes(slot.kind, slot.reg, regFile.get(d.rs) + d.imm)) found = step;
+                execute(d);
+            }
+            executedCount++;
+        }
+        if (found != end)
+        {
+            seek(log, found);
+            return true;
+        }
+        end = saved.step;
+    }
+    seek(log, oldest);
+    return false;
+}
@@ -0,0 +1,92 @@
+/*
+File: undo_log.h
+Author: Brysen Landis
+*/
+
+#ifndef UNDO_LOG_H
+#define UNDO_LOG_H
+
+#include <deque>
+#include <vector>
+#include "machine.h"
+
+// History of one Machine for stepping backwards, kept by
+// Machine::runRecorded() (undo_log.cpp).
+//
+// Every instruction logs the one thing it overwrites, a register, HI and LO,
+// or up to a word of memory, in a ring of the last CAPACITY instructions, and
+// stepping back puts those values back. Syscalls and fused copy loops change
+// too much to log that way; they are undone by restoring the latest full
+// snapshot before them and running forward again. Snapshots are taken every
+// SNAPSHOT_INTERVAL instructions and after each syscall that reads input or
+// uses a file, so running forward never repeats host I/O, and console output
+// is skipped. The oldest of MAX_SNAPSHOTS snapshots bounds how far back
+// history reaches; past the ring, stepping back always runs forward from a
+// snapshot.
+class UndoLog
+{
+public:
+    static const size_t CAPACITY = 1 << 20;
+    static const unsigned long long SNAPSHOT_INTERVAL = 1 << 20;
+    static const size_t MAX_SNAPSHOTS = 256;
+
+    UndoLog();
+
+    // Forgets all history; the next recorded run starts a new one
+    void clear();
+
+    // Instructions the machine can step back through
+    unsigned long long depth() const
+    {
+        return snapshots.empty() ? 0 : position - snapshots.front().step;
+    }
+
+private:
+    friend class Machine;
+
+    enum Kind : unsigned char
+    {
+        NOTHING,    // only PC changes
+        REGISTER,
+        HI_LO,
+        MEMORY,
+        REPLAY      // undone by running forward from a snapshot
+    };
+
+    // Register numbers of HI_LO entries: 32 for HI, 33 for LO, BOTH for
+    // multiplies and divides
+    static const unsigned char BOTH = 34;
+
+    struct Entry
+    {
+        unsigned int pc;
+        Kind kind;
+        unsigned char reg;      // REGISTER and HI_LO: register; MEMORY: bytes stored
+        unsigned int address;   // MEMORY: address; HI_LO: old HI
+        unsigned int old;       // old register, LO or memory value
+    };
+
+    // What the instruction in each slot of the program logs
+    struct SlotUndo
+    {
+        Kind kind;
+        unsigned char reg;
+    };
+
+    struct SavedState
+    {
+        unsigned long long step;
+        Machine::Snapshot state;
+    };
+
+    std::vector<Entry> entries;         // step s at entries[s % CAPACITY]
+    std::deque<SavedState> snapshots;   // oldest first
+    unsigned long long position;        // steps recorded; the machine is at this step
+    unsigned long long ringStart;       // oldest step with an entry
+    unsigned long long executedAt;      // the machine's instruction count at position
+
+    const Program* program;             // the program slots describes
+    std::vector<SlotUndo> slots;
+};
+
+#endif